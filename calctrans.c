@@ -38,6 +38,7 @@ main(int argc, char *argv[])
 {
   unsigned int n1, n2, np;
   unsigned int cols1[]={1,2}, cols2[]={1,2};
+  char *names1[]={NULL,NULL}, *names2[]={NULL,NULL};
   char **argptr, *filename1=NULL, *filename2=NULL;
   double *d1ptr[2], *d2ptr[2], paramx[3], paramy[3], x, y;
   char *fs1, *fs2;
@@ -49,10 +50,10 @@ main(int argc, char *argv[])
   if (argc<3) {
     printf("Format:\n\n   calctrans file1 file2 [options]\n\n\
    where the options can appear anywhere in any order:\n\n\
-   -x1 column          column to read x-coordinate from file 1 - default %d\n\
-   -y1 column          column to read y-coordinate from file 1 - default %d\n\
-   -x2 column          column to read x-coordinate from file 2 - default %d\n\
-   -y2 column          column to read y-coordinate from file 2 - default %d\n\
+   -x1 col|name        column to read x-coordinate from file 1 - default %d\n\
+   -y1 col|name        column to read y-coordinate from file 1 - default %d\n\
+   -x2 col|name        column to read x-coordinate from file 2 - default %d\n\
+   -y2 col|name        column to read y-coordinate from file 2 - default %d\n\
    -x  x-coord         x-coord to transform\n\
    -y  y-coord         x-coord to transform\n\
    -fs  FS             field separator - default space/TAB\n\
@@ -72,19 +73,19 @@ main(int argc, char *argv[])
   for (argptr=argv+1;argptr<argv+argc;argptr++) {
     if (strstr(*argptr,"-x1")) {
       if (++argptr<argv+argc) {
-	cols1[0]=atoi(*argptr);
+	loadfile_column(*argptr,cols1+0,names1+0);
       }
     } else if (strstr(*argptr,"-y1")) {
       if (++argptr<argv+argc) {
-	cols1[1]=atoi(*argptr);
+	loadfile_column(*argptr,cols1+1,names1+1);
       }
     } else if (strstr(*argptr,"-x2")) {
       if (++argptr<argv+argc) {
-	cols2[0]=atoi(*argptr);
+	loadfile_column(*argptr,cols2+0,names2+0);
       } 
     } else if (strstr(*argptr,"-y2")) {
       if (++argptr<argv+argc) {
-	cols2[1]=atoi(*argptr);
+	loadfile_column(*argptr,cols2+1,names2+1);
       }
     } else if (strstr(*argptr,"-x")) {
       if (++argptr<argv+argc) {
@@ -142,17 +143,17 @@ main(int argc, char *argv[])
   }
 
   if (strcmp(filename1,"-")) {
-    n1=loadfile_fs(filename1,2,cols1,d1ptr,fs1);
+    n1=loadfile_named_fs(filename1,2,cols1,names1,d1ptr,fs1);
   } else {
-    n1=loadfile_fileptr_fs(stdin,2,cols1,d1ptr,fs1);
+    n1=loadfile_named_fileptr_fs(stdin,2,cols1,names1,d1ptr,fs1);
   }
 
   if (filename2==NULL)  { filename2=filename1; }
 
   if (strcmp(filename2,"-")) {
-    n2=loadfile_fs(filename2,2,cols2,d2ptr,fs2); 
+    n2=loadfile_named_fs(filename2,2,cols2,names2,d2ptr,fs2); 
   } else {
-    n2=loadfile_fileptr_fs(stdin,2,cols2,d2ptr,fs2); 
+    n2=loadfile_named_fileptr_fs(stdin,2,cols2,names2,d2ptr,fs2); 
   }
 
   np = (n1<n2 ? n1 : n2);
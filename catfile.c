@@ -0,0 +1,407 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include "catfile.h"
+
+#define ALIGN8(x) (((x)+7)&~((unsigned long long) 7))
+
+static int
+host_le(void) {
+  unsigned int one=1;
+  return *((unsigned char *) &one);
+}
+
+static unsigned long long
+get64(const char *p) {
+  unsigned long long v=0;
+  int i;
+
+  for (i=7;i>=0;i--) {
+    v=(v<<8)|(unsigned char) p[i];
+  }
+  return v;
+}
+
+static unsigned int
+get32(const char *p) {
+  return ((unsigned int) (unsigned char) p[0]) | ((unsigned int) (unsigned char) p[1])<<8 |
+    ((unsigned int) (unsigned char) p[2])<<16 | ((unsigned int) (unsigned char) p[3])<<24;
+}
+
+static double
+getdouble(const char *p) {
+  unsigned long long v=get64(p);
+  double d;
+
+  memcpy(&d,&v,sizeof(d));
+  return d;
+}
+
+static void
+put64(char *p, unsigned long long v) {
+  int i;
+
+  for (i=0;i<8;i++) {
+    p[i]=(char) (v&0xff);
+    v>>=8;
+  }
+}
+
+static void
+put32(char *p, unsigned int v) {
+  int i;
+
+  for (i=0;i<4;i++) {
+    p[i]=(char) (v&0xff);
+    v>>=8;
+  }
+}
+
+int
+catfile_check(const char *buf, size_t len) {
+  return (len>=CATFILE_HEADER && memcmp(buf,CATFILE_MAGIC,8)==0);
+}
+
+int
+catfile_open(const char *buf, size_t len, struct catfile *cf) {
+  const char *d;
+  unsigned long long offset, length, size;
+  unsigned int i;
+
+  cf->column=NULL;
+  if (!catfile_check(buf,len)) {
+    printf("Not a binary catalogue at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  if (get32(buf+8)!=CATFILE_VERSION) {
+    printf("Binary catalogue version %u is not supported at %s:%d\n",get32(buf+8),__FILE__,__LINE__);
+    return -1;
+  }
+  cf->buf=buf;
+  cf->len=len;
+  cf->ncolumns=get32(buf+12);
+  cf->nrows=get64(buf+16);
+  cf->lon=get32(buf+24);
+  cf->lat=get32(buf+28);
+  offset=get64(buf+32);
+  cf->unitvec=NULL;
+  cf->text=-1;
+  if (CATFILE_HEADER+(unsigned long long) CATFILE_DESCRIPTOR*cf->ncolumns>len) {
+    printf("Binary catalogue is truncated at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  if (offset) {
+    if (offset+24*cf->nrows>len) {
+      printf("Binary catalogue is truncated at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+    cf->unitvec=buf+offset;
+  }
+  if ((cf->column=(struct catfile_column *) malloc(sizeof(struct catfile_column)*(cf->ncolumns+1)))==NULL) {
+    printf("Unable to allocate columns in %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  for (i=0;i<cf->ncolumns;i++) {
+    d=buf+CATFILE_HEADER+CATFILE_DESCRIPTOR*i;
+    memcpy(cf->column[i].name,d,CATFILE_NAMELEN);
+    cf->column[i].name[CATFILE_NAMELEN]=0;
+    cf->column[i].type=get32(d+40);
+    cf->column[i].source=get32(d+44);
+    offset=get64(d+48);
+    length=get64(d+56);
+    switch (cf->column[i].type) {
+    case CATFILE_DOUBLE:
+    case CATFILE_INT64:
+      size=8*cf->nrows;
+      break;
+    case CATFILE_FLOAT:
+      size=4*cf->nrows;
+      break;
+    case CATFILE_TEXT:
+      size=8*(cf->nrows+1);
+      break;
+    default:
+      printf("Column %s has unknown type %u at %s:%d\n",cf->column[i].name,cf->column[i].type,__FILE__,__LINE__);
+      catfile_close(cf);
+      return -1;
+    }
+    if (length<size || offset+length>len ||
+	(cf->column[i].type==CATFILE_TEXT && get64(buf+offset+8*cf->nrows)>length-size)) {
+      printf("Column %s is truncated at %s:%d\n",cf->column[i].name,__FILE__,__LINE__);
+      catfile_close(cf);
+      return -1;
+    }
+    cf->column[i].data=buf+offset;
+    cf->column[i].length=length;
+    if (cf->column[i].type==CATFILE_TEXT && cf->text<0 && strcmp(cf->column[i].name,"line")==0) {
+      cf->text=i;
+    }
+  }
+  return 0;
+}
+
+void
+catfile_close(struct catfile *cf) {
+  free((void *) cf->column);
+  cf->column=NULL;
+}
+
+int
+catfile_find(const struct catfile *cf, unsigned int source) {
+  unsigned int i;
+
+  for (i=0;i<cf->ncolumns;i++) {
+    if (cf->column[i].source==source && cf->column[i].type!=CATFILE_TEXT) return i;
+  }
+  return -1;
+}
+
+int
+catfile_findname(const struct catfile *cf, const char *name) {
+  unsigned int i;
+
+  for (i=0;i<cf->ncolumns;i++) {
+    if (strcasecmp(cf->column[i].name,name)==0 && cf->column[i].type!=CATFILE_TEXT) return i;
+  }
+  return -1;
+}
+
+double
+catfile_value(const struct catfile *cf, int column, unsigned long long row) {
+  const struct catfile_column *c;
+  unsigned int v;
+  float f;
+
+  if (column<0) return 0.0/0.0;
+  c=cf->column+column;
+  switch (c->type) {
+  case CATFILE_DOUBLE:
+    return getdouble(c->data+8*row);
+  case CATFILE_FLOAT:
+    v=get32(c->data+4*row);
+    memcpy(&f,&v,sizeof(f));
+    return f;
+  case CATFILE_INT64:
+    return (double) (long long) get64(c->data+8*row);
+  }
+  return 0.0/0.0;
+}
+
+double
+catfile_unitvec(const struct catfile *cf, int axis, unsigned long long row) {
+  return getdouble(cf->unitvec+8*(axis*cf->nrows+row));
+}
+
+void
+catfile_radec(double lon, double lat, double v[3]) {
+  double a=lon/180.0*M_PI, b=lat/180.0*M_PI;
+
+  v[0]=cos(a)*cos(b);
+  v[1]=sin(a)*cos(b);
+  v[2]=sin(b);
+}
+
+const char *
+catfile_textrow(const struct catfile *cf, int column, unsigned long long row, size_t *len) {
+  const struct catfile_column *c=cf->column+column;
+  const char *bytes=c->data+8*(cf->nrows+1);
+  unsigned long long start=get64(c->data+8*row), end=get64(c->data+8*(row+1));
+
+  *len=(end>start ? end-start : 0);
+  return bytes+start;
+}
+
+unsigned int
+catfile_load(const char *buf, size_t len, unsigned int ncolumns, unsigned int columns[], double *data[]) {
+  struct catfile cf;
+  unsigned long long i, n;
+  unsigned int j;
+  int c;
+
+  if (catfile_open(buf,len,&cf)) {
+    return 0;
+  }
+  n=cf.nrows;
+  if (n>~0U) {
+    printf("Binary catalogue has too many rows (%llu) at %s:%d\n",n,__FILE__,__LINE__);
+    catfile_close(&cf);
+    return 0;
+  }
+  for (j=0;j<ncolumns;j++) {
+    if ((data[j]=(double *) malloc(sizeof(double)*(n>0 ? n : 1)))==NULL) {
+      printf("Unable to allocate data[%d] in %s:%d\n",j,__FILE__,__LINE__);
+      catfile_close(&cf);
+      return 0;
+    }
+    c=catfile_find(&cf,columns[j]);
+    if (c>=0 && cf.column[c].type==CATFILE_DOUBLE && host_le()) {
+      memcpy(data[j],cf.column[c].data,sizeof(double)*n);
+    } else {
+      /* missing values given nan */
+      for (i=0;i<n;i++) {
+	data[j][i]=catfile_value(&cf,c,i);
+      }
+    }
+  }
+  catfile_close(&cf);
+  return (unsigned int) n;
+}
+
+/* write count little-endian 64-bit words */
+static int
+write64(FILE *out, const void *words, unsigned long long count) {
+  char b[8];
+  unsigned long long i, v;
+
+  if (host_le()) {
+    return (fwrite(words,8,count,out)==count ? 0 : -1);
+  }
+  for (i=0;i<count;i++) {
+    memcpy(&v,(const char *) words+8*i,8);
+    put64(b,v);
+    if (fwrite(b,8,1,out)!=1) return -1;
+  }
+  return 0;
+}
+
+static int
+writepad(FILE *out, unsigned long long length) {
+  static const char zero[8];
+  return (fwrite(zero,1,ALIGN8(length)-length,out)==ALIGN8(length)-length ? 0 : -1);
+}
+
+int
+catfile_write(FILE *out, unsigned long long nrows, unsigned int ncolumns, char *name[], unsigned int source[], double *data[],
+	      const char *line[], const size_t linelen[], unsigned int lon, unsigned int lat) {
+  char header[CATFILE_HEADER], d[CATFILE_DESCRIPTOR];
+  unsigned long long offset, textbytes=0, i, *textoff=NULL;
+  unsigned int j, ncol=ncolumns+(line!=NULL);
+  int ilon=-1, ilat=-1, axis;
+  double *uv=NULL;
+
+  for (j=0;j<ncolumns;j++) {
+    if (lon && source[j]==lon) ilon=j;
+    if (lat && source[j]==lat) ilat=j;
+  }
+  if (lon && (ilon<0 || ilat<0)) {
+    printf("The unit vector columns %u and %u are not in the catalogue at %s:%d\n",lon,lat,__FILE__,__LINE__);
+    return -1;
+  }
+  if (line) {
+    for (i=0;i<nrows;i++) {
+      textbytes+=linelen[i];
+    }
+  }
+
+  memset(header,0,sizeof(header));
+  memcpy(header,CATFILE_MAGIC,8);
+  put32(header+8,CATFILE_VERSION);
+  put32(header+12,ncol);
+  put64(header+16,nrows);
+  offset=CATFILE_HEADER+(unsigned long long) CATFILE_DESCRIPTOR*ncol;
+  offset+=8*nrows*ncolumns;
+  if (line) offset+=ALIGN8(8*(nrows+1)+textbytes);
+  if (lon) {
+    put32(header+24,lon);
+    put32(header+28,lat);
+    put64(header+32,offset);
+  }
+  if (fwrite(header,1,sizeof(header),out)!=sizeof(header)) goto fail;
+
+  /* the descriptors */
+  offset=CATFILE_HEADER+(unsigned long long) CATFILE_DESCRIPTOR*ncol;
+  for (j=0;j<ncol;j++) {
+    memset(d,0,sizeof(d));
+    if (j<ncolumns) {
+      strncpy(d,name[j],CATFILE_NAMELEN);
+      put32(d+40,CATFILE_DOUBLE);
+      put32(d+44,source[j]);
+      put64(d+48,offset);
+      put64(d+56,8*nrows);
+      offset+=8*nrows;
+    } else {
+      strncpy(d,"line",CATFILE_NAMELEN);
+      put32(d+40,CATFILE_TEXT);
+      put64(d+48,offset);
+      put64(d+56,8*(nrows+1)+textbytes);
+      offset+=ALIGN8(8*(nrows+1)+textbytes);
+    }
+    if (fwrite(d,1,sizeof(d),out)!=sizeof(d)) goto fail;
+  }
+
+  /* the columns */
+  for (j=0;j<ncolumns;j++) {
+    if (write64(out,data[j],nrows)) goto fail;
+  }
+  if (line) {
+    if ((textoff=(unsigned long long *) malloc(sizeof(unsigned long long)*(nrows+1)))==NULL) {
+      printf("Unable to allocate text offsets in %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+    textoff[0]=0;
+    for (i=0;i<nrows;i++) {
+      textoff[i+1]=textoff[i]+linelen[i];
+    }
+    if (write64(out,textoff,nrows+1)) goto fail;
+    for (i=0;i<nrows;i++) {
+      if (fwrite(line[i],1,linelen[i],out)!=linelen[i]) goto fail;
+    }
+    if (writepad(out,8*(nrows+1)+textbytes)) goto fail;
+    free((void *) textoff);
+    textoff=NULL;
+  }
+
+  /* the unit vectors, one axis at a time */
+  if (lon) {
+    if ((uv=(double *) malloc(sizeof(double)*(nrows>0 ? nrows : 1)))==NULL) {
+      printf("Unable to allocate unit vectors in %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+    for (axis=0;axis<3;axis++) {
+      for (i=0;i<nrows;i++) {
+	double v[3];
+	catfile_radec(data[ilon][i],data[ilat][i],v);
+	uv[i]=v[axis];
+      }
+      if (write64(out,uv,nrows)) goto fail;
+    }
+    free((void *) uv);
+  }
+  return 0;
+
+ fail:
+  printf("Unable to write the binary catalogue at %s:%d\n",__FILE__,__LINE__);
+  free((void *) textoff);
+  free((void *) uv);
+  return -1;
+}
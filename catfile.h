@@ -0,0 +1,102 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#ifndef _CATFILE_H_
+#define _CATFILE_H_
+
+/* A binary columnar catalogue, all numbers little-endian:
+
+     0  "KDCAT\0\0\0"
+     8  uint32 version, uint32 number of columns
+    16  uint64 number of rows
+    24  uint32 lon and lat columns of the unit vectors (0 if none)
+    32  uint64 offset of the unit vectors (x, y and z arrays of doubles)
+    40  uint64 reserved
+    48  one 64-byte descriptor per column: char name[40], uint32 type,
+        uint32 number of the column in the original text (0 if none),
+        uint64 offset and uint64 length of its data
+
+   Numeric columns are contiguous arrays; a text column is an array of
+   nrows+1 uint64 offsets followed by the bytes they point into.  Every
+   block starts on an eight-byte boundary. */
+
+#define CATFILE_MAGIC "KDCAT\0\0"
+#define CATFILE_VERSION 1
+#define CATFILE_HEADER 48
+#define CATFILE_DESCRIPTOR 64
+#define CATFILE_NAMELEN 40
+
+#define CATFILE_DOUBLE 1
+#define CATFILE_FLOAT 2
+#define CATFILE_INT64 3
+#define CATFILE_TEXT 4
+
+struct catfile_column {
+  char name[CATFILE_NAMELEN+1];
+  unsigned int type, source;
+  const char *data;
+  unsigned long long length;
+};
+
+struct catfile {
+  const char *buf;
+  size_t len;
+  unsigned long long nrows;
+  unsigned int ncolumns, lon, lat;
+  struct catfile_column *column;
+  const char *unitvec;
+  int text;		/* the column holding the original lines, or -1 */
+};
+
+/* is the buffer a binary catalogue? */
+int catfile_check(const char *buf, size_t len);
+/* read the header of the catalogue in buf; returns 0 on success */
+int catfile_open(const char *buf, size_t len, struct catfile *cf);
+void catfile_close(struct catfile *cf);
+/* the descriptor for column number source of the original text, or -1 */
+int catfile_find(const struct catfile *cf, unsigned int source);
+/* the numeric column with the given name (any case), or -1 */
+int catfile_findname(const struct catfile *cf, const char *name);
+/* one value of a numeric column, or one of the unit vectors (0, 1 or 2) */
+double catfile_value(const struct catfile *cf, int column, unsigned long long row);
+double catfile_unitvec(const struct catfile *cf, int axis, unsigned long long row);
+/* the unit vector of RA/Dec in degrees, rounded just as match_kd's are */
+void catfile_radec(double lon, double lat, double v[3]);
+/* the text of one row of a text column (not terminated) */
+const char *catfile_textrow(const struct catfile *cf, int column, unsigned long long row, size_t *len);
+/* copy the columns like loadfile does; missing columns are nan */
+unsigned int catfile_load(const char *buf, size_t len, unsigned int ncolumns, unsigned int columns[], double *data[]);
+
+/* write a catalogue of nrows rows with ncolumns double columns, the
+   original lines (line[i] of length linelen[i]) if line is not null and
+   the unit vectors for columns lon and lat (numbered as in the text) if
+   lon is not zero */
+int catfile_write(FILE *out, unsigned long long nrows, unsigned int ncolumns, char *name[], unsigned int source[], double *data[],
+		  const char *line[], const size_t linelen[], unsigned int lon, unsigned int lat);
+
+#endif	/* _CATFILE_H_ */
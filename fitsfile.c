@@ -0,0 +1,399 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+#include "fitsfile.h"
+
+/* round a header or data length up to whole FITS blocks */
+#define FITS_BLOCKS(x) ((((x)+FITS_BLOCK-1)/FITS_BLOCK)*FITS_BLOCK)
+
+/* the value field of keyword key in the header cards [hdr,hdrend) */
+static const char *
+findkey(const char *hdr, const char *hdrend, const char *key) {
+  size_t keylen=strlen(key);
+  const char *card;
+
+  for (card=hdr;card+FITS_CARD<=hdrend;card+=FITS_CARD) {
+    if (strncmp(card,key,keylen)==0 && (keylen==8 || card[keylen]==' ') && card[8]=='=') {
+      return card+10;
+    }
+  }
+  return NULL;
+}
+
+static long long
+getlong(const char *hdr, const char *hdrend, const char *key, long long def) {
+  const char *v=findkey(hdr,hdrend,key);
+  char buf[FITS_CARD];
+
+  if (v==NULL) return def;
+  memcpy(buf,v,FITS_CARD-10);
+  buf[FITS_CARD-10]=0;
+  return strtoll(buf,NULL,10);
+}
+
+static double
+getdouble(const char *hdr, const char *hdrend, const char *key, double def) {
+  const char *v=findkey(hdr,hdrend,key);
+  char buf[FITS_CARD], *p;
+
+  if (v==NULL) return def;
+  memcpy(buf,v,FITS_CARD-10);
+  buf[FITS_CARD-10]=0;
+  /* FITS allows a D exponent */
+  for (p=buf;*p && *p!='/';p++) {
+    if (*p=='D' || *p=='d') *p='E';
+  }
+  return strtod(buf,NULL);
+}
+
+/* a quoted string value, trailing blanks removed; returns 0 if found */
+static int
+getstring(const char *hdr, const char *hdrend, const char *key, char *out, size_t outlen) {
+  const char *v=findkey(hdr,hdrend,key), *end;
+  size_t n=0;
+
+  if (v==NULL) return -1;
+  end=v+FITS_CARD-10;
+  while (v<end && *v==' ') v++;
+  if (v==end || *v!='\'') return -1;
+  for (v++;v<end && n+1<outlen;v++) {
+    if (*v=='\'') {
+      /* a doubled quote is a quote */
+      if (v+1<end && v[1]=='\'') {
+	v++;
+      } else {
+	break;
+      }
+    }
+    out[n++]=*v;
+  }
+  while (n>0 && out[n-1]==' ') n--;
+  out[n]=0;
+  return 0;
+}
+
+/* the header of an HDU: returns the end of its cards, or null */
+static const char *
+headerend(const char *hdr, const char *bufend) {
+  const char *card;
+
+  for (card=hdr;card+FITS_CARD<=bufend;card+=FITS_CARD) {
+    if (strncmp(card,"END",3)==0 && (card[3]==' ' || card+3==bufend)) {
+      return card+FITS_CARD;
+    }
+  }
+  return NULL;
+}
+
+int
+fitsfile_check(const char *buf, size_t len) {
+  return (len>=FITS_BLOCK && strncmp(buf,"SIMPLE  =",9)==0);
+}
+
+int
+fitsfile_open(const char *buf, size_t len, struct fitsfile *ff) {
+  const char *hdr=buf, *hdrend, *data, *bufend=buf+len;
+  char key[32], value[72];
+  unsigned long long size;
+  long long naxis, i, bitpix, pcount, gcount;
+  unsigned int j;
+  unsigned long offset;
+  struct fitsfile_column *c;
+  char *p;
+
+  ff->column=NULL;
+  if (!fitsfile_check(buf,len)) {
+    printf("Not a FITS file at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+
+  /* walk the HDUs until the first binary table */
+  for (;;) {
+    if (hdr>=bufend || (hdrend=headerend(hdr,bufend))==NULL) {
+      printf("No binary table in the FITS file at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+    data=hdr+FITS_BLOCKS(hdrend-hdr);
+    if (hdr!=buf && getstring(hdr,hdrend,"XTENSION",value,sizeof(value))==0 &&
+	strcmp(value,"BINTABLE")==0) {
+      break;
+    }
+    bitpix=getlong(hdr,hdrend,"BITPIX",8);
+    naxis=getlong(hdr,hdrend,"NAXIS",0);
+    pcount=getlong(hdr,hdrend,"PCOUNT",0);
+    gcount=getlong(hdr,hdrend,"GCOUNT",1);
+    size=(naxis>0 ? 1 : 0);
+    for (i=1;i<=naxis;i++) {
+      snprintf(key,sizeof(key),"NAXIS%lld",i);
+      size*=getlong(hdr,hdrend,key,0);
+    }
+    if (naxis>0) size=(bitpix<0 ? -bitpix : bitpix)/8*gcount*(pcount+size);
+    hdr=data+FITS_BLOCKS(size);
+  }
+
+  ff->buf=buf;
+  ff->len=len;
+  ff->data=data;
+  ff->rowlen=getlong(hdr,hdrend,"NAXIS1",0);
+  ff->nrows=getlong(hdr,hdrend,"NAXIS2",0);
+  ff->ncolumns=getlong(hdr,hdrend,"TFIELDS",0);
+  if (data+(unsigned long long) ff->rowlen*ff->nrows>bufend) {
+    printf("The FITS binary table is truncated at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  if ((ff->column=(struct fitsfile_column *) malloc(sizeof(struct fitsfile_column)*(ff->ncolumns+1)))==NULL) {
+    printf("Unable to allocate columns in %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+
+  offset=0;
+  for (j=0;j<ff->ncolumns;j++) {
+    c=ff->column+j;
+    snprintf(key,sizeof(key),"TTYPE%u",j+1);
+    if (getstring(hdr,hdrend,key,c->name,sizeof(c->name))) c->name[0]=0;
+    snprintf(key,sizeof(key),"TFORM%u",j+1);
+    if (getstring(hdr,hdrend,key,value,sizeof(value))) {
+      printf("Column %u of the FITS table has no TFORM at %s:%d\n",j+1,__FILE__,__LINE__);
+      fitsfile_close(ff);
+      return -1;
+    }
+    /* rT: a repeat count and a type */
+    c->repeat=strtoul(value,&p,10);
+    if (p==value) c->repeat=1;
+    c->type=toupper((unsigned char) *p);
+    switch (c->type) {
+    case 'L': case 'B': case 'A': c->width=1; break;
+    case 'I': c->width=2; break;
+    case 'J': case 'E': c->width=4; break;
+    case 'K': case 'D': case 'C': case 'P': c->width=8; break;
+    case 'M': case 'Q': c->width=16; break;
+    case 'X': c->width=0; break;
+    default:
+      printf("Column %u of the FITS table has unknown type %s at %s:%d\n",j+1,value,__FILE__,__LINE__);
+      fitsfile_close(ff);
+      return -1;
+    }
+    c->offset=offset;
+    offset+=(c->type=='X' ? (c->repeat+7)/8 : c->repeat*c->width);
+    snprintf(key,sizeof(key),"TSCAL%u",j+1);
+    c->scale=getdouble(hdr,hdrend,key,1.0);
+    snprintf(key,sizeof(key),"TZERO%u",j+1);
+    c->zero=getdouble(hdr,hdrend,key,0.0);
+    snprintf(key,sizeof(key),"TNULL%u",j+1);
+    c->hasnull=(findkey(hdr,hdrend,key)!=NULL);
+    c->null=getlong(hdr,hdrend,key,0);
+  }
+  if (offset>ff->rowlen) {
+    printf("The FITS columns are wider than the rows at %s:%d\n",__FILE__,__LINE__);
+    fitsfile_close(ff);
+    return -1;
+  }
+  return 0;
+}
+
+void
+fitsfile_close(struct fitsfile *ff) {
+  free((void *) ff->column);
+  ff->column=NULL;
+}
+
+int
+fitsfile_find(const struct fitsfile *ff, const char *name) {
+  char *end;
+  long n;
+  unsigned int j;
+
+  n=strtol(name,&end,10);
+  if (end>name && *end==0) {
+    return (n>=1 && n<=ff->ncolumns ? (int) n-1 : -1);
+  }
+  for (j=0;j<ff->ncolumns;j++) {
+    if (strcasecmp(ff->column[j].name,name)==0) return j;
+  }
+  return -1;
+}
+
+/* big-endian integers */
+static unsigned long long
+getbe(const unsigned char *p, int n) {
+  unsigned long long v=0;
+  int i;
+
+  for (i=0;i<n;i++) {
+    v=(v<<8)|p[i];
+  }
+  return v;
+}
+
+/* element k of a column in a row */
+static double
+element(const struct fitsfile *ff, const struct fitsfile_column *c, unsigned long row, unsigned long k) {
+  const unsigned char *p=(const unsigned char *) ff->data+row*ff->rowlen+c->offset+k*c->width;
+  unsigned long long u;
+  long long raw;
+  float f;
+  double d;
+  char buf[72];
+  size_t n;
+
+  switch (c->type) {
+  case 'B':
+    raw=p[0];
+    break;
+  case 'I':
+    raw=(short) getbe(p,2);
+    break;
+  case 'J':
+    raw=(int) getbe(p,4);
+    break;
+  case 'K':
+    raw=(long long) getbe(p,8);
+    break;
+  case 'L':
+    return (p[0]=='T' ? 1.0 : (p[0]=='F' ? 0.0 : 0.0/0.0));
+  case 'E':
+    u=getbe(p,4);
+    {
+      unsigned int w=(unsigned int) u;
+      memcpy(&f,&w,sizeof(f));
+    }
+    return f*c->scale+c->zero;
+  case 'D':
+    u=getbe(p,8);
+    memcpy(&d,&u,sizeof(d));
+    return d*c->scale+c->zero;
+  case 'A':
+    /* a number written as text */
+    n=(c->repeat<sizeof(buf) ? c->repeat : sizeof(buf)-1);
+    memcpy(buf,ff->data+row*ff->rowlen+c->offset,n);
+    buf[n]=0;
+    return (n>0 ? strtod(buf,NULL) : 0.0/0.0);
+  default:
+    return 0.0/0.0;
+  }
+  if (c->hasnull && raw==c->null) return 0.0/0.0;
+  return raw*c->scale+c->zero;
+}
+
+double
+fitsfile_value(const struct fitsfile *ff, int column, unsigned long row) {
+  if (column<0 || ff->column[column].repeat==0) return 0.0/0.0;
+  return element(ff,ff->column+column,row,0);
+}
+
+size_t
+fitsfile_linelen(const struct fitsfile *ff) {
+  size_t len=1;
+  unsigned int j;
+
+  for (j=0;j<ff->ncolumns;j++) {
+    len+=(ff->column[j].type=='A' ? ff->column[j].repeat+1 : 26*ff->column[j].repeat);
+  }
+  return len;
+}
+
+size_t
+fitsfile_format(const struct fitsfile *ff, unsigned long row, char *line) {
+  const struct fitsfile_column *c;
+  const char *s;
+  char *p=line;
+  unsigned long k, n;
+  unsigned int j;
+  double v;
+
+  for (j=0;j<ff->ncolumns;j++) {
+    c=ff->column+j;
+    if (c->type=='A') {
+      s=ff->data+row*ff->rowlen+c->offset;
+      for (n=0;n<c->repeat && s[n];n++);
+      while (n>0 && s[n-1]==' ') n--;
+      if (n==0) continue;
+      if (p>line) *p++=' ';
+      memcpy(p,s,n);
+      p+=n;
+      continue;
+    }
+    /* descriptors, bits and complex numbers are not written out */
+    if (strchr("BIJKEDL",c->type)==NULL) continue;
+    for (k=0;k<c->repeat;k++) {
+      v=element(ff,c,row,k);
+      if (p>line) *p++=' ';
+      /* the shorter form if it reads back the same */
+      if (c->type=='E' && c->scale==1.0 && c->zero==0.0) {
+	n=sprintf(p,"%.7g",v);
+	if ((float) strtod(p,NULL)!=(float) v && !isnan(v)) n=sprintf(p,"%.9g",v);
+      } else {
+	n=sprintf(p,"%.15g",v);
+	if (strtod(p,NULL)!=v && !isnan(v)) n=sprintf(p,"%.17g",v);
+      }
+      p+=n;
+    }
+  }
+  *p=0;
+  return p-line;
+}
+
+unsigned int
+fitsfile_load(const char *buf, size_t len, unsigned int ncolumns, char *colname[], double *data[]) {
+  struct fitsfile ff;
+  unsigned long i, n;
+  unsigned int j;
+  int c;
+
+  if (fitsfile_open(buf,len,&ff)) {
+    return 0;
+  }
+  n=ff.nrows;
+  if (n>~0U) {
+    printf("FITS table has too many rows (%lu) at %s:%d\n",n,__FILE__,__LINE__);
+    fitsfile_close(&ff);
+    return 0;
+  }
+  for (j=0;j<ncolumns;j++) {
+    if ((c=fitsfile_find(&ff,colname[j]))<0) {
+      printf("There is no column %s in the FITS table at %s:%d\n",colname[j],__FILE__,__LINE__);
+    }
+    if ((data[j]=(double *) malloc(sizeof(double)*(n>0 ? n : 1)))==NULL) {
+      printf("Unable to allocate data[%d] in %s:%d\n",j,__FILE__,__LINE__);
+      fitsfile_close(&ff);
+      return 0;
+    }
+    /* missing values given nan */
+    for (i=0;i<n;i++) {
+      data[j][i]=fitsfile_value(&ff,c,i);
+    }
+  }
+  fitsfile_close(&ff);
+  return (unsigned int) n;
+}
@@ -0,0 +1,71 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#ifndef _FITSFILE_H_
+#define _FITSFILE_H_
+
+/* A reader for the first binary table (XTENSION='BINTABLE') of a FITS
+   file held in memory.  Only the columns asked for are decoded. */
+
+#define FITS_BLOCK 2880
+#define FITS_CARD 80
+
+struct fitsfile_column {
+  char name[72];
+  char type;			/* TFORM letter: L X B I J K A E D C M P Q */
+  unsigned long repeat, offset, width;
+  double scale, zero;
+  int hasnull;
+  long long null;
+};
+
+struct fitsfile {
+  const char *buf;
+  size_t len;
+  const char *data;		/* the first row of the table */
+  unsigned long rowlen, nrows;
+  unsigned int ncolumns;
+  struct fitsfile_column *column;
+};
+
+/* is the buffer a FITS file? */
+int fitsfile_check(const char *buf, size_t len);
+/* find the binary table in buf; returns 0 on success */
+int fitsfile_open(const char *buf, size_t len, struct fitsfile *ff);
+void fitsfile_close(struct fitsfile *ff);
+/* the column with the given name (any case) or number, or -1 */
+int fitsfile_find(const struct fitsfile *ff, const char *name);
+/* the first element of a column in a row, scaled; nan if null or not a number */
+double fitsfile_value(const struct fitsfile *ff, int column, unsigned long row);
+/* write a row as text into line (which needs fitsfile_linelen bytes) */
+size_t fitsfile_linelen(const struct fitsfile *ff);
+size_t fitsfile_format(const struct fitsfile *ff, unsigned long row, char *line);
+/* copy the named or numbered columns like loadfile does */
+unsigned int fitsfile_load(const char *buf, size_t len, unsigned int ncolumns, char *colname[], double *data[]);
+
+#endif	/* _FITSFILE_H_ */
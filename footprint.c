@@ -0,0 +1,161 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "footprint.h"
+
+struct hullpoint {
+  double x, y;
+};
+
+static int
+hullcomp(const void *a, const void *b) {
+  const struct hullpoint *p=(const struct hullpoint *) a, *q=(const struct hullpoint *) b;
+
+  if (p->x<q->x) return -1;
+  if (p->x>q->x) return 1;
+  if (p->y<q->y) return -1;
+  if (p->y>q->y) return 1;
+  return 0;
+}
+
+/* twice the area of o, a, b: positive if they turn to the left */
+static double
+turn(const struct hullpoint *o, const struct hullpoint *a, const struct hullpoint *b) {
+  return (a->x-o->x)*(b->y-o->y)-(a->y-o->y)*(b->x-o->x);
+}
+
+/* Andrew's monotone chain */
+int
+footprint_hull(int n, const double x[], const double y[], double hx[], double hy[]) {
+  struct hullpoint *p, *h;
+  int i, m, k=0, lower;
+
+  if ((p=(struct hullpoint *) malloc(sizeof(struct hullpoint)*(2*n+1)))==NULL) {
+    printf("Unable to allocate the hull at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  h=p+n;
+  for (i=0, m=0;i<n;i++) {
+    /* (points without coordinates are left out) */
+    if (!isfinite(x[i]) || !isfinite(y[i])) continue;
+    p[m].x=x[i];
+    p[m++].y=y[i];
+  }
+  qsort((void *) p,m,sizeof(struct hullpoint),hullcomp);
+  /* the lower hull left to right, then the upper right to left */
+  for (i=0;i<m;i++) {
+    while (k>=2 && turn(h+k-2,h+k-1,p+i)<=0) k--;
+    h[k++]=p[i];
+  }
+  for (i=m-2, lower=k+1;i>=0;i--) {
+    while (k>=lower && turn(h+k-2,h+k-1,p+i)<=0) k--;
+    h[k++]=p[i];
+  }
+  /* (the first corner came round again) */
+  if (k>1) k--;
+  for (i=0;i<k;i++) {
+    hx[i]=h[i].x;
+    hy[i]=h[i].y;
+  }
+  free((void *) p);
+  return k;
+}
+
+/* on the inner side of every edge moved out by margin (so the corners
+   are a little generous) */
+int
+footprint_inside(int nh, const double hx[], const double hy[], double x, double y, double margin) {
+  double ex, ey;
+  int i, j;
+
+  for (i=0;i<nh;i++) {
+    j=(i+1)%nh;
+    ex=hx[j]-hx[i];
+    ey=hy[j]-hy[i];
+    if (ex*(y-hy[i])-ey*(x-hx[i])<-margin*hypot(ex,ey)) return 0;
+  }
+  return 1;
+}
+
+/* keep the points of one list inside the footprint of the other */
+static int
+clip(unsigned int *n, double xp[], double yp[], const double xt[], const double yt[],
+     int nh, const double hx[], const double hy[], double margin, int **id) {
+  unsigned int i, m;
+
+  if ((*id=(int *) malloc(sizeof(int)*(*n+1)))==NULL) {
+    printf("Unable to allocate the points kept at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  for (i=0, m=0;i<*n;i++) {
+    if (nh>=3 && !footprint_inside(nh,hx,hy,xt[i],yt[i],margin)) continue;
+    xp[m]=xp[i];
+    yp[m]=yp[i];
+    (*id)[m++]=(int) i;
+  }
+  *n=m;
+  return 0;
+}
+
+int
+footprint_overlap(unsigned int *n1, double xp1[], double yp1[], int **id1,
+		  unsigned int *n2, double xp2[], double yp2[], int **id2,
+		  const double t[6], double margin) {
+  double *xt, *yt, *hx1, *hy1, *hx2, *hy2;
+  unsigned int i;
+  int nh1, nh2, retval=-1;
+
+  /* list 1 is carried into the coordinates of list 2 */
+  if ((xt=(double *) malloc(sizeof(double)*(4*(*n1)+2*(*n2)+1)))==NULL) {
+    printf("Unable to allocate the footprints at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  yt=xt+*n1;
+  hx1=yt+*n1;
+  hy1=hx1+*n1;
+  hx2=hy1+*n1;
+  hy2=hx2+*n2;
+  for (i=0;i<*n1;i++) {
+    xt[i]=t[0]*xp1[i]+t[1]*yp1[i]+t[2];
+    yt[i]=t[3]*xp1[i]+t[4]*yp1[i]+t[5];
+  }
+  if ((nh1=footprint_hull(*n1,xt,yt,hx1,hy1))>=0 &&
+      (nh2=footprint_hull(*n2,xp2,yp2,hx2,hy2))>=0) {
+    /* a footprint with no area tells us nothing */
+    if (nh1<3 || nh2<3) nh1=nh2=0;
+    /* (list 2 against the footprint of list 1 first, while xt and yt
+       still follow the points of list 1) */
+    if (clip(n2,xp2,yp2,xp2,yp2,nh1,hx1,hy1,margin,id2)==0 &&
+	clip(n1,xp1,yp1,xt,yt,nh2,hx2,hy2,margin,id1)==0) retval=0;
+  }
+  free((void *) xt);
+  return retval;
+}
@@ -0,0 +1,52 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#ifndef _FOOTPRINT_H_
+#define _FOOTPRINT_H_
+
+/* The footprint of a list of points is its convex hull.  Given a rough
+   transformation from list 1 to list 2 (x2 = t[0] x1 + t[1] y1 + t[2],
+   y2 = t[3] x1 + t[4] y1 + t[5], as -t is written), the points of each
+   list that fall outside the footprint of the other, widened by margin
+   (in the coordinates of list 2), cannot be in both fields and can be
+   dropped before any asterisms are made. */
+
+/* the hull of n points, counter-clockwise, into hx and hy (room for n);
+   returns the number of corners */
+int footprint_hull(int n, const double x[], const double y[], double hx[], double hy[]);
+/* is (x,y) within margin of the hull (with at least three corners)? */
+int footprint_inside(int nh, const double hx[], const double hy[], double x, double y, double margin);
+/* drop the points of both lists outside the overlap, moving the others
+   to the front in order; id1 and id2 get the numbers they had before
+   (allocated here).  Returns 0, or -1 if memory ran out; if either
+   footprint has no area, nothing is dropped. */
+int footprint_overlap(unsigned int *n1, double xp1[], double yp1[], int **id1,
+		      unsigned int *n2, double xp2[], double yp2[], int **id2,
+		      const double t[6], double margin);
+
+#endif	/* _FOOTPRINT_H_ */
@@ -0,0 +1,415 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include "kdtree.h"
+#include "rangejoin.h"
+#include "loadfile.h"
+#include "outbuf.h"
+#include "match_kd.h"
+#include "incstate.h"
+
+#define INC_MAGIC "KDMINC"
+#define INC_STARS 64		/* in a cell, on average */
+struct inccell {
+  long long c[3];
+  unsigned long long hash;
+  int used;
+};
+struct celltable {
+  struct inccell *cell;
+  unsigned long long n, mask;
+};
+char *incpath;
+static unsigned long long opthash, nreused;
+static double cellsize;
+static struct loadfile_text oldstate;
+static struct incrow *oldrow;
+static unsigned long long rowmask;
+static struct celltable oldcells;
+/* the centres of the cells that have changed, and the new state */
+static struct kdtree *changed;
+static struct outbuf state;
+static char *statename;
+
+/* FNV-1a, carrying on from h */
+static unsigned long long
+hashbytes(const void *p, size_t n, unsigned long long h) {
+  const unsigned char *q=(const unsigned char *) p;
+
+  while (n-->0) {
+    h^=*q++;
+    h*=0x100000001b3ULL;
+  }
+  return h;
+}
+#define HASH_START 0xcbf29ce484222325ULL
+
+/* a little-endian number in the old state */
+static unsigned long long
+le64at(const char *p) {
+  unsigned long long v=0;
+  int i;
+
+  for (i=7;i>=0;i--) v=(v<<8)|(unsigned char) p[i];
+  return v;
+}
+
+static double
+ledoubleat(const char *p) {
+  unsigned long long v=le64at(p);
+  double d;
+
+  memcpy(&d,&v,sizeof(d));
+  return d;
+}
+
+/* the cell of a position (all stars off the grid share one) */
+static void
+cellof(const double pos[], long long c[3]) {
+  int j;
+
+  for (j=0;j<3;j++) c[j]=0;
+  for (j=0;j<ndim;j++) {
+    if (!(fabs(pos[j]/cellsize)<1e15)) {
+      c[0]=c[1]=c[2]=LLONG_MIN;
+      return;
+    }
+    c[j]=(long long) floor(pos[j]/cellsize);
+  }
+}
+
+/* the place for cell c in the table, growing it if need be */
+static struct inccell *
+findcell(struct celltable *t, const long long c[3]) {
+  struct inccell *old;
+  unsigned long long h, i, oldsize;
+
+  if (2*(t->n+1)>t->mask) {
+    old=t->cell;
+    oldsize=(old ? t->mask+1 : 0);
+    t->mask=(old ? 2*t->mask+1 : 1023);
+    if ((t->cell=(struct inccell *) calloc(t->mask+1,sizeof(struct inccell)))==NULL) {
+      printf("Unable to allocate the cells at %s:%d\n",__FILE__,__LINE__);
+      exit(-1);
+    }
+    for (i=0;i<oldsize;i++) {
+      if (old[i].used) *findcell(t,old[i].c)=old[i];
+    }
+    free((void *) old);
+  }
+  h=hashbytes(c,sizeof(long long)*3,HASH_START);
+  for (i=h&t->mask;t->cell[i].used && memcmp(t->cell[i].c,c,sizeof(long long)*3);i=(i+1)&t->mask);
+  return t->cell+i;
+}
+
+/* the hash of a star of catalogue 1: its line and position (and its
+   number, which -bin prints) */
+static unsigned long long
+rowkey(const char *line, size_t len, const double pos[], unsigned long long id) {
+  unsigned long long h=hashbytes(line,len,HASH_START);
+
+  h=hashbytes(pos,sizeof(double)*ndim,h);
+  if (dobinary) h=hashbytes(&id,sizeof(id),h);
+  return (h ? h : 1);
+}
+
+/* read the state of the last run, if there is one for the same options */
+int
+loadstate(void) {
+  const char *p, *end;
+  struct inccell *cl;
+  unsigned long long ncell, nrow, i, k, key;
+  long long c[3];
+  FILE *in;
+  int j;
+
+  if ((in=fopen(incpath,"r"))==NULL) return 0;
+  if (loadfile_text_fileptr(in,&oldstate)) return -1;
+  fclose(in);
+  p=oldstate.data;
+  end=p+oldstate.len;
+  if (oldstate.len<32 || memcmp(p,INC_MAGIC,7) || le64at(p+8)!=opthash) {
+    if (verbose) printf("# %s is for other options; everything is matched again\n",incpath);
+    return 0;
+  }
+  cellsize=ledoubleat(p+16);
+  ncell=le64at(p+24);
+  p+=32;
+  if ((unsigned long long) (end-p)/32<ncell) goto cut;
+  for (i=0;i<ncell;i++,p+=32) {
+    for (j=0;j<3;j++) c[j]=(long long) le64at(p+8*j);
+    cl=findcell(&oldcells,c);
+    memcpy(cl->c,c,sizeof(c));
+    cl->hash=le64at(p+24);
+    cl->used=1;
+    oldcells.n++;
+  }
+  /* the stars, counted first for the table */
+  for (nrow=0, k=p-oldstate.data;k+24<=oldstate.len;nrow++) {
+    k+=24+le64at(oldstate.data+k+16);
+  }
+  if (k!=oldstate.len) goto cut;
+  for (rowmask=1023;rowmask<2*nrow;rowmask=2*rowmask+1);
+  if ((oldrow=(struct incrow *) calloc(rowmask+1,sizeof(struct incrow)))==NULL) {
+    printf("Unable to allocate the last state at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  for (;p<end;p+=24+le64at(p+16)) {
+    key=le64at(p);
+    for (k=key&rowmask;oldrow[k].key && oldrow[k].key!=key;k=(k+1)&rowmask);
+    oldrow[k].key=key;
+    oldrow[k].reach=ledoubleat(p+8);
+    oldrow[k].len=le64at(p+16);
+    oldrow[k].out=p+24;
+  }
+  return 0;
+ cut:
+  printf("%s has been cut short at %s:%d\n",incpath,__FILE__,__LINE__);
+  return -1;
+}
+
+/* mark cell c as changed since the last run */
+static void
+changecell(const long long c[3]) {
+  double centre[3];
+  int j;
+
+  if (c[0]==LLONG_MIN) {
+    /* stars off the grid could be anywhere: match everything again */
+    free((void *) oldrow);
+    oldrow=NULL;
+    return;
+  }
+  for (j=0;j<ndim;j++) centre[j]=(c[j]+0.5)*cellsize;
+  if (kd_insert(changed,centre,NULL)) {
+    printf("Unable to insert point into the tree at %s:%d\n",__FILE__,__LINE__);
+    exit(-1);
+  }
+}
+
+/* cut catalogue 2 into cells, find those that have changed since the
+   last run and start the new state with them */
+int
+startstate(void) {
+  struct celltable cells;
+  struct inccell *cl, *oc;
+  double lo[2]={1.0/0.0,1.0/0.0}, hi[2]={-1.0/0.0,-1.0/0.0}, area;
+  unsigned long long i, nchanged=0, star;
+  long long c[3];
+  int j, fd;
+
+  if (cellsize<=0) {
+    /* INC_STARS to a cell but no smaller than the distance */
+    if (dosphere) {
+      area=4*M_PI;
+    } else {
+      for (i=0;i<ref->n;i++) {
+	for (j=0;j<2;j++) {
+	  if (ref->pos[i*ndim+j]<lo[j]) lo[j]=ref->pos[i*ndim+j];
+	  if (ref->pos[i*ndim+j]>hi[j]) hi[j]=ref->pos[i*ndim+j];
+	}
+      }
+      area=(hi[0]-lo[0])*(hi[1]-lo[1]);
+    }
+    cellsize=sqrt(area*INC_STARS/(ref->n+1));
+    if (cellsize<distance) cellsize=distance;
+    if (!(cellsize>0 && cellsize<1.0/0.0)) cellsize=1;
+  }
+
+  memset(&cells,0,sizeof(cells));
+  for (i=0;i<ref->n;i++) {
+    cellof(ref->pos+i*ndim,c);
+    if (!(cl=findcell(&cells,c))->used) {
+      memcpy(cl->c,c,sizeof(c));
+      cl->hash=HASH_START;
+      cl->used=1;
+      cells.n++;
+    }
+    cl->hash=hashbytes(ref->base+ref->line[i],ref->len[i],cl->hash);
+    cl->hash=hashbytes(ref->pos+i*ndim,sizeof(double)*ndim,cl->hash);
+    /* (-bin prints the number of the star) */
+    star=i;
+    if (dobinary) cl->hash=hashbytes(&star,sizeof(star),cl->hash);
+  }
+
+  /* a cell has changed if it is not the same in both */
+  changed=kd_create(ndim);
+  for (i=0;i<=cells.mask;i++) {
+    if (!cells.cell[i].used) continue;
+    oc=(oldcells.cell ? findcell(&oldcells,cells.cell[i].c) : NULL);
+    if (oc && oc->used && oc->hash==cells.cell[i].hash) {
+      oc->used=2;
+      continue;
+    }
+    changecell(cells.cell[i].c);
+    nchanged++;
+  }
+  for (i=0;oldcells.cell && i<=oldcells.mask;i++) {
+    if (oldcells.cell[i].used!=1) continue;
+    changecell(oldcells.cell[i].c);
+    nchanged++;
+  }
+  if (verbose) printf("# %llu of %llu cells of catalogue 2 have changed\n",nchanged,cells.n);
+
+  /* the new state goes next to the old one until it is complete */
+  if ((statename=(char *) malloc(strlen(incpath)+5))==NULL) {
+    printf("Unable to allocate a file name at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  sprintf(statename,"%s.new",incpath);
+  if ((fd=open(statename,O_WRONLY|O_CREAT|O_TRUNC,0644))<0 || outbuf_open(&state,fd,0)) {
+    printf("Unable to write %s (%s) at %s:%d\n",statename,strerror(errno),__FILE__,__LINE__);
+    return -1;
+  }
+  outbuf_write(&state,INC_MAGIC "\0",8);
+  outbuf_le64(&state,opthash);
+  outbuf_ledouble(&state,cellsize);
+  outbuf_le64(&state,cells.n);
+  for (i=0;i<=cells.mask;i++) {
+    if (!cells.cell[i].used) continue;
+    for (j=0;j<3;j++) outbuf_le64(&state,(unsigned long long) cells.cell[i].c[j]);
+    outbuf_le64(&state,cells.cell[i].hash);
+  }
+  free((void *) cells.cell);
+  return 0;
+}
+
+/* the stars of block bl whose output from the last run still holds */
+void
+reuseblock(struct block *bl) {
+  struct kdres *res;
+  struct incrow *r;
+  double pos[3];
+  unsigned long long k;
+  unsigned int i;
+
+  for (i=0;i<bl->n;i++) {
+    bl->reuse[i]=NULL;
+    if (bl->kind[i]!=LINE_STAR) continue;
+    bl->key[i]=rowkey(bl->store.text+bl->line[i],bl->len[i],bl->pos[i],bl->id[i]);
+    if (oldrow==NULL) continue;
+    for (k=bl->key[i]&rowmask;oldrow[k].key && oldrow[k].key!=bl->key[i];k=(k+1)&rowmask);
+    r=oldrow+k;
+    if (r->key==0) continue;
+    /* is every changed cell (even its corners) beyond its reach? */
+    if ((res=kd_nearest(changed,bl->pos[i])) && kd_res_size(res)>0) {
+      kd_res_item(res,pos);
+      if (!(stardist(pos,bl->pos[i])>r->reach+cellsize*sqrt((double) ndim)/2*1.000001)) r=NULL;
+    }
+    if (res) kd_res_free(res);
+    if (r) {
+      bl->reuse[i]=r;
+      nreused++;
+    }
+  }
+}
+
+/* lines a to b-1 of block bl into the new state, with their output
+   (from out, where the output of line a starts) */
+void
+saveblock(struct block *bl, unsigned int a, unsigned int b, const char *out) {
+  unsigned int i;
+
+  for (i=a;i<b;i++) {
+    if (bl->kind[i]==LINE_COMMENT) {
+      out+=bl->len[i];
+      continue;
+    }
+    if (bl->kind[i]==LINE_STAR) {
+      outbuf_le64(&state,bl->key[i]);
+      outbuf_ledouble(&state,bl->reach[i]);
+      outbuf_le64(&state,bl->bytes[i]);
+      outbuf_write(&state,out,bl->bytes[i]);
+    }
+    out+=bl->bytes[i];
+  }
+}
+
+/* put the new state in place of the old */
+int
+endstate(void) {
+  int fd=state.fd;
+
+  if (outbuf_close(&state) || close(fd) || rename(statename,incpath)) {
+    printf("Unable to write %s at %s:%d\n",incpath,__FILE__,__LINE__);
+    return -1;
+  }
+  if (verbose) printf("# %llu stars of catalogue 1 were copied from the last run\n",nreused);
+  free((void *) statename);
+  free((void *) oldrow);
+  free((void *) oldcells.cell);
+  if (oldstate.data) loadfile_text_free(&oldstate);
+  kd_free(changed);
+  return 0;
+}
+
+/* -inc: lines a to b-1 of block bl, whose neighbours were found in
+   part for the stars not copied from the last run alone (from the ka-th
+   of them), with those in place and none for the others */
+void
+spreadcsr(struct block *bl, const struct rangejoin *part, unsigned int a, unsigned int b, unsigned int ka, struct rangejoin *csr) {
+  unsigned int i, k;
+
+  for (i=a, k=ka;i<b;i++) {
+    csr->offset[i]=part->offset[k];
+    if (!bl->reuse[i]) k++;
+  }
+  csr->offset[b]=part->offset[k];
+  csr->index=part->index;
+  csr->dist=part->dist;
+}
+
+/* the hash of the options that are not in the globals, and of those
+   that are */
+void
+incoptions(unsigned int cols1[3], unsigned int cols2[3], char *names1[3], char *names2[3],
+	   const char *fs1, const char *fs2) {
+  int j;
+
+  opthash=hashbytes(cols1,sizeof(unsigned int)*3,HASH_START);
+  opthash=hashbytes(cols2,sizeof(unsigned int)*3,opthash);
+  for (j=0;j<3;j++) {
+    if (names1[j]) opthash=hashbytes(names1[j],strlen(names1[j])+1,opthash);
+    if (names2[j]) opthash=hashbytes(names2[j],strlen(names2[j])+1,opthash);
+  }
+  opthash=hashbytes(fs1,strlen(fs1)+1,opthash);
+  opthash=hashbytes(fs2,strlen(fs2)+1,opthash);
+  opthash=hashbytes(&distance,sizeof(distance),opthash);
+  if (dotransform1) opthash=hashbytes(transform1,sizeof(double)*6,opthash);
+  if (dotransform2) opthash=hashbytes(transform2,sizeof(double)*6,opthash);
+  j=dotransform1+2*dotransform2+4*donearest+8*dosphere+16*dobinary;
+  opthash=hashbytes(&j,sizeof(j),opthash);
+}
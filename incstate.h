@@ -0,0 +1,75 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#ifndef _INCSTATE_H_
+#define _INCSTATE_H_
+
+#include "match_kd.h"
+
+/* -inc: the state of the last run is kept next to the output so that
+   only what has changed is matched again.  Catalogue 2 is cut into the
+   cells of a grid, each with an FNV-1a hash of its stars; each star of
+   catalogue 1 has a hash of its line, how far from it its output depends
+   on catalogue 2 (its closest star or the distance, whichever is
+   further) and its output.  A star whose hash is in the last state and with no
+   changed cell within that reach has its output copied from it.  The
+   state is INC_MAGIC, the hash of the options and the size of the cells;
+   the number of cells and the coordinates and hash of each; then for
+   each star of catalogue 1 its hash, reach, the length of its output and
+   the output, all as eight byte little-endian numbers. */
+
+/* a star of catalogue 1 in the last state */
+struct incrow {
+  unsigned long long key, len;
+  double reach;
+  const char *out;
+};
+extern char *incpath;
+
+/* the last state only holds for the same options: those not kept in
+   match_kd's globals are passed here */
+void incoptions(unsigned int cols1[3], unsigned int cols2[3], char *names1[3], char *names2[3],
+		const char *fs1, const char *fs2);
+/* read the state of the last run, if there is one for the same options */
+int loadstate(void);
+/* cut catalogue 2 into cells, find those that have changed since the
+   last run and start the new state with them */
+int startstate(void);
+/* the stars of block bl whose output from the last run still holds */
+void reuseblock(struct block *bl);
+/* lines a to b-1 of block bl into the new state, with their output
+   (from out, where the output of line a starts) */
+void saveblock(struct block *bl, unsigned int a, unsigned int b, const char *out);
+/* put the new state in place of the old */
+int endstate(void);
+/* lines a to b-1 of block bl, whose neighbours were found in part for
+   the stars not copied from the last run alone (from the ka-th of them),
+   with those in place and none for the others */
+void spreadcsr(struct block *bl, const struct rangejoin *part, unsigned int a, unsigned int b, unsigned int ka, struct rangejoin *csr);
+
+#endif	/* _INCSTATE_H_ */
@@ -205,7 +205,7 @@ int kd_insert(struct kdtree *tree, const double *pos, void *data)
 
 int kd_insertf(struct kdtree *tree, const float *pos, void *data)
 {
-	static double sbuf[16];
+	double sbuf[16] = {0};	/* (so the compiler can see it is set) */
 	double *bptr, *buf = 0;
 	int res, dim = tree->dim;
 
@@ -287,55 +287,48 @@ static int find_nearest(struct kdnode *node, const double *pos, double range, st
 	return added_res;
 }
 
-#if 0
-static int find_nearest_n(struct kdnode *node, const double *pos, double range, int num, struct rheap *heap, int dim)
+/* keep the num nearest nodes in list, in order of distance, with the
+ * distance to the furthest of them in *range_sq once there are num */
+static int find_nearest_n(struct kdnode *node, const double *pos, int num, struct res_node *list, int *size, double *range_sq, int dim)
 {
+	struct res_node *last;
 	double dist_sq, dx;
-	int i, ret, added_res = 0;
+	int i;
 
 	if(!node) return 0;
-	
-	/* if the photon is close enough, add it to the result heap */
+
 	dist_sq = 0;
 	for(i=0; i<dim; i++) {
 		dist_sq += SQ(node->pos[i] - pos[i]);
 	}
-	if(dist_sq <= range_sq) {
-		if(heap->size >= num) {
-			/* get furthest element */
-			struct res_node *maxelem = rheap_get_max(heap);
-
-			/* and check if the new one is closer than that */
-			if(maxelem->dist_sq > dist_sq) {
-				rheap_remove_max(heap);
-
-				if(rheap_insert(heap, node, dist_sq) == -1) {
-					return -1;
-				}
-				added_res = 1;
-
-				range_sq = dist_sq;
-			}
-		} else {
-			if(rheap_insert(heap, node, dist_sq) == -1) {
-				return =1;
-			}
-			added_res = 1;
+	if(*size < num || dist_sq < *range_sq) {
+		if(rlist_insert(list, node, dist_sq) == -1) {
+			return -1;
+		}
+		if(++*size > num) {
+			/* drop the furthest */
+			for(last = list; last->next->next; last = last->next);
+			free_resnode(last->next);
+			last->next = 0;
+			--*size;
+		}
+		if(*size == num) {
+			for(last = list; last->next; last = last->next);
+			*range_sq = last->dist_sq;
 		}
 	}
 
-
 	/* find signed distance from the splitting plane */
 	dx = pos[node->dir] - node->pos[node->dir];
 
-	ret = find_nearest_n(dx <= 0.0 ? node->left : node->right, pos, range, num, heap, dim);
-	if(ret >= 0 && fabs(dx) < range) {
-		added_res += ret;
-		ret = find_nearest_n(dx <= 0.0 ? node->right : node->left, pos, range, num, heap, dim);
+	if(find_nearest_n(dx <= 0.0 ? node->left : node->right, pos, num, list, size, range_sq, dim) == -1) {
+		return -1;
 	}
-
+	if(*size < num || SQ(dx) < *range_sq) {
+		return find_nearest_n(dx <= 0.0 ? node->right : node->left, pos, num, list, size, range_sq, dim);
+	}
+	return 0;
 }
-#endif
 
 static void kd_nearest_i(struct kdnode *node, const double *pos, struct kdnode **result, double *result_dist_sq, struct kdhyperrect* rect)
 {
@@ -453,7 +446,7 @@ struct kdres *kd_nearest(struct kdtree *kd, const double *pos)
 
 struct kdres *kd_nearestf(struct kdtree *tree, const float *pos)
 {
-	static double sbuf[16];
+	double sbuf[16];
 	double *bptr, *buf = 0;
 	int dim = tree->dim;
 	struct kdres *res;
@@ -504,11 +497,11 @@ struct kdres *kd_nearest3f(struct kdtree *tree, float x, float y, float z)
 }
 
 /* ---- nearest N search ---- */
-/*
-static kdres *kd_nearest_n(struct kdtree *kd, const double *pos, int num)
+struct kdres *kd_nearest_n(struct kdtree *kd, const double *pos, int num)
 {
-	int ret;
 	struct kdres *rset;
+	double range_sq = 0;
+	int size = 0;
 
 	if(!(rset = malloc(sizeof *rset))) {
 		return 0;
@@ -520,14 +513,15 @@ static kdres *kd_nearest_n(struct kdtree *kd, const double *pos, int num)
 	rset->rlist->next = 0;
 	rset->tree = kd;
 
-	if((ret = find_nearest_n(kd->root, pos, range, num, rset->rlist, kd->dim)) == -1) {
+	if(num > 0 && find_nearest_n(kd->root, pos, num, rset->rlist, &size, &range_sq, kd->dim) == -1) {
+		rset->size = 0;
 		kd_res_free(rset);
 		return 0;
 	}
-	rset->size = ret;
+	rset->size = size;
 	kd_res_rewind(rset);
 	return rset;
-}*/
+}
 
 struct kdres *kd_nearest_range(struct kdtree *kd, const double *pos, double range)
 {
@@ -555,7 +549,7 @@ struct kdres *kd_nearest_range(struct kdtree *kd, const double *pos, double rang
 
 struct kdres *kd_nearest_rangef(struct kdtree *kd, const float *pos, float range)
 {
-	static double sbuf[16];
+	double sbuf[16];
 	double *bptr, *buf = 0;
 	int dim = kd->dim;
 	struct kdres *res;
@@ -72,9 +72,10 @@ struct kdres *kd_nearest3f(struct kdtree *tree, float x, float y, float z);
  * The returned pointer can be null as an indication of an error. Otherwise
  * a valid result set is always returned which may contain 0 or more elements.
  * The result set must be deallocated with kd_res_free after use.
+ * The elements are in order of distance, nearest first.
  */
-/*
 struct kdres *kd_nearest_n(struct kdtree *tree, const double *pos, int num);
+/*
 struct kdres *kd_nearest_nf(struct kdtree *tree, const float *pos, int num);
 struct kdres *kd_nearest_n3(struct kdtree *tree, double x, double y, double z);
 struct kdres *kd_nearest_n3f(struct kdtree *tree, float x, float y, float z);
@@ -30,74 +30,771 @@ OF SUCH DAMAGE.
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
 #include "loadfile.h"
+#include "catfile.h"
+#include "fitsfile.h"
+#include "zstream.h"
 
 #define ALLOCBLOCK 512
-#define MAXCOLUMNS 100
+#define READBLOCK 65536
+/* do not bother splitting text smaller than this among threads */
+#define MINCHUNK (1<<20)
 #define LOADFILE_FS " \t"
 
-unsigned int
-loadfile_fileptr_fs(FILE *in, unsigned int ncolumns, unsigned int columns[], double *data[], char *fs) {
-  unsigned int i, j, ialloc;
-  char buffer[1024];
-  char **ap, *argv[MAXCOLUMNS], *inputstring;
+/* number of threads used to parse text; zero for one per processor */
+static int loadfile_nthreads=0;
+
+/* one newline-delimited piece of the text and the columns parsed from it */
+struct loadfile_chunk {
+  const char *base, *start, *end;
   int loadon;
+  unsigned int ncolumns, *columns, nfield;
+  const struct loadfile_fs *isfs;
+  double **data;
+  size_t *row;
+  int wantrow;
+  unsigned int n;
+  int status;
+};
+
+/* powers of ten that are exact in a double */
+static const double exact_pow10[]={
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
+/* convert the number at the start of s (ending by e at the latest) just
+   as atof would.  Decimal numbers with at most 19 significant digits whose
+   mantissa and power of ten are both exact in a double are converted
+   directly, which rounds correctly; anything else goes to strtod. */
+double
+loadfile_atof(const char *s, const char *e) {
+  const char *p=s, *digits;
+  unsigned long long mant=0;
+  int ndigit=0, exp10=0, expval=0, negative=0, negexp=0;
+  char sbuf[64], *lbuf;
+  double value;
+
+  while (p<e && (*p==' ' || *p=='\t' || *p=='\n' || *p=='\r' || *p=='\f' || *p=='\v')) p++;
+  s=p;
+  if (p<e && (*p=='-' || *p=='+')) negative=(*p++=='-');
+  /* hex goes to strtod */
+  if (p+1<e && *p=='0' && (p[1]=='x' || p[1]=='X')) goto slow;
+  digits=p;
+  while (p<e && *p=='0') p++;
+  for (;p<e && *p>='0' && *p<='9';p++) {
+    if (ndigit<19) {
+      mant=10*mant+(*p-'0');
+    } else {
+      exp10++;
+    }
+    ndigit++;
+  }
+  if (p<e && *p=='.') {
+    p++;
+    if (mant==0) {
+      while (p<e && *p=='0') {
+	p++;
+	exp10--;
+      }
+    }
+    for (;p<e && *p>='0' && *p<='9';p++) {
+      if (ndigit<19) {
+	mant=10*mant+(*p-'0');
+	exp10--;
+      }
+      ndigit++;
+    }
+  }
+  if (p==digits || (p==digits+1 && *digits=='.')) {
+    /* no digits: inf, nan, hex or not a number at all */
+    goto slow;
+  }
+  if (p<e && (*p=='e' || *p=='E')) {
+    const char *q=p+1;
+    if (q<e && (*q=='-' || *q=='+')) negexp=(*q++=='-');
+    if (q<e && *q>='0' && *q<='9') {
+      for (;q<e && *q>='0' && *q<='9';q++) {
+	if (expval<10000) expval=10*expval+(*q-'0');
+      }
+      exp10+=(negexp ? -expval : expval);
+    }
+  }
+  if (ndigit>19 || mant>(1ULL<<53) || exp10<-22 || exp10>22) goto slow;
+  value=(double) mant;
+  if (exp10<0) {
+    value/=exact_pow10[-exp10];
+  } else {
+    value*=exact_pow10[exp10];
+  }
+  return (negative ? -value : value);
+
+ slow:
+  /* copy the token so strtod cannot run past the end of the text */
+  for (p=s;p<e && *p!=' ' && *p!='\t' && *p!='\n';p++);
+  if (p-s<sizeof(sbuf)) {
+    memcpy(sbuf,s,p-s);
+    sbuf[p-s]=0;
+    return strtod(sbuf,NULL);
+  }
+  if ((lbuf=(char *) malloc(p-s+1))==NULL) {
+    return 0.0/0.0;
+  }
+  memcpy(lbuf,s,p-s);
+  lbuf[p-s]=0;
+  value=strtod(lbuf,NULL);
+  free((void *) lbuf);
+  return value;
+}
+
+#define ONES 0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
+/* the first separator at or after s (or e), eight bytes at a time while
+   there are eight left: a byte of w^word is zero where w holds that
+   separator, and (x-ONES)&~x&HIGHS flags the lowest zero byte of x exactly
+   (a byte above it may be flagged wrongly) */
+static const char *
+fieldend(const char *s, const char *e, const struct loadfile_fs *isfs) {
+  unsigned long long w, x, zero;
+  int k;
+
+  if (isfs->nword>0) {
+    for (;e-s>=8;s+=8) {
+      memcpy(&w,s,8);
+      for (k=0, zero=0;k<isfs->nword;k++) {
+	x=w^isfs->word[k];
+	zero|=(x-ONES)&~x&HIGHS;
+      }
+      if (zero) {
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+	/* (the lowest byte flagged is the first separator) */
+	return s+(__builtin_ctzll(zero)>>3);
+#else
+	for (;!isfs->is[(unsigned char) *s];s++);
+	return s;
+#endif
+      }
+    }
+  }
+  while (s<e && !isfs->is[(unsigned char) *s]) s++;
+  return s;
+}
+
+unsigned int
+loadfile_split(const char *s, const char *e, const struct loadfile_fs *isfs, unsigned int nfield, const char *start[], const char *end[]) {
+  unsigned int n=0;
+
+  while (n<nfield) {
+    /* runs of separators give empty fields which are skipped */
+    while (s<e && isfs->is[(unsigned char) *s]) s++;
+    if (s==e) break;
+    start[n]=s;
+    s=fieldend(s,e,isfs);
+    end[n++]=s;
+  }
+  return n;
+}
+
+void
+loadfile_separators(struct loadfile_fs *isfs, const char *fs) {
+  memset(isfs->is,0,256);
+  for (isfs->nword=0;*fs;fs++) {
+    if (!isfs->is[(unsigned char) *fs] && isfs->nword>=0) {
+      if (isfs->nword<LOADFILE_NSEP) {
+	isfs->word[isfs->nword++]=ONES*(unsigned char) *fs;
+      } else {
+	isfs->nword=-1;
+      }
+    }
+    isfs->is[(unsigned char) *fs]=1;
+  }
+  if (isfs->nword<0) isfs->nword=0;
+}
+
+void
+loadfile_threads(int nthreads) {
+  loadfile_nthreads=nthreads;
+}
+
+/* count the lines starting with '*', which toggle reading on and off */
+static unsigned long
+counttoggles(const char *line, const char *bufend) {
+  unsigned long ntoggle=0;
+  const char *eol;
+
+  for (;line<bufend;line=eol+1) {
+    if (*line=='*') ntoggle++;
+    if ((eol=memchr(line,'\n',bufend-line))==NULL) break;
+  }
+  return ntoggle;
+}
+
+/* parse the rows of one chunk into freshly allocated columns */
+static void *
+parsechunk(void *arg) {
+  struct loadfile_chunk *c=(struct loadfile_chunk *) arg;
+  unsigned int i, j, ialloc, nfound, ncolumns=c->ncolumns;
+  const char *line, *eol, *next;
+  const char **start, **end;
+  int loadon=c->loadon;
+
+  c->status=-1;
+  c->n=0;
+  if ((start=(const char **) malloc(sizeof(char *)*c->nfield))==NULL ||
+      (end=(const char **) malloc(sizeof(char *)*c->nfield))==NULL) {
+    printf("Unable to allocate fields in %s:%d\n",__FILE__,__LINE__);
+    return NULL;
+  }
+
+  ialloc=ALLOCBLOCK;
   for (j=0;j<ncolumns;j++) {
-    if ((data[j]=(double *) malloc(sizeof(double)*512))==NULL) {
+    if ((c->data[j]=(double *) malloc(sizeof(double)*ialloc))==NULL) {
       printf("Unable to allocate data[%d] in %s:%d\n",j,__FILE__,__LINE__);
-      return 0;
+      return NULL;
     }
   }
-  ialloc=512;
+  c->row=NULL;
+  if (c->wantrow && (c->row=(size_t *) malloc(sizeof(size_t)*ialloc))==NULL) {
+    printf("Unable to allocate row offsets in %s:%d\n",__FILE__,__LINE__);
+    return NULL;
+  }
 
   i=0;
-  loadon=1;
-  while (fgets(buffer,1023,in)) {
-    if (buffer[0]=='*') loadon=1-loadon;
-    if (buffer[0]=='#' || buffer[0]=='*' || !loadon) {
-      /* skip the line */
+  for (line=c->start;line<c->end;line=next) {
+    if ((eol=memchr(line,'\n',c->end-line))==NULL) {
+      eol=next=c->end;
     } else {
-      inputstring=buffer;
-      /* break line into up to MAXCOLUMNS columns */
-      for (ap = argv; (*ap = strsep(&inputstring, fs)) != NULL;)
-	if (**ap != '\0')
-	  if (++ap >= &argv[MAXCOLUMNS])
-	    break;
-      /* were there any tokens? */
-      if (ap>argv) {
-	/* assign columns to the data arrays; missing values given nan */
-	for (j=0;j<ncolumns;j++) {
-	  data[j][i]=(argv+columns[j]<=ap ? atof(argv[columns[j]-1]) : 0.0/0.0);
-	}
-	i++;
-	/* do we need to allocate more memory? */
-	if (i==ialloc) {
-	  for (j=0;j<ncolumns;j++) {
-	    if ((data[j]=(double *) realloc((void *) data[j],sizeof(double)*(i+512)))==NULL) {
-	      printf("Unable to reallocate data[%d] in %s:%d\n",j,__FILE__,__LINE__);
-	      return 0;
-	    }
-	  }
-	  ialloc=i+512;
+      next=eol+1;
+    }
+    if (eol>line && eol[-1]=='\r') eol--;
+    if (line[0]=='*') loadon=1-loadon;
+    if (line[0]=='#' || line[0]=='*' || !loadon) {
+      /* skip the line */
+      continue;
+    }
+    /* break line into the fields up to the last column needed */
+    nfound=loadfile_split(line,eol,c->isfs,c->nfield,start,end);
+    /* were there any tokens? */
+    if (nfound==0) continue;
+    /* do we need to allocate more memory? */
+    if (i==ialloc) {
+      ialloc*=2;
+      for (j=0;j<ncolumns;j++) {
+	if ((c->data[j]=(double *) realloc((void *) c->data[j],sizeof(double)*ialloc))==NULL) {
+	  printf("Unable to reallocate data[%d] in %s:%d\n",j,__FILE__,__LINE__);
+	  return NULL;
 	}
       }
+      if (c->row && (c->row=(size_t *) realloc((void *) c->row,sizeof(size_t)*ialloc))==NULL) {
+	printf("Unable to reallocate row offsets in %s:%d\n",__FILE__,__LINE__);
+	return NULL;
+      }
+    }
+    if (c->row) c->row[i]=line-c->base;
+    /* assign columns to the data arrays; missing values given nan */
+    for (j=0;j<ncolumns;j++) {
+      c->data[j][i]=(c->columns[j]>0 && c->columns[j]<=nfound ? loadfile_atof(start[c->columns[j]-1],end[c->columns[j]-1]) : 0.0/0.0);
+    }
+    i++;
+  }
+  free((void *) start);
+  free((void *) end);
+  c->n=i;
+  c->loadon=loadon;
+  c->status=0;
+  return NULL;
+}
+
+/* run fn on each chunk, one thread per chunk */
+static void
+runchunks(struct loadfile_chunk *chunk, int nchunk, void *(*fn)(void *)) {
+  pthread_t *tid;
+  int t;
+
+  if (nchunk==1 || (tid=(pthread_t *) malloc(sizeof(pthread_t)*nchunk))==NULL) {
+    for (t=0;t<nchunk;t++) {
+      fn((void *) (chunk+t));
+    }
+    return;
+  }
+  for (t=0;t<nchunk;t++) {
+    if (pthread_create(tid+t,NULL,fn,(void *) (chunk+t))) {
+      tid[t]=pthread_self();
+      fn((void *) (chunk+t));
     }
   }
-  /* free excess memory */
+  for (t=0;t<nchunk;t++) {
+    if (!pthread_equal(tid[t],pthread_self())) pthread_join(tid[t],NULL);
+  }
+  free((void *) tid);
+}
+
+static void *
+togglechunk(void *arg) {
+  struct loadfile_chunk *c=(struct loadfile_chunk *) arg;
+
+  c->loadon=(int) (counttoggles(c->start,c->end)&1);
+  return NULL;
+}
+
+/* the separator table for fs; returns the number of fields needed */
+static unsigned int
+setfields(struct loadfile_fs *isfs, const char *fs, unsigned int ncolumns, unsigned int columns[]) {
+  unsigned int j, maxcol=0;
+
+  loadfile_separators(isfs,fs);
   for (j=0;j<ncolumns;j++) {
-    if ((data[j]=(double *) realloc((void *) data[j],sizeof(double)*i))==NULL) {
-      printf("Unable to reallocate data[%d] in %s:%d\n",j,__FILE__,__LINE__);
-      return 0;
+    if (columns[j]>maxcol) maxcol=columns[j];
+  }
+  return (maxcol>0 ? maxcol : 1);
+}
+
+/* the columns of the parsed chunks in file order (the chunks' own
+   columns are freed); returns the number of rows */
+static unsigned int
+gatherchunks(struct loadfile_chunk *chunk, int nchunk, unsigned int ncolumns, double *data[], size_t **row) {
+  unsigned int i, j, total;
+  int t;
+
+  total=0;
+  for (t=0;t<nchunk;t++) {
+    if (chunk[t].status) {
+      total=0;
+      break;
+    }
+    total+=chunk[t].n;
+  }
+
+  if (nchunk==1 && chunk[0].status==0) {
+    /* the columns of the only chunk are the result */
+    for (j=0;j<ncolumns;j++) {
+      if ((data[j]=(double *) realloc((void *) chunk[0].data[j],sizeof(double)*(total>0 ? total : 1)))==NULL) {
+	printf("Unable to reallocate data[%d] in %s:%d\n",j,__FILE__,__LINE__);
+	total=0;
+      }
+    }
+    if (row) *row=chunk[0].row;
+  } else {
+    if (row && total>0) {
+      if ((*row=(size_t *) malloc(sizeof(size_t)*total))==NULL) {
+	printf("Unable to allocate row offsets in %s:%d\n",__FILE__,__LINE__);
+	total=0;
+      }
+      i=0;
+      for (t=0;t<nchunk && total>0;t++) {
+	memcpy(*row+i,chunk[t].row,sizeof(size_t)*chunk[t].n);
+	i+=chunk[t].n;
+      }
+    } else if (row) {
+      *row=NULL;
+    }
+    /* concatenate the columns of the chunks in file order */
+    for (j=0;j<ncolumns;j++) {
+      if ((data[j]=(double *) malloc(sizeof(double)*(total>0 ? total : 1)))==NULL) {
+	printf("Unable to allocate data[%d] in %s:%d\n",j,__FILE__,__LINE__);
+	total=0;
+	break;
+      }
+      i=0;
+      for (t=0;t<nchunk && total>0;t++) {
+	memcpy(data[j]+i,chunk[t].data[j],sizeof(double)*chunk[t].n);
+	i+=chunk[t].n;
+      }
+    }
+    for (t=0;t<nchunk;t++) {
+      if (chunk[t].status) continue;
+      for (j=0;j<ncolumns;j++) {
+	free((void *) chunk[t].data[j]);
+      }
+      free((void *) chunk[t].row);
+    }
+  }
+  return total;
+}
+
+unsigned int
+loadfile_buffer_fs(const char *buf, size_t len, unsigned int ncolumns, unsigned int columns[], double *data[], char *fs) {
+  return loadfile_buffer_rows_fs(buf,len,ncolumns,columns,data,fs,NULL);
+}
+
+unsigned int
+loadfile_buffer_rows_fs(const char *buf, size_t len, unsigned int ncolumns, unsigned int columns[], double *data[], char *fs, size_t **row) {
+  struct loadfile_chunk *chunk;
+  const char *bufend=buf+len, *p;
+  unsigned int nfield, total;
+  struct loadfile_fs isfs;
+  int nchunk, t, loadon, odd;
+
+  nfield=setfields(&isfs,fs,ncolumns,columns);
+
+  /* split the text at newlines into a chunk per thread */
+  nchunk=(loadfile_nthreads>0 ? loadfile_nthreads : (int) sysconf(_SC_NPROCESSORS_ONLN));
+  if (nchunk>len/MINCHUNK) nchunk=len/MINCHUNK;
+  if (nchunk<1) nchunk=1;
+  if ((chunk=(struct loadfile_chunk *) malloc(sizeof(struct loadfile_chunk)*nchunk))==NULL ||
+      (chunk[0].data=(double **) malloc(sizeof(double *)*nchunk*(ncolumns>0 ? ncolumns : 1)))==NULL) {
+    printf("Unable to allocate chunks in %s:%d\n",__FILE__,__LINE__);
+    return 0;
+  }
+  p=buf;
+  for (t=0;t<nchunk;t++) {
+    chunk[t].start=p;
+    if (t==nchunk-1) {
+      p=bufend;
+    } else {
+      p=buf+len/nchunk*(t+1);
+      if (p<chunk[t].start) p=chunk[t].start;
+      if ((p=memchr(p,'\n',bufend-p))==NULL) {
+	p=bufend;
+      } else {
+	p++;
+      }
     }
+    chunk[t].end=p;
+    chunk[t].base=buf;
+    chunk[t].wantrow=(row!=NULL);
+    chunk[t].ncolumns=ncolumns;
+    chunk[t].columns=columns;
+    chunk[t].nfield=nfield;
+    chunk[t].isfs=&isfs;
+    chunk[t].data=chunk[0].data+t*ncolumns;
   }
-  
+
+  /* a line starting with '*' toggles reading, so each chunk starts in
+     the state left by the odd or even number of toggles before it */
+  if (nchunk>1) {
+    runchunks(chunk,nchunk,togglechunk);
+  }
+  loadon=1;
+  for (t=0;t<nchunk;t++) {
+    odd=(nchunk>1 ? chunk[t].loadon : 0);
+    chunk[t].loadon=loadon;
+    if (odd) loadon=1-loadon;
+  }
+
+  runchunks(chunk,nchunk,parsechunk);
+  total=gatherchunks(chunk,nchunk,ncolumns,data,row);
+  free((void *) chunk[0].data);
+  free((void *) chunk);
+
   /* return the number of lines read */
-  return i;
+  return total;
+}
+
+/* read all of a decoded stream into text */
+static int
+readtext(struct zstream *zs, struct loadfile_text *text) {
+  size_t n, alloc=READBLOCK;
+
+  if ((text->data=(char *) malloc(alloc))==NULL) {
+    printf("Unable to allocate input buffer in %s:%d\n",__FILE__,__LINE__);
+    zstream_close(zs);
+    return -1;
+  }
+  text->len=0;
+  while ((n=zstream_read(zs,text->data+text->len,alloc-text->len))>0) {
+    text->len+=n;
+    if (text->len==alloc) {
+      alloc*=2;
+      if ((text->data=(char *) realloc((void *) text->data,alloc))==NULL) {
+	printf("Unable to reallocate input buffer in %s:%d\n",__FILE__,__LINE__);
+	zstream_close(zs);
+	return -1;
+      }
+    }
+  }
+  if (zstream_close(zs)) {
+    free((void *) text->data);
+    return -1;
+  }
+  return 0;
+}
+
+/* map the rest of a regular file, or read the rest of a stream */
+int
+loadfile_text_fileptr(FILE *in, struct loadfile_text *text) {
+  struct zstream *zs;
+  struct stat st;
+  off_t offset;
+  size_t n, alloc;
+  long pagesize;
+
+  text->map=NULL;
+  text->maplen=0;
+  if (zstream_open(in,&zs)) {
+    return -1;
+  }
+  if (zs) {
+    /* compressed (or an unrewindable pipe): read what the decoder gives */
+    return readtext(zs,text);
+  }
+  offset=ftello(in);
+  if (offset>=0 && fstat(fileno(in),&st)==0 && S_ISREG(st.st_mode) && st.st_size>offset) {
+    text->maplen=st.st_size;
+    if ((text->map=mmap(NULL,text->maplen,PROT_READ,MAP_PRIVATE,fileno(in),0))!=MAP_FAILED) {
+      madvise(text->map,text->maplen,MADV_SEQUENTIAL);
+      text->data=(char *) text->map+offset;
+      text->len=st.st_size-offset;
+      /* leave the stream where reading it would have */
+      fseeko(in,0,SEEK_END);
+      return 0;
+    }
+    text->map=NULL;
+    text->maplen=0;
+  }
+
+  /* not a regular file (or mmap failed): read it in, growing the buffer geometrically */
+  pagesize=sysconf(_SC_PAGESIZE);
+  alloc=(READBLOCK>pagesize ? READBLOCK : pagesize);
+  if ((text->data=(char *) malloc(alloc))==NULL) {
+    printf("Unable to allocate input buffer in %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  text->len=0;
+  while ((n=fread(text->data+text->len,1,alloc-text->len,in))>0) {
+    text->len+=n;
+    if (text->len==alloc) {
+      alloc*=2;
+      if ((text->data=(char *) realloc((void *) text->data,alloc))==NULL) {
+	printf("Unable to reallocate input buffer in %s:%d\n",__FILE__,__LINE__);
+	return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+void
+loadfile_text_free(struct loadfile_text *text) {
+  if (text->map) {
+    munmap(text->map,text->maplen);
+  } else {
+    free((void *) text->data);
+  }
+}
+
+/* look the named columns up in a binary catalogue by name */
+static unsigned int
+catfile_named(const char *buf, size_t len, unsigned int ncolumns, unsigned int columns[], char *names[], double *data[]) {
+  struct catfile cf;
+  unsigned int j, *source;
+  int k;
+  unsigned int retval;
+
+  if (catfile_open(buf,len,&cf)) {
+    return 0;
+  }
+  if ((source=(unsigned int *) malloc(sizeof(unsigned int)*(ncolumns+1)))==NULL) {
+    printf("Unable to allocate source in %s:%d\n",__FILE__,__LINE__);
+    catfile_close(&cf);
+    return 0;
+  }
+  for (j=0;j<ncolumns;j++) {
+    source[j]=columns[j];
+    if (names==NULL || names[j]==NULL) continue;
+    k=catfile_findname(&cf,names[j]);
+    if (k<0 || cf.column[k].source==0) {
+      printf("There is no column %s in the binary catalogue at %s:%d\n",names[j],__FILE__,__LINE__);
+      source[j]=0;
+    } else {
+      source[j]=cf.column[k].source;
+    }
+  }
+  catfile_close(&cf);
+  retval=catfile_load(buf,len,ncolumns,source,data);
+  free((void *) source);
+  return retval;
+}
+
+/* FITS tables take names or numbers alike */
+static unsigned int
+fitsfile_named(const char *buf, size_t len, unsigned int ncolumns, unsigned int columns[], char *names[], double *data[]) {
+  char **colname, *number;
+  unsigned int j, retval;
+
+  if ((colname=(char **) malloc(sizeof(char *)*(ncolumns+1)))==NULL ||
+      (number=(char *) malloc(16*(ncolumns+1)))==NULL) {
+    printf("Unable to allocate colname in %s:%d\n",__FILE__,__LINE__);
+    return 0;
+  }
+  for (j=0;j<ncolumns;j++) {
+    if (names!=NULL && names[j]!=NULL) {
+      colname[j]=names[j];
+    } else {
+      colname[j]=number+16*j;
+      sprintf(colname[j],"%u",columns[j]);
+    }
+  }
+  retval=fitsfile_load(buf,len,ncolumns,colname,data);
+  free((void *) number);
+  free((void *) colname);
+  return retval;
+}
+
+void
+loadfile_column(char *arg, unsigned int *column, char **name) {
+  char *end;
+  unsigned long n;
+
+  n=strtoul(arg,&end,10);
+  if (end>arg && *end==0) {
+    *column=n;
+    *name=NULL;
+  } else {
+    *column=0;
+    *name=arg;
+  }
+}
+
+/* do named columns rule out a text catalogue? */
+static int
+needsnames(unsigned int ncolumns, char *names[]) {
+  unsigned int j;
+
+  for (j=0;names!=NULL && j<ncolumns;j++) {
+    if (names[j]!=NULL) {
+      printf("Column %s must be given by number for a text catalogue at %s:%d\n",names[j],__FILE__,__LINE__);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* parse the text of a decoded stream a piece at a time as it arrives,
+   so that parsing overlaps decoding; binary formats are read whole */
+static unsigned int
+loadfile_zstream_fs(struct zstream *zs, unsigned int ncolumns, unsigned int columns[], char *names[], double *data[], char *fs) {
+  struct loadfile_text text;
+  struct loadfile_chunk *chunk=NULL, *c;
+  size_t alloc=READBLOCK, parsed=0, end, n;
+  unsigned int nfield, j, retval=0;
+  struct loadfile_fs isfs;
+  int nchunk=0, chunkalloc=0, loadon=1, binary=-1, eof=0, t;
+
+  nfield=setfields(&isfs,fs,ncolumns,columns);
+  if ((text.data=(char *) malloc(alloc))==NULL) {
+    printf("Unable to allocate input buffer in %s:%d\n",__FILE__,__LINE__);
+    zstream_close(zs);
+    return 0;
+  }
+  text.len=0;
+  while (!eof) {
+    if (text.len==alloc) {
+      alloc*=2;
+      if ((text.data=(char *) realloc((void *) text.data,alloc))==NULL) {
+	printf("Unable to reallocate input buffer in %s:%d\n",__FILE__,__LINE__);
+	goto fail;
+      }
+    }
+    n=zstream_read(zs,text.data+text.len,alloc-text.len);
+    text.len+=n;
+    eof=(n==0);
+    if (binary<0) {
+      /* the first read fills the buffer unless the input is shorter */
+      binary=(fitsfile_check(text.data,text.len) || catfile_check(text.data,text.len));
+      if (!binary && needsnames(ncolumns,names)) goto fail;
+    }
+    if (binary || (text.len-parsed<MINCHUNK && !eof)) continue;
+    /* parse up to the last whole line */
+    end=text.len;
+    if (!eof) {
+      while (end>parsed && text.data[end-1]!='\n') end--;
+    }
+    if (end==parsed) continue;
+    if (nchunk==chunkalloc) {
+      chunkalloc=(chunkalloc>0 ? 2*chunkalloc : 16);
+      if ((chunk=(struct loadfile_chunk *) realloc((void *) chunk,sizeof(struct loadfile_chunk)*chunkalloc))==NULL) {
+	printf("Unable to allocate chunks in %s:%d\n",__FILE__,__LINE__);
+	goto fail;
+      }
+    }
+    c=chunk+nchunk;
+    if ((c->data=(double **) malloc(sizeof(double *)*(ncolumns>0 ? ncolumns : 1)))==NULL) {
+      printf("Unable to allocate chunks in %s:%d\n",__FILE__,__LINE__);
+      goto fail;
+    }
+    nchunk++;
+    c->base=text.data;
+    c->start=text.data+parsed;
+    c->end=text.data+end;
+    c->loadon=loadon;
+    c->wantrow=0;
+    c->ncolumns=ncolumns;
+    c->columns=columns;
+    c->nfield=nfield;
+    c->isfs=&isfs;
+    parsechunk((void *) c);
+    if (c->status) goto fail;
+    loadon=c->loadon;
+    parsed=end;
+  }
+  if (zstream_close(zs)) {
+    zs=NULL;
+    goto fail;
+  }
+  zs=NULL;
+
+  if (binary) {
+    if (fitsfile_check(text.data,text.len)) {
+      retval=fitsfile_named(text.data,text.len,ncolumns,columns,names,data);
+    } else {
+      retval=catfile_named(text.data,text.len,ncolumns,columns,names,data);
+    }
+  } else if (nchunk==0) {
+    for (j=0;j<ncolumns;j++) {
+      data[j]=(double *) malloc(sizeof(double));
+    }
+  } else {
+    retval=gatherchunks(chunk,nchunk,ncolumns,data,NULL);
+  }
+
+ fail:
+  if (zs) zstream_close(zs);
+  for (t=0;t<nchunk;t++) {
+    free((void *) chunk[t].data);
+  }
+  free((void *) chunk);
+  free((void *) text.data);
+  return retval;
 }
 
 unsigned int
-loadfile_fs(char *filename, unsigned int ncolumns, unsigned int columns[], double *data[], char *fs) {
+loadfile_named_fileptr_fs(FILE *in, unsigned int ncolumns, unsigned int columns[], char *names[], double *data[], char *fs) {
+  struct loadfile_text text;
+  struct zstream *zs;
+  unsigned int retval;
+
+  if (zstream_open(in,&zs)) {
+    return 0;
+  }
+  if (zs) {
+    return loadfile_zstream_fs(zs,ncolumns,columns,names,data,fs);
+  }
+  if (loadfile_text_fileptr(in,&text)) {
+    return 0;
+  }
+  if (fitsfile_check(text.data,text.len)) {
+    retval=fitsfile_named(text.data,text.len,ncolumns,columns,names,data);
+  } else if (catfile_check(text.data,text.len)) {
+    /* a binary catalogue: copy the columns out */
+    retval=catfile_named(text.data,text.len,ncolumns,columns,names,data);
+  } else if (needsnames(ncolumns,names)) {
+    retval=0;
+  } else {
+    retval=loadfile_buffer_fs(text.data,text.len,ncolumns,columns,data,fs);
+  }
+  loadfile_text_free(&text);
+  return retval;
+}
+
+unsigned int
+loadfile_named_fs(char *filename, unsigned int ncolumns, unsigned int columns[], char *names[], double *data[], char *fs) {
   FILE *in;
   unsigned int retval;
 
@@ -106,11 +803,21 @@ loadfile_fs(char *filename, unsigned int ncolumns, unsigned int columns[], doubl
     return 0;
   }
 
-  retval=loadfile_fileptr_fs(in, ncolumns, columns, data, fs);
+  retval=loadfile_named_fileptr_fs(in, ncolumns, columns, names, data, fs);
   fclose(in);
   return retval;
 }
 
+unsigned int
+loadfile_fileptr_fs(FILE *in, unsigned int ncolumns, unsigned int columns[], double *data[], char *fs) {
+  return loadfile_named_fileptr_fs(in,ncolumns,columns,NULL,data,fs);
+}
+
+unsigned int
+loadfile_fs(char *filename, unsigned int ncolumns, unsigned int columns[], double *data[], char *fs) {
+  return loadfile_named_fs(filename,ncolumns,columns,NULL,data,fs);
+}
+
 unsigned int
 loadfile_fileptr(FILE *in, unsigned int ncolumns, unsigned int columns[], double *data[]) {
   return loadfile_fileptr_fs(in,ncolumns,columns,data,LOADFILE_FS);
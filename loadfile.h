@@ -26,10 +26,52 @@ CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
 IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
 OF SUCH DAMAGE.
 */
+#ifndef _LOADFILE_H_
+#define _LOADFILE_H_
+
+/* the field separators: a table of them, and for a few of them each
+   one repeated in every byte of a word, so the end of a field can be
+   found eight bytes at a time */
+#define LOADFILE_NSEP 4
+struct loadfile_fs {
+  unsigned char is[256];
+  unsigned long long word[LOADFILE_NSEP];
+  int nword;			/* 0 when there are too many for that */
+};
+
+/* the catalogue text, either mapped from a file or read into memory */
+struct loadfile_text {
+  char *data;
+  size_t len;
+  void *map;
+  size_t maplen;
+};
+
 unsigned int loadfile_fileptr_fs(FILE *in, unsigned int ncolumns, unsigned int columns[], double *data[], char *fs);
 unsigned int loadfile_fs(char *filename, unsigned int ncolumns, unsigned int columns[], double *data[], char *fs);
 unsigned int loadfile_fileptr(FILE *in, unsigned int ncolumns, unsigned int columns[], double *data[]);
 unsigned int loadfile(char *filename, unsigned int ncolumns, unsigned int columns[], double *data[]);
+/* as above, but a column with a name in names[] (names may be null) is
+   looked up by name in a FITS table or binary catalogue */
+unsigned int loadfile_named_fileptr_fs(FILE *in, unsigned int ncolumns, unsigned int columns[], char *names[], double *data[], char *fs);
+unsigned int loadfile_named_fs(char *filename, unsigned int ncolumns, unsigned int columns[], char *names[], double *data[], char *fs);
+/* a column argument is either a number or a name */
+void loadfile_column(char *arg, unsigned int *column, char **name);
+/* number of threads to parse with; zero (the default) for one per processor */
+void loadfile_threads(int nthreads);
+/* parse catalogue text already in memory */
+unsigned int loadfile_buffer_fs(const char *buf, size_t len, unsigned int ncolumns, unsigned int columns[], double *data[], char *fs);
+/* as above, also returning the offset of the line of each row in *row */
+unsigned int loadfile_buffer_rows_fs(const char *buf, size_t len, unsigned int ncolumns, unsigned int columns[], double *data[], char *fs, size_t **row);
+/* atof for the number at s that cannot read past e */
+double loadfile_atof(const char *s, const char *e);
+/* set up isfs for the separators fs */
+void loadfile_separators(struct loadfile_fs *isfs, const char *fs);
+/* find the starts and ends of the fields of the line [s,e) up to field
+   nfield; returns how many were found */
+unsigned int loadfile_split(const char *s, const char *e, const struct loadfile_fs *isfs, unsigned int nfield, const char *start[], const char *end[]);
+/* map the rest of a file (or read the rest of a stream) into text */
+int loadfile_text_fileptr(FILE *in, struct loadfile_text *text);
+void loadfile_text_free(struct loadfile_text *text);
 
-
-
+#endif	/* _LOADFILE_H_ */
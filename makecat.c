@@ -0,0 +1,247 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "loadfile.h"
+#include "catfile.h"
+#include "skystore.h"
+
+#define MAXCOLUMNS 1000
+
+/* split a comma-separated list into at most max entries */
+int
+splitlist(char *list, char *entry[], int max) {
+  int n=0;
+  char *s;
+
+  while (n<max && (s=strsep(&list,","))!=NULL) {
+    if (*s) entry[n++]=s;
+  }
+  return n;
+}
+
+/* count the fields in the first row of the text */
+unsigned int
+countfields(const char *buf, size_t len, const char *fs) {
+  const char *line=buf, *eol, *bufend=buf+len;
+  unsigned int n;
+  int loadon=1, infield;
+
+  for (;line<bufend;line=eol+1) {
+    if ((eol=memchr(line,'\n',bufend-line))==NULL) eol=bufend;
+    if (line[0]=='*') loadon=1-loadon;
+    if (line[0]=='#' || line[0]=='*' || !loadon) continue;
+    n=0;
+    infield=0;
+    for (;line<eol && *line!='\r';line++) {
+      if (strchr(fs,*line)) {
+	infield=0;
+      } else if (!infield) {
+	infield=1;
+	n++;
+      }
+    }
+    if (n>0) return n;
+  }
+  return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+  char **argptr, *filename1=NULL, *filename2=NULL, *fs, *collist=NULL, *namelist=NULL;
+  char *colentry[MAXCOLUMNS], *name[MAXCOLUMNS], namebuf[MAXCOLUMNS][16];
+  unsigned int cols[MAXCOLUMNS], ncolumns=0, lon=0, lat=0, n, i, j;
+  double *data[MAXCOLUMNS];
+  const char **line=NULL;
+  size_t *linelen=NULL, *row=NULL;
+  struct loadfile_text text;
+  int keeplines=1, nnames=0, verbose=0, skyorder=-1;
+  FILE *in, *out;
+
+  fs = strdup(" \t");
+
+  if (argc<3) {
+    printf("Format:\n\n   makecat textfile catfile [options]\n\n\
+   where the options can appear anywhere in any order:\n\n\
+   -c  columns   comma-separated list of the columns to keep\n\
+                 - default all the columns of the first row\n\
+   -n  names     comma-separated names for the columns - default col1, col2 ...\n\
+   -eq lon lat   also store unit vectors for match_kd -eq from these columns\n\
+                 (RA/Dec or l/b in degrees)\n\
+   -nl           do not keep the text of each line\n\
+   -sky order    write a sky store for match_kd -eq instead, the catalogue\n\
+                 cut into HEALPix tiles of this order (up to %d; each tile\n\
+                 is about %.1f/2^order degrees across) for the positions\n\
+                 given by -eq; only the lines are kept, not the columns\n\
+   -fs FS        field separator - default space/TAB\n\
+   -v            be verbose\n\
+   -             read from standard input or write to standard output\n\n\
+   makecat converts a text catalogue into the binary columnar format that\n\
+   loadfile and match_kd read directly, so it does not need parsing again.\n\
+   The columns keep their numbers, so -x1, -y1 and so on stay the same.\n",
+	   SKYSTORE_MAXORDER,58.6);
+    return -1;
+  }
+
+  for (argptr=argv+1;argptr<argv+argc;argptr++) {
+    if (strstr(*argptr,"-sky")) {
+      if (++argptr<argv+argc) {
+	skyorder=atoi(*argptr);
+      }
+    } else if (strstr(*argptr,"-nl")) {
+      keeplines=0;
+    } else if (strstr(*argptr,"-n")) {
+      if (++argptr<argv+argc) {
+	namelist=*argptr;
+      }
+    } else if (strstr(*argptr,"-c")) {
+      if (++argptr<argv+argc) {
+	collist=*argptr;
+      }
+    } else if (strstr(*argptr,"-eq")) {
+      if (++argptr<argv+argc) {
+	lon=atoi(*argptr);
+      }
+      if (++argptr<argv+argc) {
+	lat=atoi(*argptr);
+      }
+    } else if (strstr(*argptr,"-fs")) {
+      if (++argptr<argv+argc) {
+	free ( (void *) fs);
+	fs=strdup(*argptr);
+      }
+    } else if (strstr(*argptr,"-v")) {
+      verbose++;
+    } else {
+      if (filename1==NULL) 
+	filename1=*argptr;
+      else if (filename2==NULL) 
+	filename2=*argptr;
+    }
+  }
+
+  if (filename1==NULL || filename2==NULL) {
+    printf("Both a text file and a catalogue file are needed at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  if (strcmp(filename1,"-")) {
+    if ((in=fopen(filename1,"r"))==NULL) {
+      printf("Unable to open %s  %s:%d\n",filename1,__FILE__,__LINE__);
+      return -1;
+    }
+  } else {
+    in=stdin;
+  }
+  if (loadfile_text_fileptr(in,&text)) {
+    return -1;
+  }
+
+  if (skyorder>=0) {
+    /* the tiles are written in place, so not to standard output */
+    if (strcmp(filename2,"-")==0) {
+      printf("A sky store cannot go to standard output at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+    if (skystore_write(filename2,text.data,text.len,fs,lon,lat,skyorder)) {
+      return -1;
+    }
+    if (in!=stdin) fclose(in);
+    loadfile_text_free(&text);
+    free((void *) fs);
+    return 0;
+  }
+
+  /* which columns to keep */
+  if (collist) {
+    ncolumns=splitlist(collist,colentry,MAXCOLUMNS);
+    for (j=0;j<ncolumns;j++) {
+      cols[j]=atoi(colentry[j]);
+    }
+  } else {
+    ncolumns=countfields(text.data,text.len,fs);
+    if (ncolumns>MAXCOLUMNS) ncolumns=MAXCOLUMNS;
+    for (j=0;j<ncolumns;j++) {
+      cols[j]=j+1;
+    }
+  }
+  if (namelist) {
+    nnames=splitlist(namelist,name,MAXCOLUMNS);
+  }
+  for (j=nnames;j<ncolumns;j++) {
+    snprintf(namebuf[j],sizeof(namebuf[j]),"col%u",cols[j]);
+    name[j]=namebuf[j];
+  }
+
+  n=loadfile_buffer_rows_fs(text.data,text.len,ncolumns,cols,data,fs,&row);
+  if (verbose) {
+    printf("# %s: %u rows and %u columns\n",filename1,n,ncolumns);
+  }
+
+  /* the text of each row runs up to the end of its line */
+  if (keeplines) {
+    if ((line=(const char **) malloc(sizeof(char *)*(n>0 ? n : 1)))==NULL ||
+	(linelen=(size_t *) malloc(sizeof(size_t)*(n>0 ? n : 1)))==NULL) {
+      printf("Unable to allocate lines in %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+    for (i=0;i<n;i++) {
+      const char *s=text.data+row[i], *e;
+      if ((e=memchr(s,'\n',text.len-row[i]))==NULL) e=text.data+text.len;
+      if (e>s && e[-1]=='\r') e--;
+      line[i]=s;
+      linelen[i]=e-s;
+    }
+  }
+
+  if (strcmp(filename2,"-")) {
+    if ((out=fopen(filename2,"wb"))==NULL) {
+      printf("Unable to open %s  %s:%d\n",filename2,__FILE__,__LINE__);
+      return -1;
+    }
+  } else {
+    out=stdout;
+  }
+  if (catfile_write(out,n,ncolumns,name,cols,data,line,linelen,lon,lat)) {
+    return -1;
+  }
+  if (out!=stdout) fclose(out);
+  if (in!=stdin) fclose(in);
+
+  loadfile_text_free(&text);
+  for (j=0;j<ncolumns;j++) {
+    free((void *) data[j]);
+  }
+  free((void *) row);
+  free((void *) line);
+  free((void *) linelen);
+  free((void *) fs);
+  return 0;
+}
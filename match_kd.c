@@ -28,11 +28,91 @@ OF SUCH DAMAGE.
 */
 #include <math.h>
 #include <stdio.h>
+#include <errno.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "kdtree.h"
+#include "rangejoin.h"
+#include "loadfile.h"
+#include "catfile.h"
+#include "fitsfile.h"
+#include "zstream.h"
+#include "outbuf.h"
+#include "ring.h"
+#include "skystore.h"
+#include "match_kd.h"
+#include "tiles.h"
+#include "serve.h"
+#include "incstate.h"
+
+/* how many of the lines of a block (JOINBLOCK) and their pairs within
+   -d are found at a time */
+#define JOINPART 32768
+#define MAXTHREADS 256
+/* blocks going round the reader and the matcher, and output buffers
+   waiting for the writer */
+#define NPIPEBLOCK 3
 
 int verbose=0;
+int dotransform1=0, dotransform2=0, dounique=0, donearest=1, dosphere=0, dobinary=0, ndim=2;
+/* -r1, -r2: each star of that catalogue has a radius for -d */
+int doradius1=0, doradius2=0;
+double distance=-10, transform1[6], transform2[6];
+/* -cache: megabytes of the tiles of a sky store to keep mapped */
+double cachemb=1024;
+/* ref is the one being loaded, and catalogue 2 once they all are */
+struct refcat refs[MAXCAT], *ref=refs;
+int nref=1;
+/* the numbers in catalogue 2 of the stars of ref, when it holds only some */
+unsigned long long *id2;
+/* whether -n has matched the stars of catalogue 2 (a bit each) */
+unsigned char *matched2;
+/* the output, and the number of catalogue 1 lines read */
+struct outbuf out;
+unsigned long long n1;
+/* the block being filled, unless the reader has a thread of its own */
+struct block *blk;
+double blockposd[JOINBLOCK*3], blockradius[JOINBLOCK];
+unsigned int blockline[JOINBLOCK];
+/* -u: catalogue 1 is kept whole, with the candidates for each star,
+   until the closest pairs have been taken */
+struct keptline {
+  size_t line;
+  unsigned int len, partner;
+  int kind;
+  double pos[2];
+  double dist;
+  unsigned long long id;
+};
+struct candidate {
+  unsigned int i1, i2;
+  double dist;
+};
+int doonetoone=0;
+unsigned int maxcand, nkept, keptalloc;
+struct keptline *kept;
+/* -g: catalogue 1 is kept whole with its positions and radii (nan for
+   lines without a star), and grouped with itself */
+int dogroup=0;
+double *keptpos, *keptradius;
+struct linestore keep;
+struct candidate *cand;
+size_t ncand, candalloc;
+/* -j: a part of the block for each thread, with its output */
+struct matchwork {
+  struct block *blk;
+  unsigned int a, b;
+  struct rangejoin *csr;
+  struct outbuf out;
+};
+int nthreads=1;
+struct matchwork work[MAXTHREADS];
+/* the fields of a line of text */
+unsigned int nfield;
+const char **fieldstart, **fieldend;
 
 #ifndef __AVAILABILITY__
 void
@@ -43,74 +123,1263 @@ __sincospi(double ang, double *sinval, double *cosval) {
 }
 #endif
 
+/* apply the transformation and put RA/Dec on the unit sphere */
+void
+placepos(double pos[], int dotransform, double transform[]) {
+  double dumx;
+
+  if (dotransform) {
+    dumx=pos[0]*transform[0]+pos[1]*transform[1]+transform[2];
+    pos[1]=pos[0]*transform[3]+pos[1]*transform[4]+transform[5];
+    pos[0]=dumx;
+  }
+  if (dosphere) {
+    double x,y,z,rad;
+    __sincospi(pos[0]/180.0,&y,&x);
+    __sincospi(pos[1]/180.0,&z,&rad);
+    pos[0]=x*rad;
+    pos[1]=y*rad;
+    pos[2]=z;
+  }
+}
+
+/* read the coordinates and radius from a line of text (nan where a
+   column is missing), splitting it into start and end; returns the
+   number of fields */
+unsigned int
+parsepos(const char *s, const char *e, const struct loadfile_fs *isfs, const char *start[], const char *end[],
+	 unsigned int cols[], double pos[], double *radius, int dotransform, double transform[]) {
+  unsigned int nfound, j;
+
+  nfound=loadfile_split(s,e,isfs,nfield,start,end);
+  for (j=0;j<2;j++) {
+    pos[j]=(cols[j]>0 && cols[j]<=nfound ? loadfile_atof(start[cols[j]-1],end[cols[j]-1]) : 0.0/0.0);
+  }
+  *radius=(cols[2]>0 && cols[2]<=nfound ? loadfile_atof(start[cols[2]-1],end[cols[2]-1]) : 0.0/0.0);
+  placepos(pos,dotransform,transform);
+  return nfound;
+}
+
+/* room for len more bytes at the end of the store, or null */
+char *
+reserveline(struct linestore *ls, size_t len) {
+  if (ls->len+len>ls->alloc || ls->text==NULL) {
+    ls->alloc=(ls->alloc ? 2*ls->alloc : 1<<20);
+    if (ls->alloc<ls->len+len) ls->alloc=ls->len+len;
+    if ((ls->text=(char *) realloc((void *) ls->text,ls->alloc))==NULL) {
+      printf("Unable to allocate a line at %s:%d\n",__FILE__,__LINE__);
+      return NULL;
+    }
+  }
+  return ls->text+ls->len;
+}
+
+/* add a star from catalogue 2 to the tree and keep its position, radius
+   and line by number */
 int
-main(int argc, char *argv[]) {
-  float dist;
-  FILE *in;
-  char buffer[1024];
-  struct kdtree *kd;
+addreference(double pos[], double radius, size_t line, unsigned int len) {
+  int j;
+
+  if (kd_insert(ref->kd, pos, (void *) (size_t) ref->n)) {
+    printf("Unable to insert point into the tree at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  if (ref->n==ref->nalloc) {
+    ref->nalloc=(ref->nalloc ? 2*ref->nalloc : 1024);
+    /* the positions are only wanted for the range join and -inc */
+    if (((distance>0 || incpath) && (ref->pos=(double *) realloc((void *) ref->pos,sizeof(double)*ndim*ref->nalloc))==NULL) ||
+	(ref->line=(size_t *) realloc((void *) ref->line,sizeof(size_t)*ref->nalloc))==NULL ||
+	(ref->len=(unsigned int *) realloc((void *) ref->len,sizeof(unsigned int)*ref->nalloc))==NULL ||
+	(doradius2 && (ref->radius=(double *) realloc((void *) ref->radius,sizeof(double)*ref->nalloc))==NULL) ||
+	(dotiles && (id2=(unsigned long long *) realloc((void *) id2,sizeof(unsigned long long)*ref->nalloc))==NULL)) {
+      printf("Unable to allocate catalogue 2 at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+  }
+  for (j=0;(distance>0 || incpath) && j<ndim;j++) {
+    ref->pos[ref->n*ndim+j]=pos[j];
+  }
+  if (doradius2) ref->radius[ref->n]=radius;
+  ref->line[ref->n]=line;
+  ref->len[ref->n++]=len;
+  return 0;
+}
+
+/* how far apart two stars are */
+double
+stardist(const double a[], const double b[]) {
+  if (dosphere) return hypot(hypot(a[0]-b[0],a[1]-b[1]),a[2]-b[2]);
+  return hypot(a[0]-b[0],a[1]-b[1]);
+}
+
+/* the star of rc closest to q, its position and how far away it is;
+   -1 if rc has no stars */
+long
+closest(struct refcat *rc, const double q[], double pos[], double *dist) {
   struct kdres *res;
-  float pos[3], irpos[3];
-#define MAXCOLUMNS 100
-  char *optline, *inputstring, **ap, *argv2[MAXCOLUMNS];
-  int cols1[2]={1,2}, cols2[2]={1,2}, ncolumns=2, j;
-  int dotransform1=0, dotransform2=0, dounique=0, donearest=1, dosphere=0, loadon=1;
-  char *fs1, *fs2, *filename1=NULL, *filename2=NULL;
-  double transform1[6], transform2[6], dumx, distance=-10;
+  long i=-1;
+
+  if ((res=kd_nearest(rc->kd,q)) && kd_res_size(res)>0) {
+    i=(long) (size_t) kd_res_item(res,pos);
+    *dist=stardist(pos,q);
+  }
+  if (res) kd_res_free(res);
+  return i;
+}
+
+/* the number in catalogue 2 of star i of the tree */
+unsigned long long
+number2(unsigned int i) {
+  return (dotiles || connectpath || ref->sky ? id2[i] : i);
+}
+
+/* print line i of catalogue 2 */
+void
+putline2(struct outbuf *ob, unsigned int i) {
+  outbuf_write(ob,ref->base+ref->line[i],ref->len[i]);
+  outbuf_putc(ob,'\n');
+}
+
+/* a match for -bin: the numbers of the lines in each catalogue (counting
+   from zero and not counting comments) and the distance */
+void
+putrecord(struct outbuf *ob, unsigned long long i1, unsigned long long i2, double dist) {
+  outbuf_le64(ob,i1);
+  outbuf_le64(ob,i2);
+  outbuf_ledouble(ob,dist);
+}
+
+/* is the file a binary catalogue from makecat (1), a FITS file (2) or a
+   sky store from makecat -sky (3)? (a stream or compressed file is read
+   as text) */
+int
+isbinary(FILE *in) {
+  char magic[9];
+  int retval=0;
+
+  if (in==stdin || ftello(in)<0) return 0;
+  if (fread(magic,1,9,in)==9) {
+    if (memcmp(magic,CATFILE_MAGIC,8)==0) retval=1;
+    if (memcmp(magic,"SIMPLE  =",9)==0) retval=2;
+    if (memcmp(magic,SKYSTORE_MAGIC,8)==0) retval=3;
+  }
+  rewind(in);
+  return retval;
+}
+
+/* append the text of a row of a binary catalogue to the store: its
+   original line if it was kept, otherwise its columns; returns its length */
+long
+catfile_line(struct catfile *cf, unsigned long long row, struct linestore *ls) {
+  char *line, *p;
+  const char *text;
+  size_t len;
+  unsigned int j;
+
+  if (cf->text>=0) {
+    text=catfile_textrow(cf,cf->text,row,&len);
+    if ((line=reserveline(ls,len))==NULL) return -1;
+    memcpy(line,text,len);
+  } else {
+    if ((line=reserveline(ls,25*cf->ncolumns+OUTBUF_NUMBER))==NULL) return -1;
+    p=line;
+    for (j=0;j<cf->ncolumns;j++) {
+      if (cf->column[j].type==CATFILE_TEXT) continue;
+      if (p>line) *p++=' ';
+      p+=outbuf_fmtdouble(p,catfile_value(cf,j,row));
+    }
+    len=p-line;
+  }
+  ls->len+=len;
+  return len;
+}
+
+/* a block of catalogue 1 with its output kept in memory */
+struct block *
+newblock(void) {
+  struct block *b;
+
+  if ((b=(struct block *) calloc(1,sizeof(struct block)))==NULL ||
+      outbuf_open(&b->out,-1,0)) {
+    printf("Unable to allocate a block at %s:%d\n",__FILE__,__LINE__);
+    return NULL;
+  }
+  return b;
+}
+
+void
+freeblock(struct block *b) {
+  free((void *) b->store.text);
+  outbuf_close(&b->out);
+  free((void *) b);
+}
+
+/* a star read from a binary file, whose line has just been put in the
+   store: into the tree for catalogue 2, otherwise into the block to match */
+int
+addstar(double pos[], double radius, size_t line, unsigned int len, int iscat2) {
+  struct linestore *ls=(iscat2 ? &ref->store : &blk->store);
+  int j;
+
+  if (dotiles) {
+    j=tilestar(pos,radius,1,ls->text+line,len,iscat2);
+    ls->len=line;
+    return j;
+  }
+  if (iscat2) {
+    return addreference(pos,radius,line,len);
+  }
+  for (j=0;j<ndim;j++) {
+    blk->pos[blk->n][j]=pos[j];
+  }
+  blk->radius[blk->n]=radius;
+  blk->line[blk->n]=line;
+  blk->len[blk->n]=len;
+  blk->kind[blk->n]=LINE_STAR;
+  blk->id[blk->n]=n1++;
+  if (++blk->n==JOINBLOCK) flushblock();
+  return 0;
+}
+
+/* read the stars of a binary catalogue */
+int
+readcatfile(struct loadfile_text *text, unsigned int cols[], char *names[], int iscat2) {
+  struct catfile cf;
+  unsigned long long row;
+  struct linestore *ls=(iscat2 ? &ref->store : &blk->store);
+  double pos[3], radius;
+  size_t line;
+  long len;
+  int cx, cy, cr, useuv;
+
+  if (catfile_open(text->data,text->len,&cf)) {
+    return -1;
+  }
+  cx=(names[0] ? catfile_findname(&cf,names[0]) : catfile_find(&cf,cols[0]));
+  cy=(names[1] ? catfile_findname(&cf,names[1]) : catfile_find(&cf,cols[1]));
+  cr=(names[2] ? catfile_findname(&cf,names[2]) : cols[2]>0 ? catfile_find(&cf,cols[2]) : -1);
+  /* the unit vectors are stored for the sphere if the coordinates are not transformed */
+  useuv=(dosphere && cf.unitvec && cx>=0 && cy>=0 &&
+	 cf.lon==cf.column[cx].source && cf.lat==cf.column[cy].source &&
+	 !(iscat2 ? dotransform2 : dotransform1));
+
+  for (row=0;row<cf.nrows;row++) {
+    line=ls->len;
+    if ((len=catfile_line(&cf,row,ls))<0) {
+      return -1;
+    }
+    if (useuv) {
+      pos[0]=catfile_unitvec(&cf,0,row);
+      pos[1]=catfile_unitvec(&cf,1,row);
+      pos[2]=catfile_unitvec(&cf,2,row);
+    } else {
+      pos[0]=catfile_value(&cf,cx,row);
+      pos[1]=catfile_value(&cf,cy,row);
+      placepos(pos,(iscat2 ? dotransform2 : dotransform1),(iscat2 ? transform2 : transform1));
+    }
+    radius=catfile_value(&cf,cr,row);
+    if (addstar(pos,radius,line,len,iscat2)) return -1;
+  }
+  catfile_close(&cf);
+  return 0;
+}
+
+/* read the stars of a FITS binary table; its rows are printed as text */
+int
+readfitsfile(struct loadfile_text *text, unsigned int cols[], char *names[], int iscat2) {
+  struct fitsfile ff;
+  unsigned long row;
+  struct linestore *ls=(iscat2 ? &ref->store : &blk->store);
+  double pos[3], radius;
+  char *p, number[16];
+  size_t line, len;
+  int c[3], j;
+
+  if (fitsfile_open(text->data,text->len,&ff)) {
+    return -1;
+  }
+  c[2]=-1;
+  for (j=0;j<3;j++) {
+    if (j==2 && names[j]==NULL && cols[j]==0) break;
+    if (names[j]==NULL) {
+      sprintf(number,"%u",cols[j]);
+    }
+    if ((c[j]=fitsfile_find(&ff,(names[j] ? names[j] : number)))<0) {
+      printf("There is no column %s in the FITS table at %s:%d\n",(names[j] ? names[j] : number),__FILE__,__LINE__);
+    }
+  }
+  for (row=0;row<ff.nrows;row++) {
+    if ((p=reserveline(ls,fitsfile_linelen(&ff)+1))==NULL) {
+      return -1;
+    }
+    line=ls->len;
+    len=fitsfile_format(&ff,row,p);
+    ls->len+=len;
+    pos[0]=fitsfile_value(&ff,c[0],row);
+    pos[1]=fitsfile_value(&ff,c[1],row);
+    placepos(pos,(iscat2 ? dotransform2 : dotransform1),(iscat2 ? transform2 : transform1));
+    radius=fitsfile_value(&ff,c[2],row);
+    if (addstar(pos,radius,line,len,iscat2)) return -1;
+  }
+  fitsfile_close(&ff);
+  return 0;
+}
+
+/* read a binary catalogue or FITS table */
+int
+readbinary(FILE *in, int type, unsigned int cols[], char *names[], int iscat2) {
+  struct loadfile_text text;
+  int retval;
+
+  if (type==3) {
+    printf("A sky store can only be catalogue 2, matched in memory, at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  if (loadfile_text_fileptr(in,&text)) {
+    return -1;
+  }
+  if (type==2) {
+    retval=readfitsfile(&text,cols,names,iscat2);
+  } else {
+    retval=readcatfile(&text,cols,names,iscat2);
+  }
+  loadfile_text_free(&text);
+  return retval;
+}
+
+/* match lines a to b of block bl, writing their output to ob and how
+   much there was for each line to bl->bytes */
+void
+matchlines(struct block *bl, unsigned int a, unsigned int b, struct rangejoin *csr, struct outbuf *ob) {
+  double pos[3], *irpos;
+  double dist;
+  const char *buffer;
+  unsigned int i, i2, len;
+  long k;
+  unsigned long long here;
+  int found;
+
+  for (i=a;i<b;i++) {
+    buffer=bl->store.text+bl->line[i];
+    len=bl->len[i];
+    irpos=bl->pos[i];
+    here=outbuf_tell(ob);
+    if (bl->kind[i]==LINE_COMMENT) {
+      outbuf_write(ob,buffer,len);
+      bl->bytes[i]=0;
+      continue;
+    }
+    if (incpath && bl->reuse[i]) {
+      /* as it was last time */
+      outbuf_write(ob,bl->reuse[i]->out,bl->reuse[i]->len);
+      bl->reach[i]=bl->reuse[i]->reach;
+      bl->bytes[i]=bl->reuse[i]->len;
+      continue;
+    }
+    if (incpath) bl->reach[i]=(doradius1 ? bl->radius[i] : distance);
+    if (!dounique && donearest && !dobinary) {
+      outbuf_write(ob,buffer,len);
+    }
+    if (bl->kind[i]==LINE_STAR) {
+      if (!dounique && donearest) {
+	if (connectpath || ref->sky) {
+	  i2=bl->near[i];
+	  dist=bl->neardist[i];
+	  found=(i2!=~0U);
+	} else {
+	  /* (a tile may have no stars from catalogue 2) */
+	  found=((k=closest(ref,irpos,pos,&dist))>=0);
+	  i2=(unsigned int) k;
+	  /* a tile only holds the stars within distance */
+	  if (dotiles && dist>distance) found=0;
+	}
+	if (incpath) bl->reach[i]=(!found ? 1.0/0.0 : dist>bl->reach[i] ? dist : bl->reach[i]);
+	if (found) {
+	  if (dobinary) {
+	    putrecord(ob,bl->id[i],number2(i2),dist);
+	  } else {
+	    if (dotransform1) {
+	      outbuf_putc(ob,' ');
+	      outbuf_fixed(ob,irpos[0],8,4);
+	      outbuf_putc(ob,' ');
+	      outbuf_fixed(ob,irpos[1],8,4);
+	    }
+	    if (dotransform2) {
+	      outbuf_putc(ob,' ');
+	      outbuf_fixed(ob,pos[0],8,4);
+	      outbuf_putc(ob,' ');
+	      outbuf_fixed(ob,pos[1],8,4);
+	    }
+	    outbuf_putc(ob,' ');
+	    outbuf_exp(ob,dist,12,4);
+	    outbuf_putc(ob,' ');
+	    putline2(ob,i2);
+	  }
+	} else if ((dotiles || connectpath || ref->sky) && !dobinary) {
+	  outbuf_putc(ob,'\n');
+	}
+      }
+      if (distance>0) {
+	/* the neighbours within distance, closest first */
+	for (k=csr->offset[i];k<csr->offset[i+1];k++) {
+	  i2 = csr->index[k];
+	  if (dounique) {
+	    SETMATCHED(number2(i2));
+	  } else if (dobinary) {
+	    putrecord(ob,bl->id[i],number2(i2),csr->dist[k]);
+	  } else {
+	    outbuf_write(ob,buffer,len);
+	    if (dotransform1) {
+	      outbuf_putc(ob,' ');
+	      outbuf_fixed(ob,irpos[0],8,4);
+	      outbuf_putc(ob,' ');
+	      outbuf_fixed(ob,irpos[1],8,4);
+	    }
+	    outbuf_putc(ob,' ');
+	    outbuf_fixed(ob,csr->dist[k],8,4);
+	    outbuf_putc(ob,' ');
+	    putline2(ob,i2);
+	  }
+	}
+      }
+    }
+    bl->bytes[i]=outbuf_tell(ob)-here;
+  }
+}
+
+/* the N-way mode: match lines a to b of block bl against each catalogue
+   after the first, printing a row for each star with a slot for every
+   catalogue: the distance to its closest star and that star's line, or
+   nan if there is none (within -d, if it is given) */
+void
+matchmulti(struct block *bl, unsigned int a, unsigned int b, struct outbuf *ob) {
+  struct refcat *rc;
+  double pos[3], *irpos, dist;
+  unsigned int i, i2;
+  long k;
+  int found;
+
+  for (i=a;i<b;i++) {
+    irpos=bl->pos[i];
+    if (bl->kind[i]==LINE_COMMENT) {
+      outbuf_write(ob,bl->store.text+bl->line[i],bl->len[i]);
+      continue;
+    }
+    if (bl->kind[i]!=LINE_STAR) continue;
+    if (dobinary) {
+      outbuf_le64(ob,bl->id[i]);
+    } else {
+      outbuf_write(ob,bl->store.text+bl->line[i],bl->len[i]);
+      if (dotransform1) {
+	outbuf_putc(ob,' ');
+	outbuf_fixed(ob,irpos[0],8,4);
+	outbuf_putc(ob,' ');
+	outbuf_fixed(ob,irpos[1],8,4);
+      }
+    }
+    for (rc=refs;rc<refs+nref;rc++) {
+      dist=0.0/0.0;
+      found=((k=closest(rc,irpos,pos,&dist))>=0);
+      i2=(unsigned int) k;
+      if (distance>0 && dist>distance) found=0;
+      if (dobinary) {
+	outbuf_le64(ob,(found ? i2 : ~0ULL));
+	outbuf_ledouble(ob,(found ? dist : 0.0/0.0));
+      } else if (found) {
+	if (dotransform2) {
+	  outbuf_putc(ob,' ');
+	  outbuf_fixed(ob,pos[0],8,4);
+	  outbuf_putc(ob,' ');
+	  outbuf_fixed(ob,pos[1],8,4);
+	}
+	outbuf_putc(ob,' ');
+	outbuf_exp(ob,dist,12,4);
+	outbuf_putc(ob,' ');
+	outbuf_write(ob,rc->base+rc->line[i2],rc->len[i2]);
+      } else {
+	outbuf_write(ob," nan",4);
+      }
+    }
+    if (!dobinary) outbuf_putc(ob,'\n');
+  }
+}
+
+void *
+matchworker(void *arg) {
+  struct matchwork *w=(struct matchwork *) arg;
+
+  if (nref>1) {
+    matchmulti(w->blk,w->a,w->b,&w->out);
+  } else {
+    matchlines(w->blk,w->a,w->b,w->csr,&w->out);
+  }
+  return NULL;
+}
+
+/* -u: keep lines a to b of the block and the candidates within distance
+   of each star (the closest maxcand of them, if maxcand is set); -g:
+   keep the lines and where the stars are */
+void
+keepblock(struct block *bl, unsigned int a, unsigned int b, struct rangejoin *csr) {
+  struct keptline *kl;
+  unsigned long k, last;
+  unsigned int i;
+  char *q;
+  int j;
+
+  for (i=a;i<b;i++) {
+    if (nkept==keptalloc) {
+      keptalloc=(keptalloc ? 2*keptalloc : 1024);
+      if ((kept=(struct keptline *) realloc((void *) kept,sizeof(struct keptline)*keptalloc))==NULL ||
+	  (dogroup && (keptpos=(double *) realloc((void *) keptpos,sizeof(double)*ndim*keptalloc))==NULL) ||
+	  (dogroup && (keptradius=(double *) realloc((void *) keptradius,sizeof(double)*keptalloc))==NULL)) {
+	printf("Unable to allocate catalogue 1 at %s:%d\n",__FILE__,__LINE__);
+	exit(-1);
+      }
+    }
+    if ((q=reserveline(&keep,bl->len[i]))==NULL) exit(-1);
+    memcpy(q,bl->store.text+bl->line[i],bl->len[i]);
+    kl=kept+nkept;
+    kl->line=keep.len;
+    kl->len=bl->len[i];
+    kl->kind=bl->kind[i];
+    kl->id=bl->id[i];
+    kl->pos[0]=bl->pos[i][0];
+    kl->pos[1]=bl->pos[i][1];
+    kl->partner=~0U;
+    keep.len+=bl->len[i];
+    for (j=0;dogroup && j<ndim;j++) {
+      keptpos[nkept*ndim+j]=(bl->kind[i]==LINE_STAR ? bl->pos[i][j] : 0.0/0.0);
+    }
+    if (dogroup) keptradius[nkept]=bl->radius[i];
+    if (doonetoone && bl->kind[i]==LINE_STAR) {
+      last=csr->offset[i+1];
+      if (maxcand>0 && last>csr->offset[i]+maxcand) last=csr->offset[i]+maxcand;
+      for (k=csr->offset[i];k<last;k++) {
+	if (ncand==candalloc) {
+	  candalloc=(candalloc ? 2*candalloc : 1024);
+	  if ((cand=(struct candidate *) realloc((void *) cand,sizeof(struct candidate)*candalloc))==NULL) {
+	    printf("Unable to allocate the candidates at %s:%d\n",__FILE__,__LINE__);
+	    exit(-1);
+	  }
+	}
+	cand[ncand].i1=nkept;
+	cand[ncand].i2=csr->index[k];
+	cand[ncand++].dist=csr->dist[k];
+      }
+    }
+    nkept++;
+  }
+}
+
+/* closest first, then in catalogue order */
+int
+candcomp(const void *a, const void *b) {
+  const struct candidate *ca=(const struct candidate *) a, *cb=(const struct candidate *) b;
+
+  if (ca->dist!=cb->dist) return (ca->dist<cb->dist ? -1 : 1);
+  if (ca->i1!=cb->i1) return (ca->i1<cb->i1 ? -1 : 1);
+  return (ca->i2<cb->i2 ? -1 : ca->i2>cb->i2);
+}
+
+/* -u: pair the stars greedily, closest pair first, using each star of
+   either catalogue once; then print the pairs in catalogue 1 order */
+void
+putpairs(struct outbuf *ob) {
+  struct keptline *kl;
+  unsigned char *used2;
+  size_t k;
+  unsigned int p;
+
+  if ((used2=(unsigned char *) calloc(ref->n+1,1))==NULL) {
+    printf("Unable to allocate catalogue 2 at %s:%d\n",__FILE__,__LINE__);
+    exit(-1);
+  }
+  qsort((void *) cand,ncand,sizeof(struct candidate),candcomp);
+  for (k=0;k<ncand;k++) {
+    kl=kept+cand[k].i1;
+    if (kl->partner==~0U && !used2[cand[k].i2]) {
+      kl->partner=cand[k].i2;
+      kl->dist=cand[k].dist;
+      used2[cand[k].i2]=1;
+    }
+  }
+  free((void *) used2);
+
+  for (kl=kept;kl<kept+nkept;kl++) {
+    if (kl->kind==LINE_COMMENT) {
+      outbuf_write(ob,keep.text+kl->line,kl->len);
+    } else if ((p=kl->partner)!=~0U) {
+      if (dobinary) {
+	putrecord(ob,kl->id,p,kl->dist);
+	continue;
+      }
+      outbuf_write(ob,keep.text+kl->line,kl->len);
+      if (dotransform1) {
+	outbuf_putc(ob,' ');
+	outbuf_fixed(ob,kl->pos[0],8,4);
+	outbuf_putc(ob,' ');
+	outbuf_fixed(ob,kl->pos[1],8,4);
+      }
+      if (dotransform2) {
+	outbuf_putc(ob,' ');
+	outbuf_fixed(ob,ref->pos[p*ndim],8,4);
+	outbuf_putc(ob,' ');
+	outbuf_fixed(ob,ref->pos[p*ndim+1],8,4);
+      }
+      outbuf_putc(ob,' ');
+      outbuf_exp(ob,kl->dist,12,4);
+      outbuf_putc(ob,' ');
+      putline2(ob,p);
+    }
+  }
+}
+
+/* -g: the root of star i's group, halving the path to it on the way;
+   the root of a group is its first star, since roots only ever become
+   children of earlier stars */
+unsigned int
+findroot(atomic_uint *parent, unsigned int i) {
+  unsigned int p, gp;
+
+  while ((p=atomic_load(parent+i))!=i) {
+    gp=atomic_load(parent+p);
+    atomic_compare_exchange_weak(parent+i,&p,gp);
+    i=gp;
+  }
+  return i;
+}
+
+/* put stars a and b in the same group; the later root is linked to the
+   earlier one, and only if it is still a root, so threads can link at
+   the same time */
+void
+linkstars(atomic_uint *parent, unsigned int a, unsigned int b) {
+  unsigned int t;
+
+  for (;;) {
+    a=findroot(parent,a);
+    b=findroot(parent,b);
+    if (a==b) return;
+    if (a>b) {
+      t=a;
+      a=b;
+      b=t;
+    }
+    t=b;
+    if (atomic_compare_exchange_strong(parent+b,&t,a)) return;
+  }
+}
+
+atomic_uint *groupparent;
+
+void *
+linkworker(void *arg) {
+  struct matchwork *w=(struct matchwork *) arg;
+  unsigned long k;
+  unsigned int i;
+
+  for (i=w->a;i<w->b;i++) {
+    for (k=w->csr->offset[i];k<w->csr->offset[i+1];k++) {
+      /* each pair is listed both ways */
+      if (w->csr->index[k]>i) linkstars(groupparent,i,w->csr->index[k]);
+    }
+  }
+  return NULL;
+}
+
+/* -g: link every pair of stars in catalogue 1 within the distance (or
+   their radii) of each other into groups, friends of friends, and print
+   each star's line with the number of the first star of its group and
+   the number of stars in the group */
+void
+putgroups(struct outbuf *ob) {
+  struct rangejoin csr;
+  struct rjgrid *grid;
+  struct keptline *kl;
+  pthread_t tid[MAXTHREADS];
+  unsigned int *size, i, root;
+  int t, nt;
+
+  if ((grid=(dosphere ? rangejoin_zones(nkept,keptpos,(doradius1 ? keptradius : NULL),distance) :
+	     rangejoin_grid(ndim,nkept,keptpos,(doradius1 ? keptradius : NULL),distance)))==NULL ||
+      rangejoin_query(grid,nkept,keptpos,(doradius1 ? keptradius : NULL),1,nthreads,&csr)) {
+    printf("Unable to find the neighbours in catalogue 1 at %s:%d\n",__FILE__,__LINE__);
+    exit(-1);
+  }
+  rangejoin_grid_free(grid);
+  if ((groupparent=(atomic_uint *) malloc(sizeof(atomic_uint)*(nkept+1)))==NULL ||
+      (size=(unsigned int *) calloc(nkept+1,sizeof(unsigned int)))==NULL) {
+    printf("Unable to allocate the groups at %s:%d\n",__FILE__,__LINE__);
+    exit(-1);
+  }
+  for (i=0;i<nkept;i++) {
+    atomic_init(groupparent+i,i);
+  }
+
+  nt=(nthreads<(int) (nkept/4096+1) ? nthreads : (int) (nkept/4096+1));
+  for (t=0;t<nt;t++) {
+    work[t].a=(unsigned int) ((unsigned long) nkept*t/nt);
+    work[t].b=(unsigned int) ((unsigned long) nkept*(t+1)/nt);
+    work[t].csr=&csr;
+    if (nt==1 || pthread_create(tid+t,NULL,linkworker,(void *) (work+t))) {
+      /* run it here instead */
+      tid[t]=pthread_self();
+      linkworker((void *) (work+t));
+    }
+  }
+  for (t=0;t<nt;t++) {
+    if (!pthread_equal(tid[t],pthread_self())) pthread_join(tid[t],NULL);
+  }
+  rangejoin_free(&csr);
+  for (i=0;i<nkept;i++) {
+    size[findroot(groupparent,i)]++;
+  }
+
+  for (i=0,kl=kept;i<nkept;i++,kl++) {
+    if (kl->kind==LINE_COMMENT) {
+      outbuf_write(ob,keep.text+kl->line,kl->len);
+      continue;
+    }
+    if (kl->kind!=LINE_STAR) continue;
+    root=findroot(groupparent,i);
+    if (dobinary) {
+      outbuf_le64(ob,kl->id);
+      outbuf_le64(ob,kept[root].id);
+      outbuf_le64(ob,size[root]);
+      continue;
+    }
+    outbuf_write(ob,keep.text+kl->line,kl->len);
+    outbuf_putc(ob,' ');
+    outbuf_uint(ob,kept[root].id);
+    outbuf_putc(ob,' ');
+    outbuf_uint(ob,size[root]);
+    outbuf_putc(ob,'\n');
+  }
+  free((void *) groupparent);
+  free((void *) size);
+}
+
+/* -connect and a sky store: the next slot of ref, for star number of
+   catalogue 2 with a line of len bytes, which go at the place returned */
+char *
+newslot(unsigned long long number, size_t len, unsigned int *slot) {
+  char *q;
+
+  if (ref->n==ref->nalloc) {
+    ref->nalloc=(ref->nalloc ? 2*ref->nalloc : 1024);
+    if ((ref->line=(size_t *) realloc((void *) ref->line,sizeof(size_t)*ref->nalloc))==NULL ||
+	(ref->len=(unsigned int *) realloc((void *) ref->len,sizeof(unsigned int)*ref->nalloc))==NULL ||
+	(id2=(unsigned long long *) realloc((void *) id2,sizeof(unsigned long long)*ref->nalloc))==NULL) {
+      printf("Unable to allocate catalogue 2 at %s:%d\n",__FILE__,__LINE__);
+      exit(-1);
+    }
+  }
+  if ((q=reserveline(&ref->store,len))==NULL) exit(-1);
+  id2[ref->n]=number;
+  ref->line[ref->n]=ref->store.len;
+  ref->len[ref->n]=(unsigned int) len;
+  ref->store.len+=len;
+  *slot=ref->n++;
+  return q;
+}
+
+/* add star slot of ref to the neighbours in csr, of which there are
+   total in room for alloc */
+void
+addneighbour(struct rangejoin *csr, unsigned long *total, unsigned long *alloc, unsigned int slot, double dist) {
+  if (*total==*alloc) {
+    *alloc=(*alloc ? 2**alloc : 1024);
+    if ((csr->index=(unsigned int *) realloc((void *) csr->index,sizeof(unsigned int)**alloc))==NULL ||
+	(csr->dist=(double *) realloc((void *) csr->dist,sizeof(double)**alloc))==NULL) {
+      printf("Unable to allocate the neighbours at %s:%d\n",__FILE__,__LINE__);
+      exit(-1);
+    }
+  }
+  csr->index[*total]=slot;
+  csr->dist[(*total)++]=dist;
+}
+
+/* a sky store: a star found near star i of a block */
+struct storefind {
+  struct block *bl;
+  struct rangejoin *csr;
+  unsigned long total, alloc;
+  unsigned int i;
+  int first;
+};
+
+void
+foundinstore(void *arg, const struct skystar *star, double dist, const char *line) {
+  struct storefind *sf=(struct storefind *) arg;
+  unsigned int slot;
+
+  memcpy(newslot(star->row,star->len,&slot),line,star->len);
+  if (sf->first) {
+    /* (as closest() works it out) */
+    sf->bl->near[sf->i]=slot;
+    sf->bl->neardist[sf->i]=stardist(star->pos,sf->bl->pos[sf->i]);
+    sf->first=0;
+  }
+  addneighbour(sf->csr,&sf->total,&sf->alloc,slot,dist);
+}
+
+/* a sky store: find the stars within distance of those of block bl in
+   the tiles around them, which leaves them in ref (for this block only),
+   the closest to each in bl->near and all of them in csr */
+void
+askstore(struct block *bl, struct rangejoin *csr) {
+  struct storefind sf;
+
+  ref->n=0;
+  ref->store.len=0;
+  csr->n=bl->n;
+  csr->index=NULL;
+  csr->dist=NULL;
+  if ((csr->offset=(unsigned long *) malloc(sizeof(unsigned long)*(bl->n+1)))==NULL) {
+    printf("Unable to allocate the neighbours at %s:%d\n",__FILE__,__LINE__);
+    exit(-1);
+  }
+  sf.bl=bl;
+  sf.csr=csr;
+  sf.total=sf.alloc=0;
+  for (sf.i=0;sf.i<bl->n;sf.i++) {
+    csr->offset[sf.i]=sf.total;
+    bl->near[sf.i]=~0U;
+    sf.first=1;
+    if (bl->kind[sf.i]==LINE_STAR &&
+	skystore_range(ref->sky,bl->pos[sf.i],distance,foundinstore,(void *) &sf)<0) {
+      exit(-1);
+    }
+  }
+  csr->offset[bl->n]=sf.total;
+  ref->base=ref->store.text;
+}
+
+/* match the lines of catalogue 1 collected in block bl and print them
+   to ob.  With -d the block is matched a part at a time, each part as
+   many lines as keep their lines and pairs together under JOINPART, so
+   that what a part prints is bounded however crowded the field; with -j
+   each part is split among the threads, each with an output buffer of
+   its own, and the buffers are printed in order.  -inc prints each part
+   through the block's own buffer, to keep what each line printed */
+void
+matchblock(struct block *bl, struct outbuf *ob) {
+  struct rangejoin whole, count, part, spread, *csr=NULL;
+  pthread_t tid[MAXTHREADS];
+  unsigned int i, j, k=0, a, b, ka, kb=0, nblock=bl->n;
+  struct outbuf *pb=(incpath ? &bl->out : ob);
+  int t, nt, local=0;
+
+  if (nblock==0) return;
+  memset(&part,0,sizeof(part));
+  if (connectpath) {
+    askserver(bl,&whole);
+    csr=&whole;
+  } else if (ref->sky) {
+    askstore(bl,&whole);
+    csr=&whole;
+  } else if (distance>0 && nref==1 && !dogroup) {
+    /* (-inc: only for the stars that are not copied from the last run) */
+    if (incpath) reuseblock(bl);
+    for (i=0;i<nblock;i++) {
+      if (incpath && bl->reuse[i]) continue;
+      for (j=0;j<ndim;j++) {
+	blockposd[k*ndim+j]=bl->pos[i][j];
+      }
+      blockradius[k]=bl->radius[i];
+      blockline[k++]=i;
+    }
+    if (rangejoin_count(ref->grid,k,blockposd,(doradius1 ? blockradius : NULL),0,nthreads,&count) ||
+	(incpath && (spread.offset=(unsigned long *) malloc(sizeof(unsigned long)*(nblock+1)))==NULL)) {
+      printf("Unable to find the neighbours of a block at %s:%d\n",__FILE__,__LINE__);
+      exit(-1);
+    }
+    local=1;
+  } else if (incpath) {
+    reuseblock(bl);
+  }
+
+  for (a=0, ka=0;a<nblock;a=b, ka=kb) {
+    b=nblock;
+    if (local) {
+      for (kb=ka;kb<k && (kb==ka || kb+1-ka+count.offset[kb+1]-count.offset[ka]<=JOINPART);kb++);
+      if (kb<k) b=blockline[kb];
+      if (rangejoin_rows(ref->grid,blockposd,(doradius1 ? blockradius : NULL),0,nthreads,&count,ka,kb,&part)) {
+	printf("Unable to find the neighbours of a block at %s:%d\n",__FILE__,__LINE__);
+	exit(-1);
+      }
+      if (incpath) {
+	spreadcsr(bl,&part,a,b,ka,&spread);
+	csr=&spread;
+      } else {
+	csr=&part;
+      }
+    } else if (csr && distance>0) {
+      /* neighbours found for the whole block */
+      for (b=a;b<nblock && (b==a || b+1-a+csr->offset[b+1]-csr->offset[a]<=JOINPART);b++);
+    }
+
+    /* a few thousand lines each at least; -n only marks the neighbours,
+       which the range join has already found on the threads */
+    nt=(nthreads<(int) ((b-a)/4096+1) ? nthreads : (int) ((b-a)/4096+1));
+    if (doonetoone || dogroup) {
+      keepblock(bl,a,b,csr);
+    } else if (nref>1 && nt<=1) {
+      matchmulti(bl,a,b,pb);
+    } else if (nt<=1 || dounique) {
+      matchlines(bl,a,b,csr,pb);
+    } else {
+      for (t=0;t<nt;t++) {
+	work[t].blk=bl;
+	work[t].a=a+(unsigned int) ((unsigned long) (b-a)*t/nt);
+	work[t].b=a+(unsigned int) ((unsigned long) (b-a)*(t+1)/nt);
+	work[t].csr=csr;
+	if (pthread_create(tid+t,NULL,matchworker,(void *) (work+t))) {
+	  /* run it here instead */
+	  tid[t]=pthread_self();
+	  matchworker((void *) (work+t));
+	}
+      }
+      for (t=0;t<nt;t++) {
+	if (!pthread_equal(tid[t],pthread_self())) pthread_join(tid[t],NULL);
+	outbuf_write(pb,work[t].out.buf,work[t].out.len);
+	work[t].out.len=0;
+      }
+    }
+    if (incpath) {
+      saveblock(bl,a,b,bl->out.buf);
+      outbuf_write(ob,bl->out.buf,bl->out.len);
+      bl->out.len=0;
+    }
+  }
+  if (dotiles) {
+    for (i=0;i<nblock;i++) {
+      if (bl->bytes[i]>0) putindex(2*bl->id[i]+1,bl->bytes[i]);
+    }
+  }
+  if (local) {
+    rangejoin_free(&count);
+    rangejoin_free(&part);
+    if (incpath) free((void *) spread.offset);
+  } else if (csr && distance>0) {
+    rangejoin_free(&whole);
+  }
+  bl->n=0;
+  bl->store.len=0;
+}
+
+/* match the block being filled straight to the output */
+void
+flushblock(void) {
+  matchblock(blk,&out);
+}
+
+/* open a catalogue ("-" for standard input), decoding it if it is compressed */
+FILE *
+opencatalogue(char *filename, FILE **raw) {
+  struct zstream *zs;
+  FILE *in;
+
+  if (strcmp(filename,"-")) {
+    if ((*raw=fopen(filename,"r"))==NULL) {
+      printf("Unable to open %s %s:%d\n",filename,__FILE__,__LINE__);
+      return NULL;
+    }
+  } else {
+    *raw=stdin;
+  }
+  if (zstream_open(*raw,&zs)) {
+    return NULL;
+  }
+  in=(zs ? zstream_fopen(zs) : *raw);
+  return in;
+}
+
+void
+closecatalogue(FILE *in, FILE *raw) {
+  if (in!=raw && fclose(in)) {
+    printf("Unable to decode the whole catalogue at %s:%d\n",__FILE__,__LINE__);
+    exit(-1);
+  }
+  if (raw!=stdin) fclose(raw);
+}
+
+/* load a catalogue to match against into ref: its comments are printed
+   straight away, and it is indexed for -d if it is the only one */
+int
+loadreference(char *filename, unsigned int cols[], char *names[], const char *fs) {
+  FILE *in, *raw;
+  const char *p, *eol, *next;
+  double pos[3], radius;
+  struct loadfile_fs isfs;
+  int loadon=1, type;
+
+  if ((in=opencatalogue(filename,&raw))==NULL) {
+    return -1;
+  }
+  ref->text.data=NULL;
+  if ((type=isbinary(in))==3) {
+    if (!dosphere || distance<=0 || nref>1 || dotransform2 || doradius1 || doradius2 || dounique || doonetoone || dotiles) {
+      printf("A sky store needs -eq and -d, and cannot be used with -t2, -r1, -r2, -n, -u, -mem or other catalogues at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+    closecatalogue(in,raw);
+    if ((ref->sky=skystore_open(filename,(size_t) (cachemb*1048576)))==NULL) return -1;
+    return 0;
+  }
+  ref->kd=kd_create(ndim);
+  if (type) {
+    if (readbinary(in,type,cols,names,1)) return -1;
+    ref->base=ref->store.text;
+  } else if (names[0] || names[1] || names[2]) {
+    printf("Columns must be given by number for a text catalogue at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  } else {
+    /* the lines stay where they were read; only the coordinates are parsed */
+    if (loadfile_text_fileptr(in,&ref->text)) return -1;
+    ref->base=ref->text.data;
+    loadfile_separators(&isfs,fs);
+    for (p=ref->text.data;p<ref->text.data+ref->text.len;p=next) {
+      if ((eol=memchr(p,'\n',ref->text.data+ref->text.len-p))==NULL) {
+	eol=next=ref->text.data+ref->text.len;
+      } else {
+	next=eol+1;
+      }
+      if (*p=='*') loadon=1-loadon;
+      if (*p=='#' || *p=='*' || !loadon) {
+	if (!dobinary) outbuf_write(&out,p,next-p);
+	continue;
+      }
+      parsepos(p,eol,&isfs,fieldstart,fieldend,cols,pos,&radius,dotransform2,transform2);
+      if (addreference(pos,radius,p-ref->text.data,eol-p)) return -1;
+    }
+  }
+  closecatalogue(in,raw);
+
+  if (distance>0 && nref==1) {
+    if ((ref->grid=(dosphere ? rangejoin_zones(ref->n,ref->pos,ref->radius,distance) :
+		 rangejoin_grid(ndim,ref->n,ref->pos,ref->radius,distance)))==NULL) {
+      printf("Unable to index catalogue 2 at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/* catalogue 1 as text: the reader splits it into blocks, on a thread of
+   its own when there are rings to pass them on (taking empty blocks from
+   one and putting full ones in the other), otherwise matching each block
+   as it fills */
+struct reader {
+  FILE *in;
+  struct loadfile_fs isfs;
+  unsigned int *cols;
+  const char **start, **end;
+  struct ring *empty, *full;
+};
+
+void *
+readtext1(void *arg) {
+  struct reader *rd=(struct reader *) arg;
+  struct block *b=(rd->full ? (struct block *) ring_pop(rd->empty) : blk);
+  char *buffer=NULL, *q;
+  size_t bufalloc=0;
+  ssize_t len;
+  int loadon=1, kind;
+
+  while ((len=getline(&buffer,&bufalloc,rd->in))>0) {
+    if (buffer[0]=='*') loadon=1-loadon;
+    if (buffer[0]=='#' || buffer[0]=='*' || !loadon) {
+      if (dobinary) continue;
+      kind=LINE_COMMENT;
+    } else {
+      if (buffer[len-1]=='\n') len--;
+      /* were there any tokens? */
+      kind=(parsepos(buffer,buffer+len,&rd->isfs,rd->start,rd->end,rd->cols,b->pos[b->n],b->radius+b->n,dotransform1,transform1)>0 ?
+	    LINE_STAR : LINE_EMPTY);
+      b->id[b->n]=n1++;
+    }
+    /* keep the line with the rest of the block */
+    if ((q=reserveline(&b->store,len))==NULL) exit(-1);
+    memcpy(q,buffer,len);
+    b->line[b->n]=b->store.len;
+    b->len[b->n]=len;
+    b->kind[b->n]=kind;
+    b->store.len+=len;
+    if (++b->n==JOINBLOCK) {
+      if (rd->full) {
+	ring_push(rd->full,b);
+	b=(struct block *) ring_pop(rd->empty);
+      } else {
+	flushblock();
+      }
+    }
+  }
+  if (rd->full) {
+    ring_push(rd->full,b);
+    ring_close(rd->full);
+  } else {
+    flushblock();
+  }
+  free((void *) buffer);
+  return NULL;
+}
+
+int
+main(int argc, char *argv[]) {
+  FILE *in1=NULL, *raw1;
+  char **ap;
+  unsigned int cols1[3]={1,2,0}, cols2[3]={1,2,0};
+  char *names1[3]={NULL,NULL,NULL}, *names2[3]={NULL,NULL,NULL};
+  int ncolumns=3, j, type1=0, piped=0, nfile=0, stdin2=0;
+  struct reader rd;
+  struct ring empty, full;
+  struct outbuf stdoutbuf;
+  pthread_t readtid;
+  struct block *b;
+  char *fs1, *fs2, *filename1=NULL, *reffile[MAXCAT];
 
   fs1 = strdup(" \t");
   fs2 = strdup(" \t");
 
   if (argc<3) {
-    printf("Format:\n\n   match_kd file1 file2 [options]\n\n\
+    printf("Format:\n\n   match_kd file1 file2 [file3 ...] [options]\n\
+   match_kd file1 -g -d distance [options]\n\
+   match_kd file2 -serve socket [options]\n\
+   match_kd file1 -connect socket [options]\n\n\
 Find the closest star in catalogue 2 for each star in catalogue 1.\n\
 Print the line from catalogue 1 cat2-coords distance the line in catalogue 2.\n\
+With more than two files, match catalogue 1 against each of the others in\n\
+one pass and print a row for each star of catalogue 1 with, for each of\n\
+them in turn, the distance to its closest star and that star's line (or\n\
+just nan if there is none within the distance given by -d).  The columns,\n\
+separator and transformation for file 2 are used for all of them, and\n\
+-n, -u, -mem and -s cannot be used.\n\
 The options can appear anywhere in any order:\n\n\
    -x1 column    column to read x-coordinate from file 1 - default %d\n\
    -y1 column    column to read y-coordinate from file 1 - default %d\n\
    -x2 column    column to read x-coordinate from file 2 - default %d\n\
    -y2 column    column to read y-coordinate from file 2 - default %d\n\
+   -r1 column    column to read a radius for each star in file 1 from\n\
+   -r2 column    column to read a radius for each star in file 2 from\n\
+                 (a column of a FITS table or binary catalogue may be named)\n\
    -t  params    six parameter transformation from 1 to 2 (from triangle_kd)\n\
    -t2 params    six parameter transformation from 2 to 1 (from triangle_kd)\n\
    -d  distance  find all objects in catalogue 2 within the given distance;\n\
-                 listed after the closest one (may or may not include the\n\
-                 closest object)\n\
+                 listed after the closest one in order of distance (may or\n\
+                 may not include the closest object).  With -r1 or -r2 a\n\
+                 pair is within the sum of the stars' radii (a missing one\n\
+                 counting as zero) but never more than the distance\n\
    -s            do not output the nearest object\n\
    -n            find all objects in catalogue 2 that are outside the given distance\n\
+                 (listed in the order of catalogue 2)\n\
+   -u  k         one-to-one: pair each star with at most one in the other\n\
+                 catalogue, taking the closest pairs within the distance\n\
+                 first and considering the k closest candidates for each\n\
+                 star (0 for all); only the pairs are printed, in the\n\
+                 format of the closest match, once catalogue 1 has been read;\n\
+                 it cannot be used with -n\n\
+   -g            group catalogue 1 with itself instead (it is the only file):\n\
+                 stars within the distance (or the sum of their -r1 radii)\n\
+                 of each other are linked, friends of friends, and each\n\
+                 line is printed with the number of the first star in its\n\
+                 group (from zero, not counting comments) and the number\n\
+                 of stars in the group; with -bin the header is \"KDGROUP\"\n\
+                 and each record holds the star, the first star in its\n\
+                 group and the group's size as 64-bit integers\n\
+   -serve socket keep catalogue 2 (the only file) loaded and answer clients\n\
+                 on this Unix socket until killed, with its -x2, -y2, -r2,\n\
+                 -t2, -eq and -d for all of them\n\
+   -connect socket  match catalogue 1 (the only file) against the catalogue\n\
+                 of the server on this socket instead of loading one; the\n\
+                 output is as if it had been given, but -d takes the\n\
+                 server's distance and the coordinates of -t2 are not\n\
+                 printed, and -t2, -r2, -n, -u, -g and -mem cannot be used\n\
+   -inc state    match again only what has changed: the state of the last\n\
+                 run is kept in this file (made if there is none) and a\n\
+                 star of catalogue 1 whose line is unchanged, with no star\n\
+                 of catalogue 2 changed near enough to alter its matches,\n\
+                 has its output copied from it; the output is as it would\n\
+                 be without -inc.  It cannot be used with -n, -u, -g, -mem,\n\
+                 -r2, -serve, -connect, a sky store or more than two files\n\
+   -cache MB     how much of a sky store (from makecat -sky) to keep\n\
+                 mapped - default 1024; only the tiles around the stars of\n\
+                 catalogue 1 are read, and those used longest ago dropped\n\
    -fs  FS       field separator - default space/TAB\n\
    -fs1 FS       field separator for file 1\n\
    -fs2 FS       field separator for file 2\n\
    -eq           coordinates are RA/Dec or l/b on a sphere in degrees\n\
-                 (distance here is the areal distance)\n\
+                 (distance here is the areal distance; catalogue 2 is cut\n\
+                 into declination zones sorted by RA for -d)\n\
+   -bin          write binary records instead of text: after an eight byte\n\
+                 \"KDMATCH\" header, each match is the number of the line in\n\
+                 catalogue 1 and in catalogue 2 (from zero, not counting\n\
+                 comments) as 64-bit integers and the distance as a double,\n\
+                 all little-endian (-n gives all ones for catalogue 1);\n\
+                 with more than two files, each record is the number in\n\
+                 catalogue 1 followed by a number and distance for each\n\
+                 of the others (all ones and nan where there is no match)\n\
+   -j  threads   match on this many threads (0 for one per processor); the\n\
+                 output is the same as on one\n\
+   -mem MB       for catalogues too big for memory: cut both into tiles in\n\
+                 $TMPDIR and match them a tile at a time in about this much\n\
+                 memory; needs -d, and the nearest star is only listed if\n\
+                 it is within the distance\n\
    -             read from standard input\n\n\
-   Only the first two files listed will be read.  The final listed parameter\n\
-   stands.\n\
-",cols1[0],cols1[1],cols2[0],cols2[1]);
+   Up to %d files after the first are matched against it.  The final listed\n\
+   parameter stands.  Any file may be a binary catalogue written by makecat or\n\
+   a FITS binary table (but not on standard input or compressed); the lines of\n\
+   a catalogue are printed as they were in the text and the rows of a table as\n\
+   text.  Text catalogues may be compressed with gzip (or zstd).  Catalogue 2\n\
+   may also be a sky store from makecat -sky, for -eq with -d (the nearest\n\
+   star is then only listed if it is within the distance, and -t2, -r1, -r2,\n\
+   -n, -u and -mem cannot be used).\n\
+",cols1[0],cols1[1],cols2[0],cols2[1],MAXCAT);
     return -1;
   }
 
-  printf("#");
-  for (ap=argv;ap<argv+argc;ap++) {
-    printf(" %s",*ap);
-  }
-  printf("\n");
-
   for (ap=argv+1;ap<argv+argc;ap++) {
-    if (strstr(*ap,"-x1")) {
+    /* (before -s, which is part of -serve) */
+    if (strstr(*ap,"-serve")) {
+      if (++ap<argv+argc) {
+	servepath=*ap;
+      }
+    } else if (strstr(*ap,"-connect")) {
+      if (++ap<argv+argc) {
+	connectpath=*ap;
+      }
+    } else if (strstr(*ap,"-inc")) {
+      if (++ap<argv+argc) {
+	incpath=*ap;
+      }
+    } else if (strstr(*ap,"-cache")) {
+      if (++ap<argv+argc) {
+	cachemb=atof(*ap);
+      }
+    } else if (strstr(*ap,"-x1")) {
       if (++ap<argv+argc) {
-	cols1[0]=atoi(*ap);
+	loadfile_column(*ap,cols1+0,names1+0);
       }
     } else if (strstr(*ap,"-y1")) {
       if (++ap<argv+argc) {
-	cols1[1]=atoi(*ap);
+	loadfile_column(*ap,cols1+1,names1+1);
       }
     } else if (strstr(*ap,"-x2")) {
       if (++ap<argv+argc) {
-	cols2[0]=atoi(*ap);
+	loadfile_column(*ap,cols2+0,names2+0);
       } 
     } else if (strstr(*ap,"-y2")) {
       if (++ap<argv+argc) {
-	cols2[1]=atoi(*ap);
+	loadfile_column(*ap,cols2+1,names2+1);
+      }
+    } else if (strstr(*ap,"-r1")) {
+      if (++ap<argv+argc) {
+	loadfile_column(*ap,cols1+2,names1+2);
+      }
+    } else if (strstr(*ap,"-r2")) {
+      if (++ap<argv+argc) {
+	loadfile_column(*ap,cols2+2,names2+2);
       }
     } else if (strstr(*ap,"-fs1")) {
       if (++ap<argv+argc) {
@@ -129,12 +1398,29 @@ The options can appear anywhere in any order:\n\n\
 	free ( (void *) fs2);
 	fs2=strdup(*ap);
       }
+    } else if (strstr(*ap,"-bin")) {
+      dobinary=1;
+    } else if (strstr(*ap,"-j")) {
+      if (++ap<argv+argc) {
+	nthreads=atoi(*ap);
+      }
+    } else if (strstr(*ap,"-mem")) {
+      if (++ap<argv+argc) {
+	membudget=atof(*ap)*1048576;
+      }
     } else if (strstr(*ap,"-d")) {
       distance=atof(*(++ap));
     } else if (strstr(*ap,"-s")) {
       donearest=0;
     } else if (strstr(*ap,"-n")) {
       dounique=1;
+    } else if (strstr(*ap,"-g")) {
+      dogroup=1;
+    } else if (strstr(*ap,"-u")) {
+      doonetoone=1;
+      if (++ap<argv+argc) {
+	maxcand=atoi(*ap);
+      }
     } else if (strstr(*ap,"-eq")) {
       dosphere=1;
     } else if (strstr(*ap,"-t2")) {
@@ -152,9 +1438,30 @@ The options can appear anywhere in any order:\n\n\
     } else {
       if (filename1==NULL) 
 	filename1=*ap;
-      else if (filename2==NULL) 
-	filename2=*ap;
+      else if (nfile<MAXCAT) 
+	reffile[nfile++]=*ap;
+    }
+  }
+
+  if (outbuf_open(&out,STDOUT_FILENO,0)) {
+    return -1;
+  }
+  if (nthreads<=0) nthreads=(int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads>MAXTHREADS) nthreads=MAXTHREADS;
+  if (nthreads<1) nthreads=1;
+  for (j=0;nthreads>1 && j<nthreads;j++) {
+    if (outbuf_open(&work[j].out,-1,0)) return -1;
+  }
+  if (dobinary) {
+    /* nothing but the records */
+    verbose=0;
+    outbuf_write(&out,(dogroup ? "KDGROUP" : "KDMATCH"),8);
+  } else {
+    printf("#");
+    for (ap=argv;ap<argv+argc;ap++) {
+      printf(" %s",*ap);
     }
+    printf("\n");
   }
 
   if (verbose) {
@@ -172,7 +1479,11 @@ The options can appear anywhere in any order:\n\n\
     printf("# ycol2= %d\n",cols2[1]);
     printf("# fs1= %s\n",fs1);
     printf("# fs2= %s\n",fs2);
-    printf("# %s %s\n",filename1,filename2);
+    printf("# %s",filename1);
+    for (j=0;j<nfile;j++) {
+      printf(" %s",reffile[j]);
+    }
+    printf("\n");
     if (dotransform1) {
       printf("# transform1=");
       for (j=0;j<6;j++) {
@@ -192,183 +1503,233 @@ The options can appear anywhere in any order:\n\n\
   /* Find the closest star in catalogue 2 for each star in catalogue 1 */
   /* Print the line from catalogue 2 - distance - the line in catalogue 1 */
 
+  if (servepath && connectpath) {
+    printf("-serve and -connect cannot be used together at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  if (servepath) {
+    /* the one file given is catalogue 2 */
+    reffile[0]=filename1;
+    filename1=NULL;
+    if (nfile>0 || reffile[0]==NULL || strcmp(reffile[0],"-")==0 || dounique || doonetoone || dogroup || membudget>0) {
+      printf("-serve takes one catalogue (not on standard input), and cannot be used with -n, -u, -g or -mem at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+    nfile=1;
+  }
+  if (connectpath) {
+    if (nfile>0 || dotransform2 || doradius2 || dounique || doonetoone || dogroup || membudget>0) {
+      printf("-connect takes one catalogue, and cannot be used with -t2, -r2, -n, -u, -g or -mem at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+    if (connectserver(connectpath)) return -1;
+  }
+
   /* create the kd-tree for the star positions */
   if (dosphere) {
-    kd = kd_create(3);
-  } else {
-    kd = kd_create(2);
+    ndim = 3;
+  }
+  /* room for the fields up to the last coordinate column */
+  nfield=1;
+  for (j=0;j<ncolumns;j++) {
+    if (cols1[j]>nfield) nfield=cols1[j];
+    if (cols2[j]>nfield) nfield=cols2[j];
+  }
+  if ((fieldstart=(const char **) malloc(sizeof(char *)*nfield))==NULL ||
+      (fieldend=(const char **) malloc(sizeof(char *)*nfield))==NULL) {
+    printf("Unable to allocate fields at %s:%d\n",__FILE__,__LINE__);
+    return -1;
   }
-  /* designate a function to deallocate the data */
-  kd_data_destructor(kd,free);
 
-  /* actually read in catalogue 2 first */
-  if (strcmp(filename2,"-")) {
-    if ((in=fopen(filename2,"r"))==NULL) {
-      printf("Unable to open %s %s:%d\n",filename2, __FILE__,__LINE__);
-      return 0;
+  if ((blk=newblock())==NULL) {
+    return -1;
+  }
+  doradius1=(cols1[2]>0 || names1[2]);
+  doradius2=(cols2[2]>0 || names2[2]);
+  if ((doradius1 || doradius2) && distance<=0) {
+    printf("-r1 and -r2 need a distance (-d) at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  if (dogroup && (nfile>0 || distance<=0 || dounique || doonetoone || membudget>0)) {
+    printf("-g takes one catalogue and a distance (-d), and cannot be used with -n, -u or -mem at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  if (nfile<1 && !dogroup && !connectpath) {
+    printf("There is no second catalogue at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  /* (the client keeps the stars the server finds in ref) */
+  nref=(connectpath ? 1 : nfile);
+  if (incpath) {
+    if (nfile!=1 || dounique || doonetoone || dogroup || membudget>0 || connectpath || servepath || doradius2) {
+      printf("-inc takes two catalogues and cannot be used with -n, -u, -g, -mem, -connect, -serve or -r2 at %s:%d\n",__FILE__,__LINE__);
+      return -1;
     }
-  } else {
-    in=stdin;
+    incoptions(cols1,cols2,names1,names2,fs1,fs2);
   }
-  loadon=1;
-  while (fgets(buffer,1023,in)) {
-    if (buffer[0]=='*') loadon=1-loadon;
-    if (buffer[0]=='#' || buffer[0]=='*' || !loadon) {
-      fputs(buffer,stdout);
-    } else {
-      optline=strdup(buffer);
-      inputstring=buffer;
-      /* break line into up to MAXCOLUMNS columns */
-      for (ap = argv2; (*ap = strsep(&inputstring, fs2)) != NULL;)
-	if (**ap != '\0')
-	  if (++ap >= &argv2[MAXCOLUMNS])
-	    break;
-      /* were there any tokens? */
-      if (ap>argv2) {
-	/* assign columns to the data arrays; missing values given nan */
-	for (j=0;j<ncolumns;j++) {
-	  pos[j]=(argv2+cols2[j]<=ap ? atof(argv2[cols2[j]-1]) : 0.0/0.0);
-	}
-      }
-      if (dotransform2) {
-	  /* printf("\n%g %g ",irpos[0],irpos[1]);*/
-	  dumx=pos[0]*transform2[0]+pos[1]*transform2[1]+transform2[2];
-	  pos[1]=pos[0]*transform2[3]+pos[1]*transform2[4]+transform2[5];
-	  pos[0]=dumx;
-	  /* printf("%g %g\n",irpos[0],irpos[1]);*/
-      }
-      if (dosphere) {
-	double x,y,z,rad;
-	__sincospi(pos[0]/180.0,&y,&x);
-	__sincospi(pos[1]/180.0,&z,&rad);
-	pos[0]=x*rad;
-	pos[1]=y*rad;
-	pos[2]=z;
-      }
-      if (kd_insertf(kd, pos, (void *) optline)) {
-	printf("Unable to insert point into the tree at %s:%d\n",__FILE__,__LINE__);
-	return -1;
-      }
+  if (nref>1 && (dounique || doonetoone || membudget>0 || !donearest)) {
+    printf("-n, -u, -mem and -s take only two catalogues at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  if (doonetoone && (distance<=0 || dounique || membudget>0)) {
+    printf("-u needs a distance (-d) and cannot be used with -n or -mem at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  if (membudget>0) {
+    if (distance<=0) {
+      printf("-mem needs a distance (-d) at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+    j=matchtiles(filename1,cols1,names1,fs1,reffile[0],cols2,names2,fs2);
+    if (outbuf_close(&out)) {
+      fprintf(stderr,"Unable to write the output at %s:%d\n",__FILE__,__LINE__);
+      return -1;
     }
-    /*    printf("%ld %g %g\n",xptr-xopt,*(xptr-1),*(yptr-1));  */
+    return j;
   }
-  if (in!=stdin) fclose(in);
 
-  /* now read in catalogue 1 */
-  if (strcmp(filename1,"-")) {
-    if ((in=fopen(filename1,"r"))==NULL) {
-      printf("Unable to open %s  %s:%d\n",filename1,__FILE__,__LINE__);
+  if (servepath) {
+    /* the comments of catalogue 2 are kept to send to each client */
+    stdoutbuf=out;
+    if (outbuf_open(&out,-1,0) || loadreference(reffile[0],cols2,names2,fs2)) return -1;
+    comments2=out;
+    out=stdoutbuf;
+    outbuf_flush(&out);
+    return serve(servepath);
+  }
+
+  /* catalogue 1 as text is read and parsed on a thread of its own while
+     catalogue 2 is loaded (unless both are on standard input); its
+     blocks go round from the reader to the matcher and back through
+     rings */
+  for (j=0;j<nfile;j++) {
+    if (strcmp(reffile[j],"-")==0) stdin2=1;
+  }
+  if (strcmp(filename1,"-") || !stdin2) {
+    if ((in1=opencatalogue(filename1,&raw1))==NULL) {
       return 0;
     }
-  } else {
-    in=stdin;
+    type1=isbinary(in1);
   }
-  loadon=1;
-  while (fgets(buffer,1023,in)) {
-    if (buffer[0]=='*') loadon=1-loadon;
-    if (buffer[0]=='#' || buffer[0]=='*' || !loadon) {
-      fputs(buffer,stdout);
-    } else {
-      buffer[strlen(buffer)-1]=0;
-      if (!dounique && donearest) {
-	printf("%s",buffer);
-      }
-      inputstring=strdup(buffer);
-      /* break line into up to MAXCOLUMNS columns */
-      for (ap = argv2; (*ap = strsep(&inputstring, fs1)) != NULL;)
-	if (**ap != '\0')
-	  if (++ap >= &argv2[MAXCOLUMNS])
-	    break;
-      /* were there any tokens? */
-      if (ap>argv2) {
-	/* assign columns to the data arrays; missing values given nan */
-	for (j=0;j<ncolumns;j++) {
-	  irpos[j]=(argv2+cols1[j]<=ap ? atof(argv2[cols1[j]-1]) : 0.0/0.0);
-	}
-	if (dotransform1) {
-	  /* printf("\n%g %g ",irpos[0],irpos[1]);*/
-	  dumx=irpos[0]*transform1[0]+irpos[1]*transform1[1]+transform1[2];
-	  irpos[1]=irpos[0]*transform1[3]+irpos[1]*transform1[4]+transform1[5];
-	  irpos[0]=dumx;
-	  /* printf("%g %g\n",irpos[0],irpos[1]);*/
-	}
-	if (dosphere) {
-	  double x,y,z,rad;
-	  __sincospi(irpos[0]/180.0,&y,&x);
-	  __sincospi(irpos[1]/180.0,&z,&rad);
-	  irpos[0]=x*rad;
-	  irpos[1]=y*rad;
-	  irpos[2]=z;
-	}
-	if (!dounique && donearest) {
-	  res=kd_nearestf(kd,irpos);
-	  if (kd_res_size(res)>0) {
-	    optline = (char *) kd_res_itemf( res, pos );
-	    if (dosphere) {
-	      dist = hypotf(hypotf(pos[0]-irpos[0],pos[1]-irpos[1]),pos[2]-irpos[2]);
-	    } else {
-	      dist = hypotf(pos[0]-irpos[0],pos[1]-irpos[1]);
-	    }
-	    if (dotransform1) {
-	      printf(" %8.4f %8.4f",irpos[0],irpos[1]);
-	    }
-	    if (dotransform2) {
-	      printf(" %8.4f %8.4f",pos[0],pos[1]);
-	    }
-	    printf(" %12.4e %s",dist,optline);
-	  }
-	  kd_res_free(res);
-	}
-	if (distance>0) {
-	  res=kd_nearest_rangef(kd,irpos,distance);
-	  if (kd_res_size(res)>0) {
-	    while( !kd_res_end( res ) ) {
-	      optline = (char *) kd_res_itemf( res, pos );
-	      if (dounique) {
-		optline[0]=0;
-	      } else {
-		if (dosphere) {
-		  dist = hypot(hypot(pos[0]-irpos[0],pos[1]-irpos[1]),pos[2]-irpos[2]);
-		} else {
-		  dist = hypot(pos[0]-irpos[0],pos[1]-irpos[1]);
-		}
-		if (dotransform1) {
-		  printf("%s %8.4f %8.4f %8.4f %s",buffer,irpos[0],irpos[1],dist,optline);
-		} else {
-		  printf("%s %8.4f %s",buffer,dist,optline);
-		}
-	      }
-	      /* go to the next entry */
-	      kd_res_next( res );
-	    }
-	  }
-	  kd_res_free(res);
-	}
-      }
+  rd.in=in1;
+  rd.cols=cols1;
+  rd.empty=rd.full=NULL;
+  loadfile_separators(&rd.isfs,fs1);
+  if ((rd.start=(const char **) malloc(sizeof(char *)*nfield))==NULL ||
+      (rd.end=(const char **) malloc(sizeof(char *)*nfield))==NULL) {
+    printf("Unable to allocate fields at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  if (in1 && !type1 && !names1[0] && !names1[1] && !names1[2]) {
+    if (ring_init(&empty,NPIPEBLOCK) || ring_init(&full,NPIPEBLOCK)) {
+      return -1;
     }
-    free((void *) inputstring);
+    for (j=0;j<NPIPEBLOCK;j++) {
+      if ((b=newblock())==NULL) return -1;
+      ring_push(&empty,b);
+    }
+    rd.empty=&empty;
+    rd.full=&full;
+    piped=(pthread_create(&readtid,NULL,readtext1,(void *) &rd)==0);
   }
-  if (in!=stdin) fclose(in);
 
-  if (dounique) {
+  /* actually read in catalogue 2 (and any after it) first */
+  for (j=0;j<nfile;j++) {
+    ref=refs+j;
+    if (loadreference(reffile[j],cols2,names2,fs2)) return -1;
+  }
+  ref=refs;
+  if (incpath && (ref->sky || loadstate() || startstate())) {
+    if (ref->sky) printf("-inc cannot be used with a sky store at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  if (dounique && (matched2=(unsigned char *) calloc(ref->n/8+1,1))==NULL) {
+    printf("Unable to allocate catalogue 2 at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+
+  /* now match catalogue 1 */
+  if (in1==NULL && (in1=opencatalogue(filename1,&raw1))==NULL) {
+    return 0;
+  }
+  if (piped) {
+    /* the output is written a buffer at a time while the next is filled */
+    if (outbuf_async(&out,NPIPEBLOCK)) return -1;
+    while ((b=(struct block *) ring_pop(&full))) {
+      matchblock(b,&out);
+      ring_push(&empty,b);
+    }
+    pthread_join(readtid,NULL);
+    if (outbuf_sync(&out)) {
+      printf("Unable to write the output at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+    for (j=0;j<NPIPEBLOCK;j++) {
+      freeblock((struct block *) ring_pop(&empty));
+    }
+    ring_free(&empty);
+    ring_free(&full);
+  } else if ((type1=isbinary(in1))) {
+    if (readbinary(in1,type1,cols1,names1,0)) return -1;
+    flushblock();
+  } else if (names1[0] || names1[1] || names1[2]) {
+    printf("Columns must be given by number for a text catalogue at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  } else {
+    rd.in=in1;
+    rd.full=NULL;
+    readtext1((void *) &rd);
+  }
+  closecatalogue(in1,raw1);
+
+  if (doonetoone) {
+    putpairs(&out);
+  } else if (dogroup) {
+    putgroups(&out);
+  } else if (dounique) {
     /* print out all of the stars in catalogue 2 */
-    /* that were outside the search radius */ 
-    irpos[0]=0; irpos[1]=0;
-    res=kd_nearest_rangef(kd,irpos,1e100);
-    if (kd_res_size(res)>0) {
-      while( !kd_res_end( res ) ) {
-	optline = (char *) kd_res_itemf( res, pos );
-	if (optline[0]) {
-	  printf("%s",optline);
+    /* that were outside the search radius, in order */
+    unsigned int i2;
+    for (i2=0;i2<ref->n;i2++) {
+      if (!ISMATCHED(i2)) {
+	if (dobinary) {
+	  putrecord(&out,~0ULL,i2,0.0/0.0);
+	} else {
+	  putline2(&out,i2);
 	}
-	/* go to the next entry */
-	kd_res_next( res );
       }
     }
-    kd_res_free(res);
   }
 
-  kd_free(kd);
+  if (incpath && endstate()) return -1;
+  if (connectpath) closeserver();
+  for (ref=refs;ref<refs+nref;ref++) {
+    rangejoin_grid_free(ref->grid);
+    skystore_close(ref->sky);
+    free((void *) ref->pos);
+    free((void *) ref->line);
+    free((void *) ref->len);
+    free((void *) ref->radius);
+    if (ref->text.data) loadfile_text_free(&ref->text);
+    free((void *) ref->store.text);
+    kd_free(ref->kd);
+  }
+  free((void *) matched2);
+  free((void *) id2);
+  freeblock(blk);
+  free((void *) rd.start);
+  free((void *) rd.end);
+  free((void *) kept);
+  free((void *) keptpos);
+  free((void *) keptradius);
+  free((void *) keep.text);
+  free((void *) cand);
+  free((void *) fieldstart);
+  free((void *) fieldend);
+  if (outbuf_close(&out)) {
+    fprintf(stderr,"Unable to write the output at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
   free ( (void *) fs1);
   free ( (void *) fs2);
 
@@ -0,0 +1,135 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#ifndef _MATCH_KD_H_
+#define _MATCH_KD_H_
+
+#include <stdio.h>
+#include "loadfile.h"
+#include "outbuf.h"
+#include "rangejoin.h"
+
+/* What match_kd.c shares with the modes kept in files of their own
+   (tiles.c for -mem, serve.c for -serve and -connect, incstate.c for
+   -inc): the options, the catalogues and the blocks of catalogue 1. */
+
+extern int verbose;
+extern int dotransform1, dotransform2, dounique, donearest, dosphere, dobinary, ndim;
+/* -r1: each star of catalogue 1 has a radius for -d */
+extern int doradius1;
+extern double distance, transform1[6], transform2[6];
+/* lines of text kept end to end */
+struct linestore {
+  char *text;
+  size_t len, alloc;
+};
+
+/* a catalogue matched against catalogue 1 (catalogue 2, and in the
+   N-way mode those after it), its stars by number: their lines (at
+   offsets into base) and their positions; the tree holds the numbers.
+   A sky store is left on disk and its tiles mapped as they are needed,
+   and then (as for -connect) only the stars found for a block are kept,
+   numbered in id2, as are those of a tile for -mem */
+#define MAXCAT 32
+struct refcat {
+  struct kdtree *kd;
+  struct rjgrid *grid;
+  struct skystore *sky;
+  struct loadfile_text text;
+  struct linestore store;
+  const char *base;
+  size_t *line;
+  unsigned int *len;
+  double *pos, *radius;
+  unsigned int n, nalloc;
+};
+/* ref is the one being loaded, and catalogue 2 once they all are */
+extern struct refcat *ref;
+extern unsigned long long *id2;
+/* whether -n has matched the stars of catalogue 2 (a bit each) */
+extern unsigned char *matched2;
+#define SETMATCHED(i) (matched2[(i)>>3]|=(unsigned char) (1<<((i)&7)))
+#define ISMATCHED(i) ((matched2[(i)>>3]>>((i)&7))&1)
+/* the output, and the number of catalogue 1 lines read */
+extern struct outbuf out;
+extern unsigned long long n1;
+/* a block of catalogue 1 lines to match: their text (kept in store),
+   positions, kinds, numbers within catalogue 1 (not counting comments)
+   and how much output each had; and, for -inc, the output of the part
+   of it being matched */
+#define JOINBLOCK 65536
+#define LINE_EMPTY 0		/* no fields */
+#define LINE_STAR 1
+#define LINE_COMMENT 2		/* printed as it is */
+struct block {
+  struct linestore store;
+  size_t line[JOINBLOCK];
+  unsigned int len[JOINBLOCK], n;
+  int kind[JOINBLOCK];
+  double pos[JOINBLOCK][3], radius[JOINBLOCK];
+  unsigned long long id[JOINBLOCK], bytes[JOINBLOCK];
+  struct outbuf out;
+  /* -connect and a sky store: the closest star found (~0U for none) */
+  unsigned int near[JOINBLOCK];
+  double neardist[JOINBLOCK];
+  /* -inc: the hash of each line, how far from it its output depends on
+     catalogue 2, and its output from the last run if that still holds */
+  unsigned long long key[JOINBLOCK];
+  double reach[JOINBLOCK];
+  const struct incrow *reuse[JOINBLOCK];
+};
+/* the block being filled, unless the reader has a thread of its own */
+extern struct block *blk;
+/* -j */
+extern int nthreads;
+/* the fields of a line of text */
+extern const char **fieldstart, **fieldend;
+
+/* read the coordinates and radius from a line of text */
+unsigned int parsepos(const char *s, const char *e, const struct loadfile_fs *isfs, const char *start[], const char *end[],
+		      unsigned int cols[], double pos[], double *radius, int dotransform, double transform[]);
+/* room for len more bytes at the end of the store, or null */
+char *reserveline(struct linestore *ls, size_t len);
+/* add a star of catalogue 2 to the tree and keep its position, radius
+   and line (at offset line of ref's text) by number */
+int addreference(double pos[], double radius, size_t line, unsigned int len);
+double stardist(const double a[], const double b[]);
+long closest(struct refcat *rc, const double q[], double pos[], double *dist);
+void putrecord(struct outbuf *ob, unsigned long long i1, unsigned long long i2, double dist);
+/* the kind of a catalogue and reading a binary one */
+int isbinary(FILE *in);
+int readbinary(FILE *in, int type, unsigned int cols[], char *names[], int iscat2);
+FILE *opencatalogue(char *filename, FILE **raw);
+void closecatalogue(FILE *in, FILE *raw);
+/* -connect and a sky store: the stars found for a block */
+char *newslot(unsigned long long number, size_t len, unsigned int *slot);
+void addneighbour(struct rangejoin *csr, unsigned long *total, unsigned long *alloc, unsigned int slot, double dist);
+/* match the block being filled straight to the output */
+void flushblock(void);
+
+#endif	/* _MATCH_KD_H_ */
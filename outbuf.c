@@ -0,0 +1,443 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "outbuf.h"
+#include "ring.h"
+
+/* outbuf_async: the buffers go round between the filler and the writer */
+struct outbuf_chunk {
+  char *buf;
+  size_t len;
+};
+
+struct outbuf_writer {
+  int fd;
+  struct ring full, spare;
+  struct outbuf_chunk *chunk, *cur;
+  int nchunk, error;
+  pthread_t tid;
+};
+
+/* powers of ten that are exact in a double */
+static const double pow10tab[]={
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+int
+outbuf_open(struct outbuf *ob, int fd, size_t size) {
+  ob->writer=NULL;
+  ob->fd=fd;
+  ob->len=0;
+  ob->offset=0;
+  ob->size=(size>OUTBUF_NUMBER ? size : OUTBUF_SIZE);
+  ob->error=0;
+  if ((ob->buf=(char *) malloc(ob->size))==NULL) {
+    printf("Unable to allocate output buffer in %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  return 0;
+}
+
+/* write n bytes to fd, going round again after short writes */
+static int
+writeall(int fd, const char *p, size_t n) {
+  ssize_t w;
+
+  while (n>0) {
+    if ((w=write(fd,p,n))<0) {
+      if (errno==EINTR) continue;
+      return -1;
+    }
+    p+=w;
+    n-=w;
+  }
+  return 0;
+}
+
+static void *
+writechunks(void *arg) {
+  struct outbuf_writer *wr=(struct outbuf_writer *) arg;
+  struct outbuf_chunk *c;
+
+  while ((c=(struct outbuf_chunk *) ring_pop(&wr->full))) {
+    if (writeall(wr->fd,c->buf,c->len)) wr->error=1;
+    ring_push(&wr->spare,c);
+  }
+  return NULL;
+}
+
+int
+outbuf_async(struct outbuf *ob, int nbuf) {
+  struct outbuf_writer *wr;
+  int i;
+
+  if (ob->fd<0 || ob->writer) return 0;
+  if ((wr=(struct outbuf_writer *) calloc(1,sizeof(struct outbuf_writer)))==NULL ||
+      (wr->chunk=(struct outbuf_chunk *) calloc(nbuf+1,sizeof(struct outbuf_chunk)))==NULL ||
+      ring_init(&wr->full,nbuf+1) || ring_init(&wr->spare,nbuf+1)) {
+    printf("Unable to allocate output buffers in %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  fflush(stdout);
+  wr->fd=ob->fd;
+  wr->nchunk=nbuf+1;
+  /* the buffer being filled is the first */
+  wr->cur=wr->chunk;
+  wr->cur->buf=ob->buf;
+  for (i=1;i<wr->nchunk;i++) {
+    if ((wr->chunk[i].buf=(char *) malloc(ob->size))==NULL) {
+      printf("Unable to allocate output buffers in %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+    ring_push(&wr->spare,wr->chunk+i);
+  }
+  if (pthread_create(&wr->tid,NULL,writechunks,(void *) wr)) {
+    /* write them here instead */
+    for (i=1;i<wr->nchunk;i++) free((void *) wr->chunk[i].buf);
+    ring_free(&wr->full);
+    ring_free(&wr->spare);
+    free((void *) wr->chunk);
+    free((void *) wr);
+    return 0;
+  }
+  ob->writer=wr;
+  return 0;
+}
+
+int
+outbuf_sync(struct outbuf *ob) {
+  struct outbuf_writer *wr=ob->writer;
+  int i;
+
+  if (wr==NULL) return outbuf_flush(ob);
+  outbuf_flush(ob);
+  ring_close(&wr->full);
+  pthread_join(wr->tid,NULL);
+  if (wr->error) ob->error=1;
+  /* keep the one being filled */
+  for (i=0;i<wr->nchunk;i++) {
+    if (wr->chunk[i].buf!=ob->buf) free((void *) wr->chunk[i].buf);
+  }
+  ring_free(&wr->full);
+  ring_free(&wr->spare);
+  free((void *) wr->chunk);
+  free((void *) wr);
+  ob->writer=NULL;
+  return (ob->error ? -1 : 0);
+}
+
+int
+outbuf_flush(struct outbuf *ob) {
+  struct outbuf_writer *wr=ob->writer;
+
+  /* kept in memory */
+  if (ob->fd<0) return (ob->error ? -1 : 0);
+  if (wr) {
+    /* hand it to the writer and go on with a spare */
+    if (ob->len==0) return 0;
+    wr->cur->len=ob->len;
+    ring_push(&wr->full,wr->cur);
+    wr->cur=(struct outbuf_chunk *) ring_pop(&wr->spare);
+    ob->buf=wr->cur->buf;
+    ob->offset+=ob->len;
+    ob->len=0;
+    return (ob->error ? -1 : 0);
+  }
+  /* keep the order of anything printed with stdio */
+  fflush(stdout);
+  if (writeall(ob->fd,ob->buf,ob->len)) ob->error=1;
+  ob->offset+=ob->len;
+  ob->len=0;
+  return (ob->error ? -1 : 0);
+}
+
+/* room for n more bytes: write out what is buffered, or for a buffer in
+   memory make it bigger */
+static void
+makeroom(struct outbuf *ob, size_t n) {
+  if (ob->fd>=0) {
+    outbuf_flush(ob);
+    return;
+  }
+  while (ob->len+n>ob->size) ob->size*=2;
+  if ((ob->buf=(char *) realloc((void *) ob->buf,ob->size))==NULL) {
+    printf("Unable to allocate output buffer in %s:%d\n",__FILE__,__LINE__);
+    exit(-1);
+  }
+}
+
+int
+outbuf_close(struct outbuf *ob) {
+  outbuf_sync(ob);
+  free((void *) ob->buf);
+  ob->buf=NULL;
+  return (ob->error ? -1 : 0);
+}
+
+void
+outbuf_write(struct outbuf *ob, const void *p, size_t n) {
+  if (ob->len+n>ob->size) {
+    makeroom(ob,n);
+    if (n>ob->size-ob->len && ob->writer) {
+      /* a buffer at a time, to keep it in order */
+      while (n>0) {
+	size_t m=(n<ob->size-ob->len ? n : ob->size-ob->len);
+	memcpy(ob->buf+ob->len,p,m);
+	ob->len+=m;
+	p=(const char *) p+m;
+	n-=m;
+	if (ob->len==ob->size) outbuf_flush(ob);
+      }
+      return;
+    }
+    if (n>ob->size-ob->len) {
+      /* too big to buffer: write it as it is */
+      if (writeall(ob->fd,(const char *) p,n)) ob->error=1;
+      ob->offset+=n;
+      return;
+    }
+  }
+  memcpy(ob->buf+ob->len,p,n);
+  ob->len+=n;
+}
+
+void
+outbuf_putc(struct outbuf *ob, int c) {
+  if (ob->len==ob->size) makeroom(ob,1);
+  ob->buf[ob->len++]=c;
+}
+
+void
+outbuf_puts(struct outbuf *ob, const char *s) {
+  outbuf_write(ob,s,strlen(s));
+}
+
+void
+outbuf_printf(struct outbuf *ob, const char *format, ...) {
+  va_list ap;
+  char sbuf[256], *lbuf;
+  int n;
+
+  va_start(ap,format);
+  n=vsnprintf(sbuf,sizeof(sbuf),format,ap);
+  va_end(ap);
+  if (n<0) return;
+  if (n<(int) sizeof(sbuf)) {
+    outbuf_write(ob,sbuf,n);
+    return;
+  }
+  if ((lbuf=(char *) malloc(n+1))==NULL) {
+    ob->error=1;
+    return;
+  }
+  va_start(ap,format);
+  vsnprintf(lbuf,n+1,format,ap);
+  va_end(ap);
+  outbuf_write(ob,lbuf,n);
+  free((void *) lbuf);
+}
+
+/* the integer m shown with prec digits after the point, after a sign and
+   the spaces to fill width */
+static size_t
+putdigits(char *s, int negative, unsigned long long m, int prec, int width) {
+  char tmp[32], *e=tmp+sizeof(tmp), *p=e;
+  size_t n;
+  int i;
+
+  for (i=0;i<prec;i++) {
+    *--p='0'+(int) (m%10);
+    m/=10;
+  }
+  if (prec>0) *--p='.';
+  do {
+    *--p='0'+(int) (m%10);
+    m/=10;
+  } while (m>0);
+  if (negative) *--p='-';
+  n=e-p;
+  for (i=(int) n;i<width;i++) {
+    *s++=' ';
+  }
+  memcpy(s,p,n);
+  s[n]=0;
+  return ((int) n<width ? (size_t) width : n);
+}
+
+/* Multiplying or dividing by an exact power of ten rounds correctly, so
+   the scaled value is within an ulp of the exact one.  Values that land
+   too near halfway between two integers to be sure which way printf
+   would round are left to printf, as is anything out of range. */
+
+size_t
+outbuf_fmtfixed(char *s, double v, int width, int prec) {
+  double a=fabs(v), scaled, r, frac;
+
+  if (prec>=0 && prec<=9 && a<1e12/pow10tab[prec]) {
+    scaled=a*pow10tab[prec];
+    r=floor(scaled);
+    frac=scaled-r;
+    if (fabs(frac-0.5)>1e-3) {
+      return putdigits(s,signbit(v)!=0,(unsigned long long) r+(frac>0.5),prec,width);
+    }
+  }
+  return snprintf(s,OUTBUF_NUMBER,"%*.*f",width,prec,v);
+}
+
+size_t
+outbuf_fmtexp(char *s, double v, int width, int prec) {
+  double a=fabs(v), scaled=0, r, frac;
+  unsigned long long m;
+  char tmp[40], *p;
+  int e, k, pass, n, i;
+
+  if (prec<0 || prec>9 || !isfinite(v) || a==0) {
+    return snprintf(s,OUTBUF_NUMBER,"%*.*e",width,prec,v);
+  }
+  /* the exponent from log10 may be one out either way */
+  e=(int) floor(log10(a));
+  for (pass=0;pass<3;pass++) {
+    k=prec-e;
+    if (k>22 || k<-22) {
+      return snprintf(s,OUTBUF_NUMBER,"%*.*e",width,prec,v);
+    }
+    scaled=(k>=0 ? a*pow10tab[k] : a/pow10tab[-k]);
+    if (scaled<pow10tab[prec]) {
+      e--;
+    } else if (scaled>=pow10tab[prec+1]) {
+      e++;
+    } else {
+      break;
+    }
+  }
+  r=floor(scaled);
+  frac=scaled-r;
+  if (pass==3 || fabs(frac-0.5)<1e-3) {
+    return snprintf(s,OUTBUF_NUMBER,"%*.*e",width,prec,v);
+  }
+  m=(unsigned long long) r+(frac>0.5);
+  if (m==(unsigned long long) pow10tab[prec+1]) {
+    m/=10;
+    e++;
+  }
+  /* m has prec+1 digits, so showing it with prec decimals gives d.ddd */
+  p=tmp+putdigits(tmp,signbit(v)!=0,m,prec,0);
+  *p++='e';
+  *p++=(e<0 ? '-' : '+');
+  if (e<0) e=-e;
+  if (e>=100) *p++='0'+e/100;
+  *p++='0'+(e/10)%10;
+  *p++='0'+e%10;
+  n=p-tmp;
+  for (i=n;i<width;i++) {
+    *s++=' ';
+  }
+  memcpy(s,tmp,n);
+  s[n]=0;
+  return (n<width ? width : n);
+}
+
+size_t
+outbuf_fmtdouble(char *s, double v) {
+  double a=fabs(v), scaled, m;
+  size_t n;
+  int k, p;
+
+  /* the fewest decimals whose integer reads back exactly, in the range
+     where %g would not use an exponent either */
+  if (a==0 || (a>=1e-4 && a<1e15)) {
+    for (k=0;k<=17;k++) {
+      scaled=a*pow10tab[k];
+      if (scaled>=9007199254740992.0) break;
+      m=nearbyint(scaled);
+      if (m/pow10tab[k]==a) {
+	return putdigits(s,signbit(v)!=0,(unsigned long long) m,k,0);
+      }
+    }
+  }
+  for (p=15;p<17;p++) {
+    n=snprintf(s,OUTBUF_NUMBER,"%.*g",p,v);
+    if (strtod(s,NULL)==v || isnan(v)) return n;
+  }
+  return snprintf(s,OUTBUF_NUMBER,"%.17g",v);
+}
+
+/* make room to format a number straight into the buffer */
+static char *
+room(struct outbuf *ob) {
+  if (ob->len+OUTBUF_NUMBER>ob->size) makeroom(ob,OUTBUF_NUMBER);
+  return ob->buf+ob->len;
+}
+
+void
+outbuf_fixed(struct outbuf *ob, double v, int width, int prec) {
+  ob->len+=outbuf_fmtfixed(room(ob),v,width,prec);
+}
+
+void
+outbuf_exp(struct outbuf *ob, double v, int width, int prec) {
+  ob->len+=outbuf_fmtexp(room(ob),v,width,prec);
+}
+
+void
+outbuf_double(struct outbuf *ob, double v) {
+  ob->len+=outbuf_fmtdouble(room(ob),v);
+}
+
+void
+outbuf_uint(struct outbuf *ob, unsigned long long v) {
+  ob->len+=putdigits(room(ob),0,v,0,0);
+}
+
+void
+outbuf_le64(struct outbuf *ob, unsigned long long v) {
+  char b[8];
+  int i;
+
+  for (i=0;i<8;i++) {
+    b[i]=(char) (v>>(8*i));
+  }
+  outbuf_write(ob,b,8);
+}
+
+void
+outbuf_ledouble(struct outbuf *ob, double v) {
+  unsigned long long u;
+
+  memcpy(&u,&v,sizeof(u));
+  outbuf_le64(ob,u);
+}
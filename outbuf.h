@@ -0,0 +1,87 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#ifndef _OUTBUF_H_
+#define _OUTBUF_H_
+
+/* Output collected in a large buffer and written straight to a file
+   descriptor, with number formatting that avoids printf.  Each thread
+   writing output should have a buffer of its own. */
+
+#define OUTBUF_SIZE (1<<20)
+
+struct outbuf_writer;
+
+struct outbuf {
+  int fd;
+  char *buf;
+  size_t len, size;
+  unsigned long long offset;	/* bytes written out so far */
+  int error;
+  struct outbuf_writer *writer;	/* see outbuf_async */
+};
+
+/* a buffer of size bytes (0 for OUTBUF_SIZE) for fd; 0 on success.  With
+   fd -1 everything is kept in a buffer that grows, and the caller takes
+   buf and len (setting len to 0 to start again). */
+int outbuf_open(struct outbuf *ob, int fd, size_t size);
+/* write out what is buffered (after anything waiting in stdout) */
+int outbuf_flush(struct outbuf *ob);
+/* how many bytes have gone into the buffer altogether */
+#define outbuf_tell(ob) ((ob)->offset+(ob)->len)
+/* flush and free; returns -1 if any write failed */
+int outbuf_close(struct outbuf *ob);
+/* from now on a full buffer is handed to a thread of its own to write
+   while the next is filled, with at most nbuf waiting (so nbuf+1
+   buffers in all); nothing should be printed with stdio meanwhile.
+   outbuf_sync waits for them all to be written and stops the thread. */
+int outbuf_async(struct outbuf *ob, int nbuf);
+int outbuf_sync(struct outbuf *ob);
+
+void outbuf_write(struct outbuf *ob, const void *p, size_t n);
+void outbuf_putc(struct outbuf *ob, int c);
+void outbuf_puts(struct outbuf *ob, const char *s);
+void outbuf_printf(struct outbuf *ob, const char *format, ...);
+/* as printf("%*.*f") and printf("%*.*e") would, for prec up to 9 */
+void outbuf_fixed(struct outbuf *ob, double v, int width, int prec);
+void outbuf_exp(struct outbuf *ob, double v, int width, int prec);
+/* the shortest text that reads back as v */
+void outbuf_double(struct outbuf *ob, double v);
+void outbuf_uint(struct outbuf *ob, unsigned long long v);
+/* a little-endian 64-bit integer or double, for binary records */
+void outbuf_le64(struct outbuf *ob, unsigned long long v);
+void outbuf_ledouble(struct outbuf *ob, double v);
+
+/* the formatters on their own: write into s, which must have room for
+   OUTBUF_NUMBER characters (widths must be under 64), and return the length */
+#define OUTBUF_NUMBER 400
+size_t outbuf_fmtfixed(char *s, double v, int width, int prec);
+size_t outbuf_fmtexp(char *s, double v, int width, int prec);
+size_t outbuf_fmtdouble(char *s, double v);
+
+#endif	/* _OUTBUF_H_ */
@@ -231,6 +231,7 @@ main(int argc, char *argv[])
   struct kdtree *kd;
   struct kdres *res;
   unsigned int cols1[]={1,2}, cols2[]={1,2};
+  char *names1[]={NULL,NULL}, *names2[]={NULL,NULL};
   char **argptr, *filename1=NULL, *filename2=NULL;
   double *dptr[2];
   char *fs1, *fs2;
@@ -246,10 +247,10 @@ main(int argc, char *argv[])
    -xf x1_factor       factor to scale the x1 coordinate       - default %g\n\
    -yf y1_factor       factor to scale the y1 coordinate       - default %g\n\
    -m max_matches      number of matching transforms to quit   - default %d\n\
-   -x1 column          column to read x-coordinate from file 1 - default %d\n\
-   -y1 column          column to read y-coordinate from file 1 - default %d\n\
-   -x2 column          column to read x-coordinate from file 2 - default %d\n\
-   -y2 column          column to read y-coordinate from file 2 - default %d\n\
+   -x1 col|name        column to read x-coordinate from file 1 - default %d\n\
+   -y1 col|name        column to read y-coordinate from file 1 - default %d\n\
+   -x2 col|name        column to read x-coordinate from file 2 - default %d\n\
+   -y2 col|name        column to read y-coordinate from file 2 - default %d\n\
    -fs  FS             field separator - default space/TAB\n\
    -fs1 FS             field separator for file 1\n\
    -fs2 FS             field separator for file 2\n\
@@ -272,19 +273,19 @@ main(int argc, char *argv[])
   for (argptr=argv+1;argptr<argv+argc;argptr++) {
     if (strstr(*argptr,"-x1")) {
       if (++argptr<argv+argc) {
-	cols1[0]=atoi(*argptr);
+	loadfile_column(*argptr,cols1+0,names1+0);
       }
     } else if (strstr(*argptr,"-y1")) {
       if (++argptr<argv+argc) {
-	cols1[1]=atoi(*argptr);
+	loadfile_column(*argptr,cols1+1,names1+1);
       }
     } else if (strstr(*argptr,"-x2")) {
       if (++argptr<argv+argc) {
-	cols2[0]=atoi(*argptr);
+	loadfile_column(*argptr,cols2+0,names2+0);
       } 
     } else if (strstr(*argptr,"-y2")) {
       if (++argptr<argv+argc) {
-	cols2[1]=atoi(*argptr);
+	loadfile_column(*argptr,cols2+1,names2+1);
       }
     } else if (strstr(*argptr,"-d")) {
       if (++argptr<argv+argc) {
@@ -358,16 +359,16 @@ main(int argc, char *argv[])
   }
 
   if (strcmp(filename1,"-")) {
-    n1=loadfile_fs(filename1,2,cols1,dptr,fs1);
+    n1=loadfile_named_fs(filename1,2,cols1,names1,dptr,fs1);
   } else {
-    n1=loadfile_fileptr_fs(stdin,2,cols1,dptr,fs1);
+    n1=loadfile_named_fileptr_fs(stdin,2,cols1,names1,dptr,fs1);
   }
   xp1=dptr[0]; yp1=dptr[1];
 
   if (strcmp(filename2,"-")) {
-    n2=loadfile_fs(filename2,2,cols2,dptr,fs2); 
+    n2=loadfile_named_fs(filename2,2,cols2,names2,dptr,fs2); 
   } else {
-    n2=loadfile_fileptr_fs(stdin,2,cols2,dptr,fs2); 
+    n2=loadfile_named_fileptr_fs(stdin,2,cols2,names2,dptr,fs2); 
   }
   xp2=dptr[0]; yp2=dptr[1];
 
@@ -30,14 +30,31 @@ OF SUCH DAMAGE.
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "kdtree.h"
 #include "loadfile.h"
 #include "calctransform.h"
+#include "footprint.h"
 
 
 int n1, n2;
 double *xp1, *yp1, *xp2, *yp2;
 int listswapped=0, verbose=0, noswap=0, matching_pairs;
+/* -prior: a rough transformation from 1 to 2 whose overlap of the two
+   fields (widened by -margin) is all that is searched, and the numbers
+   the points kept had in their files */
+int doprior=0, *id1, *id2;
+double prior[6], margin=0;
+/* -shell: the quads among the brightest stars (by -mag1 and -mag2) are
+   matched first, in shells of stars that double in size */
+int shell=0;
+/* -near: instead of every quad, only those of a star with three of its
+   k nearest neighbours (between -scale lo and hi away), each once and
+   in order of their faintest star so that a shell is a run of them */
+int near=0, *local1, *local2;
+long nlocal1, nlocal2;
+double scalemin=0, scalemax=HUGE_VAL;
 double dist_cut=3e-3, trans_cut=1e-3, param2_factor=1000;
 struct kdtree *kd_good;
 double bestcoeff[6];
@@ -49,6 +66,12 @@ struct quad_data {
   int i, j, k, l;
 } qdata;
 
+/* the number point i of a list had in its file */
+int
+pointnumber(const int *id, int i) {
+  return (id ? id[i] : i);
+}
+
 int
 dcomp(const void *a, const void *b) {
   if (*((double *) a) <*((double *) b)) return 1;
@@ -119,11 +142,11 @@ addquad(double *param, int *quaddata) {
 	if (verbose>=0) {
 	  printf("Quad pair with matching x-transform: x2= %g x1 + %g y1 + %g: {",pos[0],pos[1],pos[2]*param2_factor);
 	  for (i=0;i<4;i++) {
-	    printf(" %d",data[i]);
+	    printf(" %d",pointnumber(listswapped ? id2 : id1,data[i]));
 	  }
 	  printf("} -> {");
 	  for (i=4;i<8;i++) {
-	    printf(" %d",data[i]);
+	    printf(" %d",pointnumber(listswapped ? id1 : id2,data[i]));
 	  }
 	  printf("}\n");
 	}
@@ -266,12 +289,14 @@ quadoutput(int ih, int jh, int kh, int lh,
     /* output the triangle information */
     if (verbose>1) {
       for (i=0;i<4;i++) {
-	printf("Tri #%d %3d - %3d - %3d %10.4f ; %3d - %3d - %3d %10.4f\n",i,pb[i].i,pb[i].j,pb[i].k,pb[i].area,pa[i].i,pa[i].j,pa[i].k,pa[i].area);
+	printf("Tri #%d %3d - %3d - %3d %10.4f ; %3d - %3d - %3d %10.4f\n",i,pointnumber(id2,pb[i].i),pointnumber(id2,pb[i].j),pointnumber(id2,pb[i].k),pb[i].area,
+	       pointnumber(id1,pa[i].i),pointnumber(id1,pa[i].j),pointnumber(id1,pa[i].k),pa[i].area);
       }
     }
     /* output the point correspondances */
     if (verbose>0) {
-      printf("{%d %d %d %d} -> {%d %d %d %d}\n",index2[0],index2[1],index2[2],index2[3],index1[0],index1[1],index1[2],index1[3]);
+      printf("{%d %d %d %d} -> {%d %d %d %d}\n",pointnumber(id2,index2[0]),pointnumber(id2,index2[1]),pointnumber(id2,index2[2]),pointnumber(id2,index2[3]),
+	     pointnumber(id1,index1[0]),pointnumber(id1,index1[1]),pointnumber(id1,index1[2]),pointnumber(id1,index1[3]));
     }
 
     /* calculate forward transformation */
@@ -307,13 +332,15 @@ quadoutput(int ih, int jh, int kh, int lh,
     /* output the triangle information */
     if (verbose>1) {
       for (i=0;i<4;i++) {
-	printf("Tri #%d %3d - %3d - %3d %10.4f ; %3d - %3d - %3d %10.4f\n",i,pa[i].i,pa[i].j,pa[i].k,pa[i].area,pb[i].i,pb[i].j,pb[i].k,pb[i].area);
+	printf("Tri #%d %3d - %3d - %3d %10.4f ; %3d - %3d - %3d %10.4f\n",i,pointnumber(id1,pa[i].i),pointnumber(id1,pa[i].j),pointnumber(id1,pa[i].k),pa[i].area,
+	       pointnumber(id2,pb[i].i),pointnumber(id2,pb[i].j),pointnumber(id2,pb[i].k),pb[i].area);
       }
     }
 
     /* output the point correspondances */
     if (verbose>0) {
-      printf("{%d %d %d %d} -> {%d %d %d %d}\n",index1[0],index1[1],index1[2],index1[3],index2[0],index2[1],index2[2],index2[3]);
+      printf("{%d %d %d %d} -> {%d %d %d %d}\n",pointnumber(id1,index1[0]),pointnumber(id1,index1[1]),pointnumber(id1,index1[2]),pointnumber(id1,index1[3]),
+	     pointnumber(id2,index2[0]),pointnumber(id2,index2[1]),pointnumber(id2,index2[2]),pointnumber(id2,index2[3]));
     }
 
     /* calculate forward transformation */
@@ -348,18 +375,471 @@ quadoutput(int ih, int jh, int kh, int lh,
   }
 }
 
+/* the shape of quad i, j, k, l of a list: the ratios of the areas of
+   the second and third biggest of its four triangles to the biggest; -1
+   if the smallest is less than a pixel */
+int
+quadshape(const double xp[], const double yp[], int i, int j, int k, int l, double ratioarray[2]) {
+  double la[4];
+
+  /* calculate triangle areas */
+  la[0]=fabs((xp[i]-xp[j])*(yp[j]-yp[k])-(xp[j]-xp[k])*(yp[i]-yp[j]));  /* leave out l */
+  la[1]=fabs((xp[i]-xp[j])*(yp[j]-yp[l])-(xp[j]-xp[l])*(yp[i]-yp[j]));  /* leave out k */
+  la[2]=fabs((xp[i]-xp[l])*(yp[l]-yp[k])-(xp[l]-xp[k])*(yp[i]-yp[l]));  /* leave out j */
+  la[3]=fabs((xp[l]-xp[j])*(yp[j]-yp[k])-(xp[j]-xp[k])*(yp[l]-yp[j]));  /* leave out i */
+  /* sort them */
+  qsort((void *) la,4,sizeof(double),dcomp);
+  if (la[3]<1) return -1;
+  /* the final ratio is determined by the other two */
+  ratioarray[0]=la[1]/la[0];
+  ratioarray[1]=la[2]/la[0];
+  return 0;
+}
+
+/* find the quads of the short list in kd with the shape of quad i, j,
+   k, l of the long list; 1 once there are enough matching transforms */
+int
+matchquad(struct kdtree *kd, const double ratioarray[2], int i, int j, int k, int l, int max_matches) {
+  struct kdres *res;
+  double pos[2], diff;
+  int *data;
+
+  res=kd_nearest_range(kd,ratioarray,dist_cut);
+  /* if there are some quads, then tell us about them */
+  while( !kd_res_end( res ) && matching_pairs < max_matches) {
+    /* get the data and position of the current result item */
+    data = (int*) kd_res_item( res, pos );
+    if (verbose>0) {
+      diff=hypot(pos[0]-ratioarray[0],pos[1]-ratioarray[1]);
+      printf("# %g %g\n",ratioarray[0],ratioarray[1]);
+      printf("# %g %g\n",pos[0],pos[1]);
+      printf("# diff= %g  %d %d %d %d %d %d %d %d\n",diff,pointnumber(id2,i),pointnumber(id2,j),pointnumber(id2,k),pointnumber(id2,l),
+	     pointnumber(id1,data[0]),pointnumber(id1,data[1]),pointnumber(id1,data[2]),pointnumber(id1,data[3]));
+    }
+    quadoutput(i,j,k,l,data[0],data[1],data[2],data[3]);
+    /* go to the next entry */
+    kd_res_next( res );
+  }
+  /* free the results structure */
+  kd_res_free(res);
+  return (matching_pairs>=max_matches);
+}
+
+/* add quad i, j, k, l of the short list to kd (unless it is too small) */
+int
+insertquad(struct kdtree *kd, int i, int j, int k, int l) {
+  double ratioarray[2];
+  int *data;
+
+  if (quadshape(xp1,yp1,i,j,k,l,ratioarray)) return 0;
+  if ((data=(int *) malloc(sizeof(int)*4))==NULL) {
+    printf("Unable to allocate data at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  data[0]=i; data[1]=j; data[2]=k; data[3]=l;
+  if (kd_insert(kd, ratioarray, (void *) data)) {
+    printf("Unable to insert ratio into the tree at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  return 0;
+}
+
+int
+localcomp(const void *a, const void *b) {
+  const int *p=(const int *) a, *q=(const int *) b;
+  int i;
+
+  for (i=3;i>=0;i--) {
+    if (p[i]!=q[i]) return (p[i]<q[i] ? -1 : 1);
+  }
+  return 0;
+}
+
+int
+intcomp(const void *a, const void *b) {
+  return *((const int *) a)-*((const int *) b);
+}
+
+/* -near: the local quads of the n stars of a list into quad, each as its
+   four stars in increasing order; returns how many, or -1 */
+long
+localquads(int n, const double xp[], const double yp[], int **quad) {
+  struct kdtree *kd;
+  struct kdres *res;
+  double pos[2], npos[2], d;
+  long nquad=0, m, i;
+  int c, a, b, e, nnb, num, found, *nb, *q;
+  size_t star;
+
+  kd=kd_create(2);
+  for (c=0;c<n;c++) {
+    pos[0]=xp[c]; pos[1]=yp[c];
+    if (kd_insert(kd, pos, (void *) (size_t) c)) {
+      printf("Unable to insert point into the tree at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+  }
+  if ((nb=(int *) malloc(sizeof(int)*(near+1)))==NULL ||
+      (*quad=(int *) malloc(sizeof(int)*4*((long) n*near*(near-1)*(near-2)/6+1)))==NULL) {
+    printf("Unable to allocate the local quads at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  for (c=0;c<n;c++) {
+    /* (the star itself is usually the nearest); those closer than
+       -scale lo do not count, so look further until there are k from lo
+       to hi away or there are no more */
+    pos[0]=xp[c]; pos[1]=yp[c];
+    for (num=near+1;;num*=2) {
+      if ((res=kd_nearest_n(kd,pos,num))==NULL) {
+	printf("Unable to find the neighbours of a star at %s:%d\n",__FILE__,__LINE__);
+	return -1;
+      }
+      for (nnb=0, d=0;!kd_res_end(res);kd_res_next(res)) {
+	star=(size_t) kd_res_item(res,npos);
+	d=hypot(npos[0]-pos[0],npos[1]-pos[1]);
+	if ((int) star==c || d<scalemin || d>scalemax || nnb==near) continue;
+	nb[nnb++]=(int) star;
+      }
+      found=kd_res_size(res);
+      kd_res_free(res);
+      if (nnb==near || found<num || d>scalemax || num>=n) break;
+    }
+    for (a=0;a<nnb;a++) {
+      for (b=a+1;b<nnb;b++) {
+	for (e=b+1;e<nnb;e++) {
+	  q=*quad+4*nquad++;
+	  q[0]=c; q[1]=nb[a]; q[2]=nb[b]; q[3]=nb[e];
+	  qsort((void *) q,4,sizeof(int),intcomp);
+	}
+      }
+    }
+  }
+  /* a quad may be local to each of its stars */
+  qsort((void *) *quad,nquad,sizeof(int)*4,localcomp);
+  for (i=0, m=0;i<nquad;i++) {
+    if (m>0 && localcomp(*quad+4*i,*quad+4*(m-1))==0) continue;
+    memmove(*quad+4*m++,*quad+4*i,sizeof(int)*4);
+  }
+  free((void *) nb);
+  kd_free(kd);
+  return m;
+}
+
+/* the first of the nquad local quads in quad whose faintest star is a or
+   fainter */
+long
+localstart(const int *quad, long nquad, int a) {
+  long lo=0, hi=nquad, mid;
+
+  while (lo<hi) {
+    mid=(lo+hi)/2;
+    if (quad[4*mid+3]<a) lo=mid+1; else hi=mid;
+  }
+  return lo;
+}
+
+/* -shell: add the quads of the short list whose faintest star is one of
+   a to b-1 to kd */
+int
+addshell(struct kdtree *kd, int a, int b) {
+  long t;
+  int i, j, k, l;
+
+  if (near) {
+    for (t=localstart(local1,nlocal1,a);t<nlocal1 && local1[4*t+3]<b;t++) {
+      if (insertquad(kd,local1[4*t],local1[4*t+1],local1[4*t+2],local1[4*t+3])) return -1;
+    }
+    return 0;
+  }
+  for (l=a;l<b;l++) {
+    for (k=2;k<l;k++) {
+      for (j=1;j<k;j++) {
+	for (i=0;i<j;i++) {
+	  if (insertquad(kd,i,j,k,l)) return -1;
+	}
+      }
+    }
+  }
+  return 0;
+}
+
+/* match the quads of the long list whose faintest star is one of a to
+   b-1 against kd; 1 once there are enough matching transforms */
+int
+matchshell(struct kdtree *kd, int a, int b, int max_matches) {
+  double ratioarray[2];
+  long t;
+  int i, j, k, l;
+
+  if (near) {
+    for (t=localstart(local2,nlocal2,a);t<nlocal2 && local2[4*t+3]<b;t++) {
+      i=local2[4*t]; j=local2[4*t+1]; k=local2[4*t+2]; l=local2[4*t+3];
+      if (quadshape(xp2,yp2,i,j,k,l,ratioarray)) continue;
+      if (matchquad(kd,ratioarray,i,j,k,l,max_matches)) return 1;
+    }
+    return 0;
+  }
+  for (l=a;l<b;l++) {
+    for (k=2;k<l;k++) {
+      for (j=1;j<k;j++) {
+	for (i=0;i<j;i++) {
+	  if (quadshape(xp2,yp2,i,j,k,l,ratioarray)) continue;
+	  if (matchquad(kd,ratioarray,i,j,k,l,max_matches)) return 1;
+	}
+      }
+    }
+  }
+  return 0;
+}
+
+/* -mag1 and -mag2: a star of a list, to be sorted by brightness */
+struct brightness {
+  double mag, x, y;
+  int id;
+};
+
+int
+brightcomp(const void *a, const void *b) {
+  const struct brightness *p=(const struct brightness *) a, *q=(const struct brightness *) b;
+
+  /* (stars without a magnitude go last) */
+  if (p->mag<q->mag || (p->mag==p->mag && q->mag!=q->mag)) return -1;
+  if (p->mag>q->mag || (p->mag!=p->mag && q->mag==q->mag)) return 1;
+  return p->id-q->id;
+}
+
+/* put the brightest of the n stars of a list first; mag is in the order
+   of the file, and id gets the number each star had there */
+int
+sortbymag(int n, double xp[], double yp[], const double mag[], int **id) {
+  struct brightness *b;
+  int i;
+
+  if ((*id==NULL && (*id=(int *) malloc(sizeof(int)*(n+1)))==NULL) ||
+      (b=(struct brightness *) malloc(sizeof(struct brightness)*(n+1)))==NULL) {
+    printf("Unable to allocate the magnitudes at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  for (i=0;i<n;i++) {
+    /* (the stars outside the overlap of -prior are gone already) */
+    b[i].id=(doprior ? (*id)[i] : i);
+    b[i].mag=mag[b[i].id];
+    b[i].x=xp[i];
+    b[i].y=yp[i];
+  }
+  qsort((void *) b,n,sizeof(struct brightness),brightcomp);
+  for (i=0;i<n;i++) {
+    (*id)[i]=b[i].id;
+    xp[i]=b[i].x;
+    yp[i]=b[i].y;
+  }
+  free((void *) b);
+  return 0;
+}
+
+
+/* -j: the full search is split among threads by rank in the order of
+   the loops, the first quad of each share found from its rank by the
+   combinatorial number system.  The threads shape (and look up) the
+   quads of a batch; the tree is built and the matches are taken here in
+   rank order, so everything is as it would be on one thread. */
+#define MAXTHREADS 256
+#define RANKBLOCK 65536		/* quads to a thread in a batch */
+int nthreads=1;
+
+struct rankfound {
+  int *data;
+  double pos[2];
+};
+
+struct rankwork {
+  unsigned long long a, b;	/* the ranks */
+  int n;			/* stars in the list */
+  const double *xp, *yp;
+  struct kdtree *kd;		/* to look them up in, or null */
+  int quad[4*RANKBLOCK];	/* the stars of each */
+  double shape[2*RANKBLOCK];	/* nan for a quad that is skipped */
+  unsigned long nfound[RANKBLOCK];	/* the end of the matches of each */
+  struct rankfound *found;
+  unsigned long foundalloc;
+  int error;
+};
+struct rankwork *rankwork;
+
+/* n choose t */
+unsigned long long
+binomial(int n, int t) {
+  unsigned long long c=1;
+  int i;
+
+  if (t<0 || n<t) return 0;
+  for (i=0;i<t;i++) c=c*(n-i)/(i+1);
+  return c;
+}
+
+/* the quad of rank r among those of n stars, in the order of the loops */
+void
+unrank(unsigned long long r, int n, int c[4]) {
+  unsigned long long count;
+  int p, v;
+
+  for (p=0, v=0;p<4;p++, v++) {
+    /* skip the quads with a smaller star here */
+    while ((count=binomial(n-1-v,3-p))<=r) {
+      r-=count;
+      v++;
+    }
+    c[p]=v;
+  }
+}
+
+void *
+rankworker(void *arg) {
+  struct rankwork *w=(struct rankwork *) arg;
+  struct kdres *res;
+  unsigned long long r;
+  unsigned long t, m=0;
+  double pos[2], *shape;
+  int c[4], broken=0, l;
+
+  if (w->a>=w->b) return NULL;
+  unrank(w->a,w->n,c);
+  /* (was the row cut short before the first quad?) */
+  for (l=c[2]+1;l<c[3] && !broken;l++) {
+    broken=quadshape(w->xp,w->yp,c[0],c[1],c[2],l,pos);
+  }
+  for (r=w->a, t=0;r<w->b;r++, t++) {
+    memcpy(w->quad+4*t,c,sizeof(c));
+    shape=w->shape+2*t;
+    /* if the smallest area is less than a pixel, skip the rest of the row */
+    if (broken || (broken=quadshape(w->xp,w->yp,c[0],c[1],c[2],c[3],shape))) {
+      shape[0]=shape[1]=NAN;
+    } else if (w->kd) {
+      /* find all the quads from the short list that are within the dist_cut */
+      if ((res=kd_nearest_range(w->kd,shape,dist_cut))==NULL) {
+	w->error=1;
+	return NULL;
+      }
+      for (;!kd_res_end(res);kd_res_next(res)) {
+	if (m==w->foundalloc) {
+	  w->foundalloc=(w->foundalloc ? 2*w->foundalloc : 1024);
+	  if ((w->found=(struct rankfound *) realloc((void *) w->found,sizeof(struct rankfound)*w->foundalloc))==NULL) {
+	    w->error=1;
+	    return NULL;
+	  }
+	}
+	w->found[m].data=(int *) kd_res_item(res,w->found[m].pos);
+	m++;
+      }
+      kd_res_free(res);
+    }
+    w->nfound[t]=m;
+    /* the next quad */
+    if (++c[3]==w->n) {
+      if (++c[2]==w->n-1) {
+	if (++c[1]==w->n-2) {
+	  c[0]++;
+	  c[1]=c[0]+1;
+	}
+	c[2]=c[1]+1;
+      }
+      c[3]=c[2]+1;
+      broken=0;
+    }
+  }
+  return NULL;
+}
+
+/* every quad of the n stars at xp, yp: added to build if it is not null,
+   otherwise matched against kd until there are enough matching
+   transforms */
+int
+rankbatches(int n, const double *xp, const double *yp, struct kdtree *build, struct kdtree *kd, int max_matches) {
+  pthread_t tid[MAXTHREADS];
+  struct rankwork *w;
+  unsigned long long r, e, total=binomial(n,4);
+  unsigned long t, f;
+  int i, *data, *q, done=0;
+  double *shape, diff;
+
+  if (rankwork==NULL && (rankwork=(struct rankwork *) calloc(nthreads,sizeof(struct rankwork)))==NULL) {
+    printf("Unable to allocate the threads at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  for (r=0;r<total && !done;r=e) {
+    e=(total-r>(unsigned long long) RANKBLOCK*nthreads ? r+(unsigned long long) RANKBLOCK*nthreads : total);
+    for (i=0;i<nthreads;i++) {
+      w=rankwork+i;
+      w->a=r+(e-r)*i/nthreads;
+      w->b=r+(e-r)*(i+1)/nthreads;
+      w->n=n;
+      w->xp=xp;
+      w->yp=yp;
+      w->kd=kd;
+      if (nthreads==1 || pthread_create(tid+i,NULL,rankworker,(void *) w)) {
+	/* run it here instead */
+	tid[i]=pthread_self();
+	rankworker((void *) w);
+      }
+    }
+    for (i=0;i<nthreads;i++) {
+      if (!pthread_equal(tid[i],pthread_self())) pthread_join(tid[i],NULL);
+    }
+    for (i=0, w=rankwork;i<nthreads && !done;i++, w++) {
+      if (w->error) {
+	printf("Unable to look up the quads at %s:%d\n",__FILE__,__LINE__);
+	return -1;
+      }
+      for (t=0, f=0;t<w->b-w->a && !done;f=w->nfound[t++]) {
+	q=w->quad+4*t;
+	shape=w->shape+2*t;
+	if (build) {
+	  if (isnan(shape[0])) continue;
+	  /* allocate an array to hold the points */
+	  if ((data=(int *) malloc(sizeof(int)*4))==NULL) {
+	    printf("Unable to allocate data at %s:%d\n",__FILE__,__LINE__);
+	    return -1;
+	  }
+	  memcpy(data,q,sizeof(int)*4);
+	  /* add it to the tree */
+	  if (kd_insert(build, shape, (void *) data)) {
+	    printf("Unable to insert ratio into the tree at %s:%d\n",__FILE__,__LINE__);
+	    return -1;
+	  }
+	  continue;
+	}
+	/* if there are some quads, then tell us about them */
+	for (;f<w->nfound[t] && matching_pairs<max_matches;f++) {
+	  data=w->found[f].data;
+	  if (verbose>0) {
+	    diff=hypot(w->found[f].pos[0]-shape[0],w->found[f].pos[1]-shape[1]);
+	    printf("# %g %g\n",shape[0],shape[1]);
+	    printf("# %g %g\n",w->found[f].pos[0],w->found[f].pos[1]);
+	    printf("# diff= %g  %d %d %d %d %d %d %d %d\n",diff,pointnumber(id2,q[0]),pointnumber(id2,q[1]),pointnumber(id2,q[2]),pointnumber(id2,q[3]),
+		   pointnumber(id1,data[0]),pointnumber(id1,data[1]),pointnumber(id1,data[2]),pointnumber(id1,data[3]));
+	  }
+	  quadoutput(q[0],q[1],q[2],q[3],data[0],data[1],data[2],data[3]);
+	}
+	done=(matching_pairs>=max_matches);
+      }
+    }
+  }
+  return 0;
+}
+
 int
 main(int argc, char *argv[])
 {
   FILE *in;
-  int i, j, k, l, ih, jh, kh, lh;
+  int i, ih, jh, kh, lh;
   int iah, jah, kah, lah, *data, max_matches=20;
-  double la[4], bestdiff, diff, ratioarray[2], pos[2], atof();
-  unsigned int cols1[]={1,2}, cols2[]={1,2};
+  double bestdiff, atof();
+  unsigned int cols1[]={1,2,0}, cols2[]={1,2,0};
+  char *names1[]={NULL,NULL,NULL}, *names2[]={NULL,NULL,NULL};
   char **argptr, *filename1=NULL, *filename2=NULL;
-  struct kdtree *kd;
-  struct kdres *res;
-  double *dptr[2];
+  struct kdtree *kd=NULL, *shells[8*sizeof(int)];
+  double *dptr[3], *mag1=NULL, *mag2=NULL;
+  int nshell=0, a1, a2, b1, b2, done;
   char *fs1, *fs2;
 
   fs1 = strdup(" \t");
@@ -372,13 +852,31 @@ main(int argc, char *argv[])
    -t transform_cutoff how small of a distance to call a match - default %g\n\
    -p translate_factor factor to scale the x-translation       - default %g\n\
    -m max_matches      number of matching transforms to quit   - default %d\n\
-   -x1 column          column to read x-coordinate from file 1 - default %d\n\
-   -y1 column          column to read y-coordinate from file 1 - default %d\n\
-   -x2 column          column to read x-coordinate from file 2 - default %d\n\
-   -y2 column          column to read y-coordinate from file 2 - default %d\n\
+   -x1 col|name        column to read x-coordinate from file 1 - default %d\n\
+   -y1 col|name        column to read y-coordinate from file 1 - default %d\n\
+   -x2 col|name        column to read x-coordinate from file 2 - default %d\n\
+   -y2 col|name        column to read y-coordinate from file 2 - default %d\n\
    -fs  FS             field separator - default space/TAB\n\
    -fs1 FS             field separator for file 1\n\
    -fs2 FS             field separator for file 2\n\
+   -prior a b c d e f  a rough transformation from 1 to 2, as from -t of a\n\
+                       match with fewer stars: only the stars in the overlap\n\
+                       of the two fields are used\n\
+   -margin m           how far outside the overlap (in the coordinates of\n\
+                       file 2) stars are still used - default %g\n\
+   -mag1 col|name      column to read a magnitude from file 1\n\
+   -mag2 col|name      column to read a magnitude from file 2\n\
+   -shell n            match the quads among the n brightest stars of each\n\
+                       file first (in the order of the files if there are\n\
+                       no magnitudes), then among the 2n brightest and so\n\
+                       on - default 10 if there are magnitudes\n\
+   -near k             only use the quads of each star with three of its\n\
+                       k nearest neighbours, so that the work grows as the\n\
+                       number of stars rather than its fourth power\n\
+   -scale lo hi        with -near, the k nearest neighbours from lo to hi\n\
+                       away (looking further past those closer than lo)\n\
+   -j threads          search every quad on this many threads (0 for one\n\
+                       per processor); the output is the same as on one\n\
    -ns                 Do not swap lists, even if the first is larger\n\
    -v                  be more verbose (more -v more verbose)\n\
    -q                  be less verbose (more -q less verbose)\n\
@@ -389,7 +887,7 @@ main(int argc, char *argv[])
    when one expects there to be shearing as well as rotation, translation and\n\
    scaling between the two catalogues.  If you don't expect shearing, use\n\
    triangle_kd.\n",
-	   dist_cut,trans_cut,param2_factor,max_matches,cols1[0],cols1[1],cols2[0],cols2[1]);
+	   dist_cut,trans_cut,param2_factor,max_matches,cols1[0],cols1[1],cols2[0],cols2[1],margin);
     return -1;
   }
 
@@ -397,19 +895,57 @@ main(int argc, char *argv[])
   for (argptr=argv+1;argptr<argv+argc;argptr++) {
     if (strstr(*argptr,"-x1")) {
       if (++argptr<argv+argc) {
-	cols1[0]=atoi(*argptr);
+	loadfile_column(*argptr,cols1+0,names1+0);
       }
     } else if (strstr(*argptr,"-y1")) {
       if (++argptr<argv+argc) {
-	cols1[1]=atoi(*argptr);
+	loadfile_column(*argptr,cols1+1,names1+1);
       }
     } else if (strstr(*argptr,"-x2")) {
       if (++argptr<argv+argc) {
-	cols2[0]=atoi(*argptr);
+	loadfile_column(*argptr,cols2+0,names2+0);
       } 
     } else if (strstr(*argptr,"-y2")) {
       if (++argptr<argv+argc) {
-	cols2[1]=atoi(*argptr);
+	loadfile_column(*argptr,cols2+1,names2+1);
+      }
+    } else if (strstr(*argptr,"-prior")) {
+      /* (before -p) */
+      doprior=1;
+      for (i=0;i<6 && ++argptr<argv+argc;i++) {
+	prior[i]=atof(*argptr);
+      }
+    } else if (strstr(*argptr,"-margin")) {
+      /* (before -m) */
+      if (++argptr<argv+argc) {
+	margin=atof(*argptr);
+      }
+    } else if (strstr(*argptr,"-mag1")) {
+      if (++argptr<argv+argc) {
+	loadfile_column(*argptr,cols1+2,names1+2);
+      }
+    } else if (strstr(*argptr,"-mag2")) {
+      if (++argptr<argv+argc) {
+	loadfile_column(*argptr,cols2+2,names2+2);
+      }
+    } else if (strstr(*argptr,"-j")) {
+      if (++argptr<argv+argc) {
+	nthreads=atoi(*argptr);
+      }
+    } else if (strstr(*argptr,"-near")) {
+      if (++argptr<argv+argc) {
+	near=atoi(*argptr);
+      }
+    } else if (strstr(*argptr,"-scale")) {
+      if (++argptr<argv+argc) {
+	scalemin=atof(*argptr);
+      }
+      if (++argptr<argv+argc) {
+	scalemax=atof(*argptr);
+      }
+    } else if (strstr(*argptr,"-shell")) {
+      if (++argptr<argv+argc) {
+	shell=atoi(*argptr);
       }
     } else if (strstr(*argptr,"-d")) {
       if (++argptr<argv+argc) {
@@ -457,6 +993,9 @@ main(int argc, char *argv[])
 	filename2=*argptr;
     }
   }
+  if (nthreads<=0) nthreads=(int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads>MAXTHREADS) nthreads=MAXTHREADS;
+  if (nthreads<1) nthreads=1;
 
   if (verbose>0) {
     printf("#");
@@ -479,20 +1018,36 @@ main(int argc, char *argv[])
     printf("# %s %s\n",filename1,filename2);
   }
 
+  /* the magnitudes are read as a third column */
+  i=(cols1[2] || names1[2] ? 3 : 2);
   if (strcmp(filename1,"-")) {
-    n1=loadfile_fs(filename1,2,cols1,dptr,fs1);
+    n1=loadfile_named_fs(filename1,i,cols1,names1,dptr,fs1);
   } else {
-    n1=loadfile_fileptr_fs(stdin,2,cols1,dptr,fs1);
+    n1=loadfile_named_fileptr_fs(stdin,i,cols1,names1,dptr,fs1);
   }
   xp1=dptr[0]; yp1=dptr[1];
+  if (i==3) mag1=dptr[2];
 
+  i=(cols2[2] || names2[2] ? 3 : 2);
   if (strcmp(filename2,"-")) {
-    n2=loadfile_fs(filename2,2,cols2,dptr,fs2); 
+    n2=loadfile_named_fs(filename2,i,cols2,names2,dptr,fs2); 
   } else {
-    n2=loadfile_fileptr_fs(stdin,2,cols2,dptr,fs2); 
+    n2=loadfile_named_fileptr_fs(stdin,i,cols2,names2,dptr,fs2); 
   }
   xp2=dptr[0]; yp2=dptr[1];
+  if (i==3) mag2=dptr[2];
+  if (shell<=0 && (mag1 || mag2)) shell=10;
+
+  /* leave out the stars that cannot be in both fields */
+  if (doprior) {
+    unsigned int m1=n1, m2=n2;
 
+    if (footprint_overlap(&m1,xp1,yp1,&id1,&m2,xp2,yp2,&id2,prior,margin)) return -1;
+    n1=m1;
+    n2=m2;
+    if (verbose>0) printf("# %d and %d points are in the overlap\n",n1,n2);
+  }
+  if ((mag1 && sortbymag(n1,xp1,yp1,mag1,&id1)) || (mag2 && sortbymag(n2,xp2,yp2,mag2,&id2))) return -1;
   /* output some information at the top */
   if (verbose>0) {
     printf("# List 1: %s has %d points and %ld quads\n# List 2: %s has %d points and %ld quads\n# dist_cut= %g\n%s",
@@ -507,105 +1062,55 @@ main(int argc, char *argv[])
     dumptr=xp1; xp1=xp2; xp2=dumptr;
     dumptr=yp1; yp1=yp2; yp2=dumptr;
     i=n1; n1=n2; n2=i;
+    data=id1; id1=id2; id2=data;
     listswapped=1;
   } else {
     listswapped=0;
   }
 
-  /* create the kd-tree */
-  kd = kd_create(2);
-  /* designate a function to deallocate the data */
-  kd_data_destructor(kd,free);
-
-  /* build the tree */
-  for (i=0;i<n1-3;i++) {
-    for (j=i+1;j<n1-2;j++) {
-      for (k=j+1;k<n1-1;k++) {
-	for (l=k+1;l<n1;l++) {
-	/* calculate triangle areas */
-	la[0]=fabs((xp1[i]-xp1[j])*(yp1[j]-yp1[k])-(xp1[j]-xp1[k])*(yp1[i]-yp1[j]));  /* leave out l */
-	la[1]=fabs((xp1[i]-xp1[j])*(yp1[j]-yp1[l])-(xp1[j]-xp1[l])*(yp1[i]-yp1[j]));  /* leave out k */
-	la[2]=fabs((xp1[i]-xp1[l])*(yp1[l]-yp1[k])-(xp1[l]-xp1[k])*(yp1[i]-yp1[l]));  /* leave out j */
-	la[3]=fabs((xp1[l]-xp1[j])*(yp1[j]-yp1[k])-(xp1[j]-xp1[k])*(yp1[l]-yp1[j]));  /* leave out i */
-	/* sort them */
-	qsort((void *) la,4,sizeof(double),dcomp);
-	/* if the smallest area is less than a pixel, skip this quad */
-	if (la[3]<1) break;
-	/* calculate the area ratio for the 2nd biggest to biggest */
-        /* and 3rd biggest to biggest, the final ratio is determined */
-	/* by the other two */
-	ratioarray[0]=la[1]/la[0];
-	ratioarray[1]=la[2]/la[0];
-	/* allocate an array to hold the points */
-	if ( (data=(int *) malloc(sizeof(int)*4))==NULL) {
-	  printf("Unable to allocate data at %s:%d\n",__FILE__,__LINE__);
-	  return -1;
-	}
-	data[0]=i; data[1]=j; data[2]=k; data[3]=l;
-	/* add it to the tree */
-	if (kd_insert(kd, ratioarray, (void *) data)) {
-	  printf("Unable to insert ratio into the tree at %s:%d\n",__FILE__,__LINE__);
-	  return -1;
-
-	}
-      }
-      }
-    }
+  if (near>2) {
+    if ((nlocal1=localquads(n1,xp1,yp1,&local1))<0 ||
+	(nlocal2=localquads(n2,xp2,yp2,&local2))<0) return -1;
+    if (verbose>0) printf("# %ld and %ld local quads\n",nlocal1,nlocal2);
+  } else {
+    near=0;
   }
 
-
-  /* go through the quads from the longer list */
-
   /* create the kd-tree for the matches */
   kd_good = kd_create(3);
   /* designate a function to deallocate the data */
   kd_data_destructor(kd_good,free);
 
-  for (i=0;i<n2-3;i++) {
-    for (j=i+1;j<n2-2;j++) {
-      for (k=j+1;k<n2-1;k++) {
-	for (l=k+1;l<n2;l++) {
-	  /* calculate triangle areas */
-	  la[0]=fabs((xp2[i]-xp2[j])*(yp2[j]-yp2[k])-(xp2[j]-xp2[k])*(yp2[i]-yp2[j]));  /* leave out l */
-	  la[1]=fabs((xp2[i]-xp2[j])*(yp2[j]-yp2[l])-(xp2[j]-xp2[l])*(yp2[i]-yp2[j]));  /* leave out k */
-	  la[2]=fabs((xp2[i]-xp2[l])*(yp2[l]-yp2[k])-(xp2[l]-xp2[k])*(yp2[i]-yp2[l]));  /* leave out j */
-	  la[3]=fabs((xp2[l]-xp2[j])*(yp2[j]-yp2[k])-(xp2[j]-xp2[k])*(yp2[l]-yp2[j]));  /* leave out i */
-	  /* sort them */
-	  qsort((void *) la,4,sizeof(double),dcomp);
-	  
-	  /* if the smallest area is less than a pixel, skip this quad */
-	  if (la[3]<1) break;
-	  /* calculate the area ratio for the 2nd biggest to biggest */
-	  /* and 3rd biggest to biggest, the final ratio is determined */
-	  /* by the other two */
-	  ratioarray[0]=la[1]/la[0];
-	  ratioarray[1]=la[2]/la[0];
-	  
-	  /* find all the quads from the first (short) list that are within the dist_cut */
-	  res=kd_nearest_range(kd,ratioarray,dist_cut);
-	  
-	  /* if there are some quads, then tell us about them */
-	  if (kd_res_size(res)>0) {
-	    while( !kd_res_end( res ) && matching_pairs < max_matches) {
-	      /* get the data and position of the current result item */
-	      data = (int*) kd_res_item( res, pos );
-	      if (verbose>0) {
-		diff=hypot(pos[0]-ratioarray[0],pos[1]-ratioarray[1]);
-		printf("# %g %g\n",ratioarray[0],ratioarray[1]);
-		printf("# %g %g\n",pos[0],pos[1]);
-		printf("# diff= %g  %d %d %d %d %d %d %d %d\n",diff,i,j,k,l,data[0],data[1],data[2],data[3]);
-	      }
-	      quadoutput(i,j,k,l,data[0],data[1],data[2],data[3]);
-	      /* go to the next entry */
-	      kd_res_next( res );
-	    }
-	  }
-	  /* free the results structure */
-	  kd_res_free(res);
-	  if (matching_pairs>max_matches) { i=j=k=l=n2; }
-	}
+  if (shell>0) {
+    /* each shell of the short list is matched against the new stars of
+       the long list and every shell before, and against the stars of the
+       long list before it, so each pair of quads is tried once */
+    for (a1=a2=done=0;!done && (a1<n1 || a2<n2);a1=b1, a2=b2) {
+      b1=(shell<<nshell<n1 ? shell<<nshell : n1);
+      b2=(shell<<nshell<n2 ? shell<<nshell : n2);
+      shells[nshell]=kd_create(2);
+      kd_data_destructor(shells[nshell],free);
+      if (addshell(shells[nshell++],a1,b1)) return -1;
+      for (i=0;i<nshell && !done;i++) {
+	done=matchshell(shells[i],a2,b2,max_matches);
       }
+      if (!done) done=matchshell(shells[nshell-1],0,a2,max_matches);
+      if (verbose>0) printf("# the %d and %d brightest points have been searched\n",b1,b2);
     }
+  } else if (near) {
+    kd = kd_create(2);
+    kd_data_destructor(kd,free);
+    if (addshell(kd,0,n1)) return -1;
+    matchshell(kd,0,n2,max_matches);
+  } else {
+    /* create the kd-tree */
+    kd = kd_create(2);
+    /* designate a function to deallocate the data */
+    kd_data_destructor(kd,free);
+
+    /* build the tree, then go through the quads from the longer list */
+    if (rankbatches(n1,xp1,yp1,kd,NULL,0) ||
+	rankbatches(n2,xp2,yp2,NULL,kd,max_matches)) return -1;
   }
 
   /* output the best cooefficients */
@@ -621,6 +1126,9 @@ main(int argc, char *argv[])
 
   /* free the tree */
   kd_free(kd);
+  for (i=0;i<nshell;i++) {
+    kd_free(shells[i]);
+  }
   kd_free(kd_good);
   free ( (void *) fs1);
   free ( (void *) fs2);
@@ -628,6 +1136,12 @@ main(int argc, char *argv[])
   free ((void *) yp1);
   free ((void *) xp2);
   free ((void *) yp2);
+  free ((void *) id1);
+  free ((void *) id2);
+  free ((void *) mag1);
+  free ((void *) mag2);
+  free ((void *) local1);
+  free ((void *) local2);
 
   return 0;
 }
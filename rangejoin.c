@@ -0,0 +1,751 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "rangejoin.h"
+
+/* grid cells are numbered with RJ_BITS bits per dimension so that a cell
+   key for up to three dimensions fits in 64 bits */
+#define RJ_MAXDIM 3
+#define RJ_BITS 21
+#define RJ_MAXCELL ((1L<<RJ_BITS)-1)
+#define RJ_MINBLOCK 1024
+/* declination zones are RJ_ZONEFACTOR match radii high, and at most
+   RJ_MAXZONE of them cover the sphere */
+#define RJ_ZONEFACTOR 2
+#define RJ_MAXZONE 65536
+/* allowances for rounding, in radians and in cells */
+#define RJ_ZONESLOP 1e-6
+#define RJ_CELLSLOP 1e-6
+/* with radii the cells (or zones) are sized from the radii of the
+   reference points, but no smaller than range/RJ_MAXSPAN */
+#define RJ_MAXSPAN 8
+#define SQ(x) ((x) * (x))
+
+struct rjgrid {
+  int dim;
+  unsigned int n;
+  const double *pos;
+  double range, cell;
+  double min[RJ_MAXDIM];
+  long ncell[RJ_MAXDIM];
+  unsigned long nkey;
+  unsigned long long *key;	/* occupied cells in increasing order */
+  unsigned int *start;		/* points of key[k] are sorted[start[k]..start[k+1]-1] */
+  unsigned int *sorted;		/* point numbers ordered by cell */
+  long nzone;			/* zones instead of cells if nonzero */
+  double height, angle;		/* zone height and match radius in radians */
+  unsigned int *zstart;		/* points of zone z are sorted[zstart[z]..zstart[z+1]-1] */
+  double *zra;			/* RA of sorted[s], increasing within each zone */
+  const double *radius;		/* radius of each point, or null */
+  double maxradius;
+  double *cellmax;		/* largest radius in each occupied cell or zone */
+};
+
+typedef
+struct rj_keyed {
+  unsigned long long key;
+  unsigned int i;
+} rjkeyed;
+
+typedef
+struct rj_zoned {
+  long zone;
+  double ra;
+  unsigned int i;
+} rjzoned;
+
+typedef
+struct rj_neighbour {
+  double dist;
+  unsigned int j;
+} rjneighbour;
+
+struct rj_work {
+  struct rjgrid *grid;
+  const double *pos, *radius;
+  unsigned int a, b;
+  int skipself, fill;
+  struct rangejoin *csr;
+  int status;
+};
+
+static int
+keycomp(const void *a, const void *b) {
+  if ( ((rjkeyed *) a)->key < ((rjkeyed *) b)->key) return -1;
+  if ( ((rjkeyed *) a)->key > ((rjkeyed *) b)->key) return 1;
+  if ( ((rjkeyed *) a)->i < ((rjkeyed *) b)->i) return -1;
+  if ( ((rjkeyed *) a)->i > ((rjkeyed *) b)->i) return 1;
+  return 0;
+}
+
+static int
+zonecomp(const void *a, const void *b) {
+  if ( ((rjzoned *) a)->zone < ((rjzoned *) b)->zone) return -1;
+  if ( ((rjzoned *) a)->zone > ((rjzoned *) b)->zone) return 1;
+  if ( ((rjzoned *) a)->ra < ((rjzoned *) b)->ra) return -1;
+  if ( ((rjzoned *) a)->ra > ((rjzoned *) b)->ra) return 1;
+  if ( ((rjzoned *) a)->i < ((rjzoned *) b)->i) return -1;
+  if ( ((rjzoned *) a)->i > ((rjzoned *) b)->i) return 1;
+  return 0;
+}
+
+static int
+neighbourcomp(const void *a, const void *b) {
+  if ( ((rjneighbour *) a)->dist < ((rjneighbour *) b)->dist) return -1;
+  if ( ((rjneighbour *) a)->dist > ((rjneighbour *) b)->dist) return 1;
+  if ( ((rjneighbour *) a)->j < ((rjneighbour *) b)->j) return -1;
+  if ( ((rjneighbour *) a)->j > ((rjneighbour *) b)->j) return 1;
+  return 0;
+}
+
+static unsigned long long
+cellkey(int dim, const long c[]) {
+  unsigned long long key=0;
+  int d;
+
+  for (d=0;d<dim;d++) {
+    key|=((unsigned long long) c[d])<<(RJ_BITS*d);
+  }
+  return key;
+}
+
+/* a radius, a missing one being zero */
+static double
+radiusof(const double *radius, unsigned int i) {
+  return (radius && radius[i]>0 ? radius[i] : 0);
+}
+
+/* the size of cell to search for points within range, or within their
+   radii if they have them: twice their mean radius, within limits */
+static double
+cellsize(unsigned int n, const double *radius, double range) {
+  double sum=0, cell;
+  unsigned int i;
+
+  if (radius==NULL || n==0) return range;
+  for (i=0;i<n;i++) {
+    sum+=radiusof(radius,i);
+  }
+  cell=2*sum/n;
+  if (cell<range/RJ_MAXSPAN) cell=range/RJ_MAXSPAN;
+  return (cell<range ? cell : range);
+}
+
+/* the largest radius among the points of each cell (or zone) from
+   sorted[start[k]] to sorted[start[k+1]-1], and among them all */
+static int
+cellmaxima(struct rjgrid *grid, const unsigned int *start, unsigned long ncell) {
+  unsigned long k;
+  unsigned int s;
+  double r;
+
+  if (grid->radius==NULL) return 0;
+  if ((grid->cellmax=(double *) malloc(sizeof(double)*(ncell>0 ? ncell : 1)))==NULL) {
+    printf("Unable to allocate grid in %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  grid->maxradius=0;
+  for (k=0;k<ncell;k++) {
+    grid->cellmax[k]=0;
+    for (s=start[k];s<start[k+1];s++) {
+      r=radiusof(grid->radius,grid->sorted[s]);
+      if (r>grid->cellmax[k]) grid->cellmax[k]=r;
+    }
+    if (grid->cellmax[k]>grid->maxradius) grid->maxradius=grid->cellmax[k];
+  }
+  return 0;
+}
+
+struct rjgrid *
+rangejoin_grid(int dim, unsigned int n, const double *pos, const double *radius, double range) {
+  struct rjgrid *grid;
+  rjkeyed *keyed;
+  double max[RJ_MAXDIM], extent;
+  long c[RJ_MAXDIM];
+  unsigned int i, nvalid;
+  unsigned long k;
+  int d, first=1;
+
+  if (dim<1 || dim>RJ_MAXDIM) {
+    printf("Range join only supports one to %d dimensions, not %d at %s:%d\n",RJ_MAXDIM,dim,__FILE__,__LINE__);
+    return NULL;
+  }
+  if ((grid=(struct rjgrid *) calloc(1,sizeof(struct rjgrid)))==NULL) {
+    printf("Unable to allocate grid in %s:%d\n",__FILE__,__LINE__);
+    return NULL;
+  }
+  grid->dim=dim;
+  grid->n=n;
+  grid->pos=pos;
+  grid->radius=radius;
+  grid->range=range;
+
+  /* find the bounding box of the points with valid coordinates */
+  for (d=0;d<dim;d++) {
+    grid->min[d]=max[d]=0;
+  }
+  for (i=0;i<n;i++) {
+    for (d=0;d<dim && !isnan(pos[i*dim+d]);d++);
+    if (d<dim) continue;
+    for (d=0;d<dim;d++) {
+      if (first || pos[i*dim+d]<grid->min[d]) grid->min[d]=pos[i*dim+d];
+      if (first || pos[i*dim+d]>max[d]) max[d]=pos[i*dim+d];
+    }
+    first=0;
+  }
+
+  /* cells are range across so only adjacent cells need to be searched
+     (or smaller with radii, when more are), and coarse enough that the
+     cell numbers fit in the key */
+  grid->cell=cellsize(n,radius,(range>0 ? range : 0));
+  for (d=0;d<dim;d++) {
+    extent=max[d]-grid->min[d];
+    if (extent>grid->cell*(RJ_MAXCELL-1)) grid->cell=extent/(RJ_MAXCELL-1);
+  }
+  if (grid->cell<=0) grid->cell=1;
+  for (d=0;d<dim;d++) {
+    grid->ncell[d]=(long) floor((max[d]-grid->min[d])/grid->cell)+1;
+  }
+
+  if ((keyed=(rjkeyed *) malloc(sizeof(rjkeyed)*(n>0 ? n : 1)))==NULL ||
+      (grid->sorted=(unsigned int *) malloc(sizeof(unsigned int)*(n>0 ? n : 1)))==NULL) {
+    printf("Unable to allocate grid in %s:%d\n",__FILE__,__LINE__);
+    free((void *) keyed);
+    rangejoin_grid_free(grid);
+    return NULL;
+  }
+  nvalid=0;
+  for (i=0;i<n;i++) {
+    for (d=0;d<dim && !isnan(pos[i*dim+d]);d++) {
+      c[d]=(long) floor((pos[i*dim+d]-grid->min[d])/grid->cell);
+      if (c[d]>=grid->ncell[d]) c[d]=grid->ncell[d]-1;
+    }
+    if (d<dim) continue;
+    keyed[nvalid].key=cellkey(dim,c);
+    keyed[nvalid].i=i;
+    nvalid++;
+  }
+  qsort((void *) keyed,nvalid,sizeof(rjkeyed),keycomp);
+
+  /* count the occupied cells */
+  grid->nkey=0;
+  for (i=0;i<nvalid;i++) {
+    if (i==0 || keyed[i].key!=keyed[i-1].key) grid->nkey++;
+  }
+  if ((grid->key=(unsigned long long *) malloc(sizeof(unsigned long long)*(grid->nkey+1)))==NULL ||
+      (grid->start=(unsigned int *) malloc(sizeof(unsigned int)*(grid->nkey+1)))==NULL) {
+    printf("Unable to allocate grid in %s:%d\n",__FILE__,__LINE__);
+    free((void *) keyed);
+    rangejoin_grid_free(grid);
+    return NULL;
+  }
+  k=0;
+  for (i=0;i<nvalid;i++) {
+    if (i==0 || keyed[i].key!=keyed[i-1].key) {
+      grid->key[k]=keyed[i].key;
+      grid->start[k++]=i;
+    }
+    grid->sorted[i]=keyed[i].i;
+  }
+  grid->start[k]=nvalid;
+  free((void *) keyed);
+  if (cellmaxima(grid,grid->start,grid->nkey)) {
+    rangejoin_grid_free(grid);
+    return NULL;
+  }
+
+  return grid;
+}
+
+/* RA and Dec in radians of a (not necessarily normalised) vector */
+static void
+radec(const double *q, double *ra, double *dec) {
+  *ra=atan2(q[1],q[0]);
+  *dec=atan2(q[2],sqrt(SQ(q[0])+SQ(q[1])));
+}
+
+/* the angle on the sphere subtended by a chord */
+static double
+chordangle(double chord) {
+  return (chord>=2 ? M_PI : 2*asin(chord>0 ? chord/2 : 0));
+}
+
+static long
+zoneof(const struct rjgrid *grid, double dec) {
+  long z=(long) floor((dec+M_PI/2)/grid->height);
+
+  if (z<0) z=0;
+  if (z>=grid->nzone) z=grid->nzone-1;
+  return z;
+}
+
+struct rjgrid *
+rangejoin_zones(unsigned int n, const double *pos, const double *radius, double range) {
+  struct rjgrid *grid;
+  rjzoned *zoned;
+  double ra, dec;
+  unsigned int i, nvalid;
+  long z;
+
+  if ((grid=(struct rjgrid *) calloc(1,sizeof(struct rjgrid)))==NULL) {
+    printf("Unable to allocate zones in %s:%d\n",__FILE__,__LINE__);
+    return NULL;
+  }
+  grid->dim=3;
+  grid->n=n;
+  grid->pos=pos;
+  grid->radius=radius;
+  grid->range=range;
+
+  /* the chord "range" subtends angle on the sphere */
+  grid->angle=chordangle(range);
+  grid->height=RJ_ZONEFACTOR*chordangle(cellsize(n,radius,range));
+  if (grid->height<M_PI/RJ_MAXZONE) grid->height=M_PI/RJ_MAXZONE;
+  grid->nzone=(long) ceil(M_PI/grid->height);
+  if (grid->nzone<1) grid->nzone=1;
+
+  if ((zoned=(rjzoned *) malloc(sizeof(rjzoned)*(n>0 ? n : 1)))==NULL ||
+      (grid->sorted=(unsigned int *) malloc(sizeof(unsigned int)*(n>0 ? n : 1)))==NULL ||
+      (grid->zra=(double *) malloc(sizeof(double)*(n>0 ? n : 1)))==NULL ||
+      (grid->zstart=(unsigned int *) malloc(sizeof(unsigned int)*(grid->nzone+1)))==NULL) {
+    printf("Unable to allocate zones in %s:%d\n",__FILE__,__LINE__);
+    free((void *) zoned);
+    rangejoin_grid_free(grid);
+    return NULL;
+  }
+  nvalid=0;
+  for (i=0;i<n;i++) {
+    if (isnan(pos[i*3]) || isnan(pos[i*3+1]) || isnan(pos[i*3+2])) continue;
+    radec(pos+i*3,&ra,&dec);
+    zoned[nvalid].zone=zoneof(grid,dec);
+    zoned[nvalid].ra=ra;
+    zoned[nvalid].i=i;
+    nvalid++;
+  }
+  qsort((void *) zoned,nvalid,sizeof(rjzoned),zonecomp);
+
+  z=0;
+  for (i=0;i<nvalid;i++) {
+    while (z<=zoned[i].zone) {
+      grid->zstart[z++]=i;
+    }
+    grid->sorted[i]=zoned[i].i;
+    grid->zra[i]=zoned[i].ra;
+  }
+  while (z<=grid->nzone) {
+    grid->zstart[z++]=nvalid;
+  }
+  free((void *) zoned);
+  grid->nkey=nvalid;
+  if (cellmaxima(grid,grid->zstart,grid->nzone)) {
+    rangejoin_grid_free(grid);
+    return NULL;
+  }
+
+  return grid;
+}
+
+void
+rangejoin_grid_free(struct rjgrid *grid) {
+  if (grid) {
+    free((void *) grid->zstart);
+    free((void *) grid->zra);
+    free((void *) grid->cellmax);
+    free((void *) grid->key);
+    free((void *) grid->start);
+    free((void *) grid->sorted);
+    free((void *) grid);
+  }
+}
+
+/* binary search for an occupied cell; returns its number or -1 */
+static long
+findcell(const struct rjgrid *grid, unsigned long long key) {
+  unsigned long lo=0, hi=grid->nkey, mid;
+
+  while (lo<hi) {
+    mid=(lo+hi)/2;
+    if (grid->key[mid]<key) {
+      lo=mid+1;
+    } else {
+      hi=mid;
+    }
+  }
+  return (lo<grid->nkey && grid->key[lo]==key ? (long) lo : -1);
+}
+
+/* how far from a query point with radius rq (negative if it has none) a
+   reference point (or cell or zone) with radius rj may be: range, or the
+   sum of the radii if there are any, but no more than range */
+static double
+reachof(const struct rjgrid *grid, double rq, double rj) {
+  double r;
+
+  if (rq<0 && grid->radius==NULL) return grid->range;
+  r=(rq>0 ? rq : 0)+rj;
+  return (r<grid->range ? r : grid->range);
+}
+
+/* visit the points of zone z with RA in [lo,hi] as searchpoint does */
+static unsigned long
+searchstripe(const struct rjgrid *grid, long z, double lo, double hi, const double *q, double rq, unsigned int iq, int skipself, rjneighbour *out) {
+  unsigned int a=grid->zstart[z], b=grid->zstart[z+1], mid, s, j;
+  double d2;
+  unsigned long count=0;
+
+  while (a<b) {
+    mid=(a+b)/2;
+    if (grid->zra[mid]<lo) {
+      a=mid+1;
+    } else {
+      b=mid;
+    }
+  }
+  for (s=a;s<grid->zstart[z+1] && grid->zra[s]<=hi;s++) {
+    j=grid->sorted[s];
+    if (skipself && j==iq) continue;
+    d2=SQ(grid->pos[j*3]-q[0]);
+    d2+=SQ(grid->pos[j*3+1]-q[1]);
+    d2+=SQ(grid->pos[j*3+2]-q[2]);
+    if (d2<=SQ(reachof(grid,rq,radiusof(grid->radius,j)))) {
+      if (out) {
+	out[count].dist=sqrt(d2);
+	out[count].j=j;
+      }
+      count++;
+    }
+  }
+  return count;
+}
+
+/* half-width in RA of a circle of the given angle about dec, or all of
+   it if it takes in a pole */
+static double
+rawidth(double dec, double angle) {
+  if (fabs(dec)+angle>=M_PI/2) return M_PI;
+  return asin(sin(angle)/cos(dec))+RJ_ZONESLOP;
+}
+
+/* searchpoint for zones: the RA window of each zone in the declination
+   band around q, split in two where it wraps; with radii each zone gets
+   a window of its own from the largest radius in it */
+static unsigned long
+searchzones(const struct rjgrid *grid, const double *q, double rq, unsigned int iq, int skipself, rjneighbour *out) {
+  double ra, dec, angle, zangle, bottom, gap, dra;
+  unsigned long count=0;
+  long z, zlo, zhi;
+
+  if (isnan(q[0]) || isnan(q[1]) || isnan(q[2])) return 0;
+  radec(q,&ra,&dec);
+  angle=chordangle(reachof(grid,rq,grid->maxradius))+RJ_ZONESLOP;
+  zlo=zoneof(grid,dec-angle);
+  zhi=zoneof(grid,dec+angle);
+  for (z=zlo;z<=zhi;z++) {
+    zangle=angle;
+    if (grid->cellmax || rq>=0) {
+      zangle=chordangle(reachof(grid,rq,(grid->cellmax ? grid->cellmax[z] : 0)))+RJ_ZONESLOP;
+      bottom=-M_PI/2+z*grid->height;
+      gap=(dec<bottom ? bottom-dec : dec>bottom+grid->height ? dec-bottom-grid->height : 0);
+      if (gap>zangle) continue;
+    }
+    dra=rawidth(dec,zangle);
+    if (dra>=M_PI) {
+      count+=searchstripe(grid,z,-M_PI-1,M_PI+1,q,rq,iq,skipself,(out ? out+count : NULL));
+      continue;
+    }
+    count+=searchstripe(grid,z,ra-dra,ra+dra,q,rq,iq,skipself,(out ? out+count : NULL));
+    if (ra-dra<-M_PI) {
+      count+=searchstripe(grid,z,ra-dra+2*M_PI,M_PI+1,q,rq,iq,skipself,(out ? out+count : NULL));
+    }
+    if (ra+dra>M_PI) {
+      count+=searchstripe(grid,z,-M_PI-1,ra+dra-2*M_PI,q,rq,iq,skipself,(out ? out+count : NULL));
+    }
+  }
+  return count;
+}
+
+/* visit every reference point within reach of point q (query number iq,
+   with radius rq or none if it is negative); if out is null just count
+   them, otherwise store them in out.  With radii, cells whose largest
+   radius cannot reach q are passed over. */
+static unsigned long
+searchpoint(const struct rjgrid *grid, const double *q, double rq, unsigned int iq, int skipself, rjneighbour *out) {
+  int dim=grid->dim, d, prune=(grid->cellmax || rq>=0);
+  long lo[RJ_MAXDIM], hi[RJ_MAXDIM], c[RJ_MAXDIM], k;
+  double clo, chi, d2, reach, edge, gap2, slop=grid->cell*RJ_CELLSLOP;
+  unsigned long count=0;
+  unsigned int s, j;
+
+  if (grid->nkey==0) return 0;
+  if (grid->nzone) return searchzones(grid,q,rq,iq,skipself,out);
+  reach=reachof(grid,rq,grid->maxradius)+slop;
+  for (d=0;d<dim;d++) {
+    if (isnan(q[d])) return 0;
+    clo=floor((q[d]-reach-grid->min[d])/grid->cell);
+    chi=floor((q[d]+reach-grid->min[d])/grid->cell);
+    /* nothing on the grid is within reach */
+    if (chi<0 || clo>grid->ncell[d]-1) return 0;
+    lo[d]=(clo<0 ? 0 : (long) clo);
+    hi[d]=(chi>grid->ncell[d]-1 ? grid->ncell[d]-1 : (long) chi);
+    c[d]=lo[d];
+  }
+
+  for (;;) {
+    if ((k=findcell(grid,cellkey(dim,c)))>=0) {
+      gap2=0;
+      for (d=0;prune && d<dim;d++) {
+	edge=grid->min[d]+c[d]*grid->cell;
+	if (q[d]<edge) {
+	  gap2+=SQ(edge-q[d]);
+	} else if (q[d]>edge+grid->cell && c[d]<grid->ncell[d]-1) {
+	  gap2+=SQ(q[d]-edge-grid->cell);
+	}
+      }
+      if (prune && gap2>SQ(reachof(grid,rq,(grid->cellmax ? grid->cellmax[k] : 0))+slop)) {
+	s=grid->start[k+1];
+      } else {
+	s=grid->start[k];
+      }
+      for (;s<grid->start[k+1];s++) {
+	j=grid->sorted[s];
+	if (skipself && j==iq) continue;
+	d2=0;
+	for (d=0;d<dim;d++) {
+	  d2+=SQ(grid->pos[j*dim+d]-q[d]);
+	}
+	if (d2<=SQ(reachof(grid,rq,radiusof(grid->radius,j)))) {
+	  if (out) {
+	    out[count].dist=sqrt(d2);
+	    out[count].j=j;
+	  }
+	  count++;
+	}
+      }
+    }
+    /* advance to the next neighbouring cell */
+    for (d=0;d<dim && ++c[d]>hi[d];d++) {
+      c[d]=lo[d];
+    }
+    if (d==dim) break;
+  }
+  return count;
+}
+
+static void *
+rangejoin_worker(void *arg) {
+  struct rj_work *w=(struct rj_work *) arg;
+  struct rangejoin *csr=w->csr;
+  rjneighbour *buf=NULL;
+  unsigned long nbuf=0, k, m;
+  unsigned int i;
+  int dim=w->grid->dim;
+  double rq;
+
+  w->status=0;
+  for (i=w->a;i<w->b;i++) {
+    rq=(w->radius ? radiusof(w->radius,i) : -1);
+    if (!w->fill) {
+      csr->offset[i+1]=searchpoint(w->grid,w->pos+i*dim,rq,i,w->skipself,NULL);
+      continue;
+    }
+    m=csr->offset[i+1]-csr->offset[i];
+    if (m==0) continue;
+    if (m>nbuf) {
+      free((void *) buf);
+      nbuf=2*m;
+      if ((buf=(rjneighbour *) malloc(sizeof(rjneighbour)*nbuf))==NULL) {
+	printf("Unable to allocate neighbour buffer in %s:%d\n",__FILE__,__LINE__);
+	w->status=-1;
+	return NULL;
+      }
+    }
+    searchpoint(w->grid,w->pos+i*dim,rq,i,w->skipself,buf);
+    if (m>1) qsort((void *) buf,m,sizeof(rjneighbour),neighbourcomp);
+    for (k=0;k<m;k++) {
+      csr->index[csr->offset[i]+k]=buf[k].j;
+      csr->dist[csr->offset[i]+k]=buf[k].dist;
+    }
+  }
+  free((void *) buf);
+  return NULL;
+}
+
+/* run one pass of the join over the query points split among the threads */
+static int
+rangejoin_pass(struct rj_work *work, int nthreads) {
+  pthread_t *tid;
+  int t, status=0;
+
+  if (nthreads==1) {
+    rangejoin_worker((void *) work);
+    return work->status;
+  }
+  if ((tid=(pthread_t *) malloc(sizeof(pthread_t)*nthreads))==NULL) {
+    printf("Unable to allocate threads in %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  for (t=0;t<nthreads;t++) {
+    if (pthread_create(tid+t,NULL,rangejoin_worker,(void *) (work+t))) {
+      /* run it here instead */
+      tid[t]=pthread_self();
+      rangejoin_worker((void *) (work+t));
+    }
+  }
+  for (t=0;t<nthreads;t++) {
+    if (!pthread_equal(tid[t],pthread_self())) pthread_join(tid[t],NULL);
+    if (work[t].status) status=-1;
+  }
+  free((void *) tid);
+  return status;
+}
+
+/* run one pass of the join over query points a to b-1 */
+static int
+rangejoin_rowpass(struct rjgrid *grid, unsigned int a, unsigned int b, const double *pos, const double *radius, int skipself, int nthreads, int fill, struct rangejoin *csr) {
+  struct rj_work *work;
+  int t, status;
+
+  if (nthreads<=0) nthreads=(int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads>(b-a)/RJ_MINBLOCK+1) nthreads=(b-a)/RJ_MINBLOCK+1;
+  if (nthreads<1) nthreads=1;
+  if ((work=(struct rj_work *) malloc(sizeof(struct rj_work)*nthreads))==NULL) {
+    printf("Unable to allocate threads in %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  for (t=0;t<nthreads;t++) {
+    work[t].grid=grid;
+    work[t].pos=pos;
+    work[t].radius=radius;
+    work[t].a=a+(unsigned int) ((unsigned long) (b-a)*t/nthreads);
+    work[t].b=a+(unsigned int) ((unsigned long) (b-a)*(t+1)/nthreads);
+    work[t].skipself=skipself;
+    work[t].fill=fill;
+    work[t].csr=csr;
+  }
+  status=rangejoin_pass(work,nthreads);
+  free((void *) work);
+  return status;
+}
+
+int
+rangejoin_count(struct rjgrid *grid, unsigned int n, const double *pos, const double *radius, int skipself, int nthreads, struct rangejoin *csr) {
+  unsigned int i;
+
+  csr->n=n;
+  csr->index=NULL;
+  csr->dist=NULL;
+  if ((csr->offset=(unsigned long *) malloc(sizeof(unsigned long)*(n+1)))==NULL) {
+    printf("Unable to allocate offsets in %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  csr->offset[0]=0;
+  if (rangejoin_rowpass(grid,0,n,pos,radius,skipself,nthreads,0,csr)) {
+    rangejoin_free(csr);
+    return -1;
+  }
+  for (i=0;i<n;i++) {
+    csr->offset[i+1]+=csr->offset[i];
+  }
+  return 0;
+}
+
+int
+rangejoin_rows(struct rjgrid *grid, const double *pos, const double *radius, int skipself, int nthreads,
+	       const struct rangejoin *count, unsigned int a, unsigned int b, struct rangejoin *part) {
+  unsigned long total=count->offset[b]-count->offset[a];
+  unsigned int i;
+
+  if (part->offset==NULL || part->n!=count->n) {
+    part->n=count->n;
+    if ((part->offset=(unsigned long *) realloc((void *) part->offset,sizeof(unsigned long)*(count->n+1)))==NULL) {
+      printf("Unable to allocate offsets in %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+  }
+  for (i=a;i<=b;i++) {
+    part->offset[i]=count->offset[i]-count->offset[a];
+  }
+  if ((part->index=(unsigned int *) realloc((void *) part->index,sizeof(unsigned int)*(total>0 ? total : 1)))==NULL ||
+      (part->dist=(double *) realloc((void *) part->dist,sizeof(double)*(total>0 ? total : 1)))==NULL) {
+    printf("Unable to allocate %lu neighbours in %s:%d\n",total,__FILE__,__LINE__);
+    return -1;
+  }
+  return rangejoin_rowpass(grid,a,b,pos,radius,skipself,nthreads,1,part);
+}
+
+int
+rangejoin_query(struct rjgrid *grid, unsigned int n, const double *pos, const double *radius, int skipself, int nthreads, struct rangejoin *csr) {
+  unsigned long total;
+
+  /* count the neighbours of each point, then fill in the rows */
+  if (rangejoin_count(grid,n,pos,radius,skipself,nthreads,csr)) {
+    return -1;
+  }
+  total=csr->offset[n];
+  if ((csr->index=(unsigned int *) malloc(sizeof(unsigned int)*(total>0 ? total : 1)))==NULL ||
+      (csr->dist=(double *) malloc(sizeof(double)*(total>0 ? total : 1)))==NULL) {
+    printf("Unable to allocate %lu neighbours in %s:%d\n",total,__FILE__,__LINE__);
+    rangejoin_free(csr);
+    return -1;
+  }
+  if (rangejoin_rowpass(grid,0,n,pos,radius,skipself,nthreads,1,csr)) {
+    rangejoin_free(csr);
+    return -1;
+  }
+  return 0;
+}
+
+int
+rangejoin_all(int dim, unsigned int n1, const double *pos1, unsigned int n2, const double *pos2, double range, int nthreads, struct rangejoin *csr) {
+  struct rjgrid *grid;
+  int retval;
+
+  if ((grid=rangejoin_grid(dim,n2,pos2,NULL,range))==NULL) {
+    return -1;
+  }
+  retval=rangejoin_query(grid,n1,pos1,NULL,(pos1==pos2),nthreads,csr);
+  rangejoin_grid_free(grid);
+  return retval;
+}
+
+void
+rangejoin_free(struct rangejoin *csr) {
+  free((void *) csr->offset);
+  free((void *) csr->index);
+  free((void *) csr->dist);
+  csr->offset=NULL;
+  csr->index=NULL;
+  csr->dist=NULL;
+  csr->n=0;
+}
@@ -0,0 +1,80 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#ifndef _RANGEJOIN_H_
+#define _RANGEJOIN_H_
+
+/* neighbour graph in compressed sparse row form: the neighbours of query
+   row i are index[offset[i]] ... index[offset[i+1]-1], sorted by distance */
+struct rangejoin {
+  unsigned int n;
+  unsigned long *offset;
+  unsigned int *index;
+  double *dist;
+};
+
+struct rjgrid;
+
+/* bin the "n" reference points (pos holds dim coordinates per point) on a
+   grid with cells at least "range" across; pos must outlive the grid.
+   If radius is not null it holds a radius for each point (and must
+   outlive the grid too): a query point then matches those within the
+   sum of their radii and its own, but never beyond range, and the cells
+   are sized from the radii instead. */
+struct rjgrid *rangejoin_grid(int dim, unsigned int n, const double *pos, const double *radius, double range);
+
+/* the same for unit vectors on the sphere: the points are cut into
+   declination zones a few match radii high and sorted by RA within
+   each zone; range (and any radius) is the chord length as before */
+struct rjgrid *rangejoin_zones(unsigned int n, const double *pos, const double *radius, double range);
+void rangejoin_grid_free(struct rjgrid *grid);
+
+/* find every reference point within the grid's range of each of the "n"
+   query points using nthreads threads (0 for one per processor).  If
+   radius is not null it holds a radius for each query point, added to
+   the reference points' as above.  If skipself is set the query points
+   are the reference points and the pairs (i,i) are left out.  Returns 0
+   on success. */
+int rangejoin_query(struct rjgrid *grid, unsigned int n, const double *pos, const double *radius, int skipself, int nthreads, struct rangejoin *csr);
+
+/* the same a part at a time, for when all the neighbours at once would
+   take too much memory: rangejoin_count only counts them, leaving the
+   offsets of every row in csr (and no index or dist), and rangejoin_rows
+   then fills part with the rows of query points a to b-1 alone, their
+   offsets counted from row a.  part starts zeroed, is reused from one
+   call to the next and is freed with rangejoin_free. */
+int rangejoin_count(struct rjgrid *grid, unsigned int n, const double *pos, const double *radius, int skipself, int nthreads, struct rangejoin *csr);
+int rangejoin_rows(struct rjgrid *grid, const double *pos, const double *radius, int skipself, int nthreads,
+		   const struct rangejoin *count, unsigned int a, unsigned int b, struct rangejoin *part);
+
+/* all pairs within range between two catalogues (or one, if pos1==pos2) */
+int rangejoin_all(int dim, unsigned int n1, const double *pos1, unsigned int n2, const double *pos2, double range, int nthreads, struct rangejoin *csr);
+
+void rangejoin_free(struct rangejoin *csr);
+
+#endif	/* _RANGEJOIN_H_ */
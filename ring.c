@@ -0,0 +1,109 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include "ring.h"
+
+int
+ring_init(struct ring *r, unsigned long size) {
+  for (r->size=1;r->size<size;r->size*=2);
+  if ((r->slot=(void **) malloc(sizeof(void *)*r->size))==NULL) {
+    printf("Unable to allocate a ring in %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  atomic_init(&r->head,0);
+  atomic_init(&r->tail,0);
+  atomic_init(&r->closed,0);
+  atomic_init(&r->waitfull,0);
+  atomic_init(&r->waitempty,0);
+  pthread_mutex_init(&r->lock,NULL);
+  pthread_cond_init(&r->wake,NULL);
+  return 0;
+}
+
+void
+ring_free(struct ring *r) {
+  free((void *) r->slot);
+  pthread_mutex_destroy(&r->lock);
+  pthread_cond_destroy(&r->wake);
+}
+
+/* wake the other thread if it is asleep; it sets its flag before it
+   looks at the ring for the last time, so one of us sees the other */
+static void
+wakeup(struct ring *r, atomic_int *waiting) {
+  if (atomic_load(waiting)) {
+    pthread_mutex_lock(&r->lock);
+    pthread_cond_broadcast(&r->wake);
+    pthread_mutex_unlock(&r->lock);
+  }
+}
+
+void
+ring_push(struct ring *r, void *p) {
+  unsigned long tail=atomic_load_explicit(&r->tail,memory_order_relaxed);
+
+  while (tail-atomic_load(&r->head)==r->size) {
+    pthread_mutex_lock(&r->lock);
+    atomic_store(&r->waitfull,1);
+    if (tail-atomic_load(&r->head)==r->size) pthread_cond_wait(&r->wake,&r->lock);
+    atomic_store(&r->waitfull,0);
+    pthread_mutex_unlock(&r->lock);
+  }
+  r->slot[tail&(r->size-1)]=p;
+  atomic_store(&r->tail,tail+1);
+  wakeup(r,&r->waitempty);
+}
+
+void *
+ring_pop(struct ring *r) {
+  unsigned long head=atomic_load_explicit(&r->head,memory_order_relaxed);
+  void *p;
+
+  while (atomic_load(&r->tail)==head) {
+    if (atomic_load(&r->closed) && atomic_load(&r->tail)==head) return NULL;
+    pthread_mutex_lock(&r->lock);
+    atomic_store(&r->waitempty,1);
+    if (atomic_load(&r->tail)==head && !atomic_load(&r->closed)) pthread_cond_wait(&r->wake,&r->lock);
+    atomic_store(&r->waitempty,0);
+    pthread_mutex_unlock(&r->lock);
+  }
+  p=r->slot[head&(r->size-1)];
+  atomic_store(&r->head,head+1);
+  wakeup(r,&r->waitfull);
+  return p;
+}
+
+void
+ring_close(struct ring *r) {
+  atomic_store(&r->closed,1);
+  pthread_mutex_lock(&r->lock);
+  pthread_cond_broadcast(&r->wake);
+  pthread_mutex_unlock(&r->lock);
+}
@@ -0,0 +1,59 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#ifndef _RING_H_
+#define _RING_H_
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* A bounded queue of pointers from one thread to one other.  Pushing and
+   popping take no lock; a thread only sleeps on the mutex when the ring
+   is full or empty, and is woken by the next pop or push. */
+
+struct ring {
+  void **slot;
+  unsigned long size;		/* a power of two */
+  atomic_ulong head, tail;	/* popped and pushed so far */
+  atomic_int closed;
+  atomic_int waitfull, waitempty;	/* the pusher or popper is asleep */
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+};
+
+/* a ring holding up to size pointers; 0 on success */
+int ring_init(struct ring *r, unsigned long size);
+void ring_free(struct ring *r);
+/* add p, waiting while the ring is full */
+void ring_push(struct ring *r, void *p);
+/* the next pointer, waiting for one; null once the ring is closed and empty */
+void *ring_pop(struct ring *r);
+/* nothing more will be pushed */
+void ring_close(struct ring *r);
+
+#endif	/* _RING_H_ */
@@ -0,0 +1,365 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "rangejoin.h"
+#include "outbuf.h"
+#include "sockio.h"
+#include "skystore.h"
+#include "match_kd.h"
+#include "serve.h"
+
+/* -serve: catalogue 2 stays loaded and answers queries from clients on
+   a Unix socket; -connect: catalogue 1 is matched by such a server, its
+   stars sent a block at a time.  Everything goes over as eight byte
+   little-endian numbers.  The server starts with SOCKIO_MAGIC, the
+   number of coordinates, the distance, the number of stars in catalogue
+   2 and the length and text of its comments.  A request is what is
+   wanted (the SERVE_ bits) and the number of stars n followed by their
+   coordinates, after -t and -eq, and with SERVE_RADIUS their radii; an
+   n of zero ends it.  The answer for each star is its closest star (with
+   SERVE_NEAREST) and then the number of stars within the distance and
+   each of them, closest first (with SERVE_RANGE).  A star is its number
+   in catalogue 2 (all ones for none) and its distance, and with
+   SERVE_LINES the length of its line and the line. */
+#define SERVE_NEAREST 1
+#define SERVE_RANGE 2
+#define SERVE_LINES 4
+#define SERVE_RADIUS 8
+/* the most stars in a request */
+#define SERVE_MAXSTARS (1<<24)
+char *servepath, *connectpath;
+/* the server: the comments of catalogue 2; the client: its connection */
+struct outbuf comments2;
+static struct outbuf serveout;
+static FILE *servein;
+
+/* -connect: read a star from the server into the next slot of ref; its
+   slot is ~0U if there is none */
+static void
+fetchstar(unsigned long long flags, unsigned int *slot, double *dist) {
+  unsigned long long number, len=0;
+  char *q;
+
+  if (sockio_le64(servein,&number) || sockio_ledouble(servein,dist)) {
+    printf("Lost the server at %s:%d\n",__FILE__,__LINE__);
+    exit(-1);
+  }
+  if (number==~0ULL) {
+    *slot=~0U;
+    return;
+  }
+  if ((flags & SERVE_LINES) && sockio_le64(servein,&len)) {
+    printf("Lost the server at %s:%d\n",__FILE__,__LINE__);
+    exit(-1);
+  }
+  q=newslot(number,len,slot);
+  if (sockio_read(servein,q,len)) {
+    printf("Lost the server at %s:%d\n",__FILE__,__LINE__);
+    exit(-1);
+  }
+}
+
+/* -connect: ask the server about the stars of block bl, which leaves the
+   stars it found in ref (for this block only), the closest to each in
+   bl->near and the neighbours in csr as the range join would */
+void
+askserver(struct block *bl, struct rangejoin *csr) {
+  unsigned long long flags, n=0, m, k;
+  unsigned long total=0, alloc=0;
+  unsigned int i, slot;
+  double dist;
+  int j;
+
+  flags=(donearest ? SERVE_NEAREST : 0)|(distance>0 ? SERVE_RANGE : 0)|
+    (dobinary ? 0 : SERVE_LINES)|(doradius1 ? SERVE_RADIUS : 0);
+  for (i=0;i<bl->n;i++) n+=(bl->kind[i]==LINE_STAR);
+  /* (a request for no stars would end the session) */
+  if (n>0) {
+    outbuf_le64(&serveout,flags);
+    outbuf_le64(&serveout,n);
+    for (i=0;i<bl->n;i++) {
+      for (j=0;bl->kind[i]==LINE_STAR && j<ndim;j++) outbuf_ledouble(&serveout,bl->pos[i][j]);
+    }
+    for (i=0;doradius1 && i<bl->n;i++) {
+      if (bl->kind[i]==LINE_STAR) outbuf_ledouble(&serveout,bl->radius[i]);
+    }
+    if (outbuf_flush(&serveout)) {
+      printf("Lost the server at %s:%d\n",__FILE__,__LINE__);
+      exit(-1);
+    }
+  }
+
+  ref->n=0;
+  ref->store.len=0;
+  csr->n=bl->n;
+  csr->index=NULL;
+  csr->dist=NULL;
+  if (distance>0 && (csr->offset=(unsigned long *) malloc(sizeof(unsigned long)*(bl->n+1)))==NULL) {
+    printf("Unable to allocate the neighbours at %s:%d\n",__FILE__,__LINE__);
+    exit(-1);
+  }
+  for (i=0;i<bl->n;i++) {
+    if (distance>0) csr->offset[i]=total;
+    bl->near[i]=~0U;
+    if (bl->kind[i]!=LINE_STAR) continue;
+    if (donearest) {
+      fetchstar(flags,bl->near+i,bl->neardist+i);
+    }
+    if (distance>0) {
+      if (sockio_le64(servein,&m)) {
+	printf("Lost the server at %s:%d\n",__FILE__,__LINE__);
+	exit(-1);
+      }
+      for (k=0;k<m;k++) {
+	fetchstar(flags,&slot,&dist);
+	addneighbour(csr,&total,&alloc,slot,dist);
+      }
+    }
+  }
+  if (distance>0) csr->offset[bl->n]=total;
+  ref->base=ref->store.text;
+}
+
+/* -serve: a star for a client (see SERVE_NEAREST) */
+static void
+putstar(struct outbuf *ob, unsigned long long flags, long i, double dist) {
+  outbuf_le64(ob,(i>=0 ? (unsigned long long) i : ~0ULL));
+  outbuf_ledouble(ob,dist);
+  if (i>=0 && (flags & SERVE_LINES)) {
+    outbuf_le64(ob,ref->len[i]);
+    outbuf_write(ob,ref->base+ref->line[i],ref->len[i]);
+  }
+}
+
+/* -serve from a sky store: the stars found for a client's star q, as
+   putstar writes them, where the first one ends and how far it is */
+struct servefind {
+  struct outbuf found;
+  const double *q;
+  unsigned long long flags, n;
+  double neardist;
+  size_t firstlen;
+};
+
+static void
+foundforclient(void *arg, const struct skystar *star, double dist, const char *line) {
+  struct servefind *sf=(struct servefind *) arg;
+
+  outbuf_le64(&sf->found,star->row);
+  outbuf_ledouble(&sf->found,dist);
+  if (sf->flags & SERVE_LINES) {
+    outbuf_le64(&sf->found,star->len);
+    outbuf_write(&sf->found,line,star->len);
+  }
+  if (sf->n++==0) {
+    sf->firstlen=sf->found.len;
+    /* (as closest() works it out) */
+    sf->neardist=stardist(star->pos,sf->q);
+  }
+}
+
+/* -serve: answer the requests of the client on socket fd until it hangs up */
+static void *
+serveclient(void *arg) {
+  int fd=(int) (size_t) arg;
+  struct rangejoin csr;
+  struct servefind sf;
+  struct outbuf ob;
+  FILE *in;
+  double *pos=NULL, *radius=NULL, npos[3], dist;
+  unsigned long long flags, n, nalloc=0, i;
+  unsigned long k;
+  long i2;
+
+  if ((in=fdopen(fd,"r"))==NULL || outbuf_open(&ob,fd,0) || outbuf_open(&sf.found,-1,0)) {
+    printf("Unable to talk to a client at %s:%d\n",__FILE__,__LINE__);
+    if (in) fclose(in); else close(fd);
+    return NULL;
+  }
+  outbuf_write(&ob,SOCKIO_MAGIC,8);
+  outbuf_le64(&ob,(unsigned long long) ndim);
+  outbuf_ledouble(&ob,distance);
+  outbuf_le64(&ob,(ref->sky ? skystore_size(ref->sky) : ref->n));
+  outbuf_le64(&ob,comments2.len);
+  outbuf_write(&ob,comments2.buf,comments2.len);
+  outbuf_flush(&ob);
+  while (!ob.error && sockio_le64(in,&flags)==0 && sockio_le64(in,&n)==0 &&
+	 n>0 && n<=SERVE_MAXSTARS) {
+    if (n>nalloc) {
+      nalloc=n;
+      if ((pos=(double *) realloc((void *) pos,sizeof(double)*ndim*nalloc))==NULL ||
+	  (radius=(double *) realloc((void *) radius,sizeof(double)*nalloc))==NULL) {
+	printf("Unable to allocate a request at %s:%d\n",__FILE__,__LINE__);
+	break;
+      }
+    }
+    for (i=0;i<n*ndim && sockio_ledouble(in,pos+i)==0;i++);
+    if (i<n*ndim) break;
+    for (i=0;(flags & SERVE_RADIUS) && i<n && sockio_ledouble(in,radius+i)==0;i++);
+    if ((flags & SERVE_RADIUS) && i<n) break;
+    /* (a sky store has no radii) */
+    if (ref->sky && (flags & SERVE_RADIUS)) break;
+    /* the range is the server's own, so there must be one */
+    if (distance<=0) flags&=~(unsigned long long) SERVE_RANGE;
+    if ((flags & SERVE_RANGE) && !ref->sky &&
+	rangejoin_query(ref->grid,(unsigned int) n,pos,((flags & SERVE_RADIUS) ? radius : NULL),0,nthreads,&csr)) {
+      printf("Unable to find the neighbours for a client at %s:%d\n",__FILE__,__LINE__);
+      break;
+    }
+    for (i=0;ref->sky && i<n;i++) {
+      /* the nearest star within the distance, then the rest */
+      sf.flags=flags;
+      sf.q=pos+i*ndim;
+      sf.n=0;
+      sf.found.len=0;
+      if ((flags & (SERVE_NEAREST|SERVE_RANGE)) && skystore_range(ref->sky,pos+i*ndim,distance,foundforclient,(void *) &sf)<0) break;
+      if ((flags & SERVE_NEAREST) && sf.n>0) {
+	outbuf_write(&ob,sf.found.buf,8);
+	outbuf_ledouble(&ob,sf.neardist);
+	outbuf_write(&ob,sf.found.buf+16,sf.firstlen-16);
+      } else if (flags & SERVE_NEAREST) {
+	putstar(&ob,flags,-1,0.0/0.0);
+      }
+      if (flags & SERVE_RANGE) {
+	outbuf_le64(&ob,sf.n);
+	outbuf_write(&ob,sf.found.buf,sf.found.len);
+      }
+    }
+    if (ref->sky && i<n) break;
+    for (i=0;!ref->sky && i<n;i++) {
+      if (flags & SERVE_NEAREST) {
+	dist=0.0/0.0;
+	i2=closest(ref,pos+i*ndim,npos,&dist);
+	putstar(&ob,flags,i2,dist);
+      }
+      if (flags & SERVE_RANGE) {
+	outbuf_le64(&ob,csr.offset[i+1]-csr.offset[i]);
+	for (k=csr.offset[i];k<csr.offset[i+1];k++) {
+	  putstar(&ob,flags,(long) csr.index[k],csr.dist[k]);
+	}
+      }
+    }
+    if ((flags & SERVE_RANGE) && !ref->sky) rangejoin_free(&csr);
+    outbuf_flush(&ob);
+  }
+  free((void *) pos);
+  free((void *) radius);
+  outbuf_close(&sf.found);
+  outbuf_close(&ob);
+  fclose(in);
+  return NULL;
+}
+
+/* -serve: accept clients on the socket at path for ever, each on a
+   thread of its own */
+int
+serve(const char *path) {
+  pthread_t tid;
+  int lfd, fd;
+
+  /* a client that goes away is only an error for its own thread */
+  signal(SIGPIPE,SIG_IGN);
+  if ((lfd=sockio_listen(path))<0) return -1;
+  if (verbose) {
+    printf("# serving %u stars on %s\n",ref->n,path);
+    fflush(stdout);
+  }
+  for (;;) {
+    if ((fd=accept(lfd,NULL,NULL))<0) {
+      if (errno==EINTR || errno==ECONNABORTED) continue;
+      printf("Unable to accept a client on %s at %s:%d\n",path,__FILE__,__LINE__);
+      close(lfd);
+      return -1;
+    }
+    if (pthread_create(&tid,NULL,serveclient,(void *) (size_t) fd)) {
+      /* answer it here instead */
+      serveclient((void *) (size_t) fd);
+    } else {
+      pthread_detach(tid);
+    }
+  }
+}
+
+/* -connect: connect to the server at path and read what it sends first:
+   the coordinates and distance it uses (its distance replaces any -d,
+   which only asks for the neighbours) and the comments of catalogue 2 */
+int
+connectserver(const char *path) {
+  unsigned long long dim, n, len;
+  char magic[8], *q;
+  double range;
+  int fd;
+
+  if ((fd=sockio_connect(path))<0) return -1;
+  if ((servein=fdopen(fd,"r"))==NULL || outbuf_open(&serveout,fd,0)) {
+    printf("Unable to talk to the server at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  if (sockio_read(servein,magic,8) || memcmp(magic,SOCKIO_MAGIC,8) ||
+      sockio_le64(servein,&dim) || sockio_ledouble(servein,&range) ||
+      sockio_le64(servein,&n) || sockio_le64(servein,&len) || (dim!=2 && dim!=3)) {
+    printf("There is no match_kd server on %s at %s:%d\n",path,__FILE__,__LINE__);
+    return -1;
+  }
+  if (len>0) {
+    if ((q=reserveline(&ref->store,len))==NULL) return -1;
+    if (sockio_read(servein,q,len)) {
+      printf("Lost the server at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+    if (!dobinary) outbuf_write(&out,q,len);
+  }
+  if (verbose) printf("# the server on %s has %llu stars\n",path,n);
+  ndim=(int) dim;
+  dosphere=(ndim==3);
+  if (distance>0) {
+    if (range<=0) {
+      printf("The server on %s has no distance (-d) at %s:%d\n",path,__FILE__,__LINE__);
+      return -1;
+    }
+    distance=range;
+  }
+  return 0;
+}
+
+/* -connect: a request for no stars ends the session */
+void
+closeserver(void) {
+  outbuf_le64(&serveout,0);
+  outbuf_le64(&serveout,0);
+  outbuf_close(&serveout);
+  fclose(servein);
+}
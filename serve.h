@@ -0,0 +1,55 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#ifndef _SERVE_H_
+#define _SERVE_H_
+
+#include "match_kd.h"
+
+/* -serve: catalogue 2 stays loaded and answers queries from clients on
+   a Unix socket; -connect: catalogue 1 is matched by such a server, its
+   stars sent a block at a time (serve.c has what goes over). */
+extern char *servepath, *connectpath;
+/* the server: the comments of catalogue 2, sent to each client */
+extern struct outbuf comments2;
+
+/* -serve: accept clients on the socket at path for ever, each on a
+   thread of its own */
+int serve(const char *path);
+/* -connect: connect to the server at path and read what it sends first:
+   the coordinates and distance it uses (its distance replaces any -d,
+   which only asks for the neighbours) and the comments of catalogue 2 */
+int connectserver(const char *path);
+/* -connect: ask the server about the stars of block bl, which leaves the
+   stars it found in ref (for this block only), the closest to each in
+   bl->near and the neighbours in csr as the range join would */
+void askserver(struct block *bl, struct rangejoin *csr);
+/* -connect: end the session */
+void closeserver(void);
+
+#endif	/* _SERVE_H_ */
@@ -0,0 +1,605 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "loadfile.h"
+#include "catfile.h"
+#include "skystore.h"
+
+#define ALIGN8(x) (((x)+7)&~((unsigned long long) 7))
+/* no point of a tile is further than this over nside radians from its
+   centre (it is about 1.05 at most) */
+#define PIXRAD 1.2
+#define NHASH 4096
+
+/* a tile that is mapped, in a list from the most recently used and in
+   a chain of its hash bucket; pins counts the queries using it */
+struct skytile {
+  unsigned long long pix, n;
+  void *map;
+  size_t maplen;
+  const char *base;
+  const struct skystar *star;
+  int pins;
+  struct skytile *newer, *older, *hnext;
+};
+
+struct skystore {
+  int fd, order;
+  unsigned long long nstars, npix;
+  const unsigned long long *tileoff, *first;
+  void *head;
+  size_t headlen, cachebytes, mapped;
+  long pagesize;
+  struct skytile *newest, *oldest, *hash[NHASH];
+  pthread_mutex_t lock;
+};
+
+/* the stars found by a query, and the tiles it has pinned */
+struct skyhit {
+  const struct skystar *s;
+  const char *base;
+  double dist;
+};
+struct skyquery {
+  struct skyhit *hit;
+  size_t nhit, hitalloc;
+  struct skytile **tile;
+  unsigned int ntile, tilealloc;
+};
+
+static int
+host_le(void) {
+  unsigned int one=1;
+  return *((unsigned char *) &one);
+}
+
+static unsigned long long
+spread(unsigned long long v) {
+  unsigned long long r=0;
+  int b;
+
+  for (b=0;b<32;b++) r|=((v>>b)&1ULL)<<(2*b);
+  return r;
+}
+
+static unsigned long long
+compress(unsigned long long v) {
+  unsigned long long r=0;
+  int b;
+
+  for (b=0;b<32;b++) r|=((v>>(2*b))&1ULL)<<b;
+  return r;
+}
+
+/* as HEALPix does it (loc2pix and pix2loc of Healpix_Base) */
+unsigned long long
+skystore_pixel(int order, const double v[3]) {
+  long long nside=1LL<<order, ix, iy, jp, jm, face;
+  double z=v[2]/sqrt(v[0]*v[0]+v[1]*v[1]+v[2]*v[2]), za=fabs(z);
+  double tt=atan2(v[1],v[0])*M_2_PI, tp, t1, t2;
+  int ntt;
+
+  if (tt<0) tt+=4;
+  if (tt>=4) tt-=4;
+  if (za<=2.0/3.0) {
+    t1=nside*(0.5+tt);
+    t2=nside*(z*0.75);
+    jp=(long long) (t1-t2);
+    jm=(long long) (t1+t2);
+    face=((jp>>order)==(jm>>order) ? ((jp>>order)|4) : ((jp>>order)<(jm>>order) ? (jp>>order) : (jm>>order)+8));
+    ix=jm&(nside-1);
+    iy=nside-(jp&(nside-1))-1;
+  } else {
+    ntt=(tt<3 ? (int) tt : 3);
+    tp=tt-ntt;
+    t1=nside*sqrt(3*(1-za));
+    jp=(long long) (tp*t1);
+    jm=(long long) ((1-tp)*t1);
+    if (jp>nside-1) jp=nside-1;
+    if (jm>nside-1) jm=nside-1;
+    if (z>=0) {
+      face=ntt;
+      ix=nside-jm-1;
+      iy=nside-jp-1;
+    } else {
+      face=ntt+8;
+      ix=jp;
+      iy=jm;
+    }
+  }
+  return ((unsigned long long) face<<(2*order))+spread(ix)+(spread(iy)<<1);
+}
+
+void
+skystore_centre(int order, unsigned long long pix, double v[3]) {
+  static const int jrll[12]={2,2,2,2,3,3,3,3,4,4,4,4}, jpll[12]={1,3,5,7,0,2,4,6,1,3,5,7};
+  long long nside=1LL<<order, ix, iy, jr, nr, kshift, jp;
+  int face=(int) (pix>>(2*order));
+  double fact2=4.0/(12.0*nside*nside), z, phi, sth;
+
+  ix=compress(pix&(nside*nside-1));
+  iy=compress((pix&(nside*nside-1))>>1);
+  jr=((long long) jrll[face]<<order)-ix-iy-1;
+  if (jr<nside) {
+    nr=jr;
+    z=1-nr*nr*fact2;
+    kshift=0;
+  } else if (jr>3*nside) {
+    nr=4*nside-jr;
+    z=nr*nr*fact2-1;
+    kshift=0;
+  } else {
+    nr=nside;
+    z=(2*nside-jr)*2*nside*fact2;
+    kshift=(jr-nside)&1;
+  }
+  jp=(jpll[face]*nr+ix-iy+1+kshift)/2;
+  if (jp>4*nr) jp-=4*nr;
+  if (jp<1) jp+=4*nr;
+  phi=(jp-(kshift+1)*0.5)*(M_PI_2/nr);
+  sth=sqrt((1-z)*(1+z));
+  v[0]=sth*cos(phi);
+  v[1]=sth*sin(phi);
+  v[2]=z;
+}
+
+/* put the n stars at s in kd-tree order from the given depth */
+static void
+kdorder(struct skystar *s, unsigned long long n, int depth) {
+  struct skystar t;
+  long long a, b, i, j, m;
+  int axis;
+  double v;
+
+  while (n>1) {
+    /* select the middle star on the axis (Wirth's find) */
+    axis=depth%3;
+    m=(long long) n/2;
+    a=0;
+    b=(long long) n-1;
+    while (a<b) {
+      v=s[m].pos[axis];
+      i=a;
+      j=b;
+      do {
+	while (s[i].pos[axis]<v) i++;
+	while (v<s[j].pos[axis]) j--;
+	if (i<=j) {
+	  t=s[i];
+	  s[i]=s[j];
+	  s[j]=t;
+	  i++;
+	  j--;
+	}
+      } while (i<=j);
+      if (j<m) a=i;
+      if (m<i) b=j;
+    }
+    kdorder(s,(unsigned long long) m,depth+1);
+    s+=m+1;
+    n-=m+1;
+    depth++;
+  }
+}
+
+/* the catalogue text being cut into tiles, and the fields of a line */
+struct skyscan {
+  const char *text;
+  size_t len;
+  struct loadfile_fs isfs;
+  unsigned int lon, lat, nfield;
+  const char **start, **end;
+};
+
+/* the next row at or after *p: its line and its position (haspos is 0
+   if it has none); returns 1 at the end of the text */
+static int
+nextrow(struct skyscan *sc, const char **p, const char **line, size_t *len, double v[3], int *haspos, int *loadon) {
+  const char *eol, *next, *e;
+  unsigned int nf;
+  double lon, lat;
+
+  for (;*p<sc->text+sc->len;*p=next) {
+    if ((eol=memchr(*p,'\n',sc->text+sc->len-*p))==NULL) {
+      eol=next=sc->text+sc->len;
+    } else {
+      next=eol+1;
+    }
+    if (**p=='*') *loadon=1-*loadon;
+    if (**p=='#' || **p=='*' || !*loadon) continue;
+    e=(eol>*p && eol[-1]=='\r' ? eol-1 : eol);
+    nf=loadfile_split(*p,e,&sc->isfs,sc->nfield,sc->start,sc->end);
+    lon=(sc->lon<=nf ? loadfile_atof(sc->start[sc->lon-1],sc->end[sc->lon-1]) : 0.0/0.0);
+    lat=(sc->lat<=nf ? loadfile_atof(sc->start[sc->lat-1],sc->end[sc->lat-1]) : 0.0/0.0);
+    *haspos=(isfinite(lon) && isfinite(lat));
+    if (*haspos) catfile_radec(lon,lat,v);
+    *line=*p;
+    *len=e-*p;
+    *p=next;
+    return 0;
+  }
+  return 1;
+}
+
+int
+skystore_write(const char *filename, const char *text, size_t len, const char *fs,
+	       unsigned int lon, unsigned int lat, int order) {
+  struct skyscan sc;
+  struct skystar *s;
+  unsigned long long npix=12ULL<<(2*order), pix, nstars=0, row, *tileoff, *first, *bytes=NULL, *nin=NULL, size;
+  const char *p, *line;
+  char *map;
+  size_t linelen;
+  double v[3];
+  int fd, haspos, loadon;
+
+  if (!host_le()) {
+    printf("A sky store can only be written on a little-endian machine at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  if (order<0 || order>SKYSTORE_MAXORDER || lon==0 || lat==0) {
+    printf("A sky store needs an order from 0 to %d and the columns of the positions at %s:%d\n",SKYSTORE_MAXORDER,__FILE__,__LINE__);
+    return -1;
+  }
+  sc.text=text;
+  sc.len=len;
+  sc.lon=lon;
+  sc.lat=lat;
+  sc.nfield=(lon>lat ? lon : lat);
+  loadfile_separators(&sc.isfs,fs);
+  if ((sc.start=(const char **) malloc(sizeof(char *)*sc.nfield))==NULL ||
+      (sc.end=(const char **) malloc(sizeof(char *)*sc.nfield))==NULL ||
+      (bytes=(unsigned long long *) calloc(npix,sizeof(unsigned long long)))==NULL ||
+      (nin=(unsigned long long *) calloc(npix,sizeof(unsigned long long)))==NULL) {
+    printf("Unable to allocate the tiles at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+
+  /* count the stars and the bytes of their lines in each tile */
+  loadon=1;
+  for (p=text;nextrow(&sc,&p,&line,&linelen,v,&haspos,&loadon)==0;) {
+    if (!haspos) continue;
+    pix=skystore_pixel(order,v);
+    nin[pix]++;
+    bytes[pix]+=linelen;
+    nstars++;
+  }
+
+  /* lay out the file, the tables first */
+  size=SKYSTORE_HEADER+16*(npix+1);
+  for (pix=0;pix<npix;pix++) {
+    size=ALIGN8(size+sizeof(struct skystar)*nin[pix]+bytes[pix]);
+  }
+  if ((fd=open(filename,O_RDWR|O_CREAT|O_TRUNC,0644))<0 || ftruncate(fd,(off_t) size) ||
+      (map=(char *) mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0))==MAP_FAILED) {
+    printf("Unable to make %s (%s) at %s:%d\n",filename,strerror(errno),__FILE__,__LINE__);
+    return -1;
+  }
+  memcpy(map,SKYSTORE_MAGIC,8);
+  ((unsigned int *) map)[2]=SKYSTORE_VERSION;
+  ((unsigned int *) map)[3]=(unsigned int) order;
+  ((unsigned long long *) map)[2]=nstars;
+  ((unsigned long long *) map)[3]=0;
+  tileoff=(unsigned long long *) (map+SKYSTORE_HEADER);
+  first=tileoff+npix+1;
+  tileoff[0]=SKYSTORE_HEADER+16*(npix+1);
+  first[0]=0;
+  for (pix=0;pix<npix;pix++) {
+    tileoff[pix+1]=ALIGN8(tileoff[pix]+sizeof(struct skystar)*nin[pix]+bytes[pix]);
+    first[pix+1]=first[pix]+nin[pix];
+    /* from here on they count what has been put in the tile */
+    bytes[pix]=sizeof(struct skystar)*nin[pix];
+    nin[pix]=0;
+  }
+
+  /* put each star and its line in its tile */
+  loadon=1;
+  for (p=text, row=0;nextrow(&sc,&p,&line,&linelen,v,&haspos,&loadon)==0;row++) {
+    if (!haspos) continue;
+    pix=skystore_pixel(order,v);
+    s=(struct skystar *) (map+tileoff[pix])+nin[pix]++;
+    memcpy(s->pos,v,sizeof(v));
+    s->row=row;
+    s->line=bytes[pix];
+    s->len=(unsigned int) linelen;
+    s->pad=0;
+    memcpy(map+tileoff[pix]+bytes[pix],line,linelen);
+    bytes[pix]+=linelen;
+  }
+  for (pix=0;pix<npix;pix++) {
+    kdorder((struct skystar *) (map+tileoff[pix]),nin[pix],0);
+  }
+
+  free((void *) sc.start);
+  free((void *) sc.end);
+  free((void *) bytes);
+  free((void *) nin);
+  if (munmap(map,size) || close(fd)) {
+    printf("Unable to write %s (%s) at %s:%d\n",filename,strerror(errno),__FILE__,__LINE__);
+    return -1;
+  }
+  return 0;
+}
+
+struct skystore *
+skystore_open(const char *filename, size_t cachebytes) {
+  struct skystore *ss;
+  struct stat st;
+  char head[SKYSTORE_HEADER];
+
+  if ((ss=(struct skystore *) calloc(1,sizeof(struct skystore)))==NULL) {
+    printf("Unable to allocate a sky store at %s:%d\n",__FILE__,__LINE__);
+    return NULL;
+  }
+  if ((ss->fd=open(filename,O_RDONLY))<0 || fstat(ss->fd,&st) ||
+      read(ss->fd,head,SKYSTORE_HEADER)!=SKYSTORE_HEADER) {
+    printf("Unable to read %s (%s) at %s:%d\n",filename,strerror(errno),__FILE__,__LINE__);
+    goto fail;
+  }
+  ss->order=(int) ((unsigned int *) head)[3];
+  ss->nstars=((unsigned long long *) head)[2];
+  if (memcmp(head,SKYSTORE_MAGIC,8) || ((unsigned int *) head)[2]!=SKYSTORE_VERSION ||
+      ss->order<0 || ss->order>SKYSTORE_MAXORDER || !host_le()) {
+    printf("%s is not a sky store that can be read here at %s:%d\n",filename,__FILE__,__LINE__);
+    goto fail;
+  }
+  ss->npix=12ULL<<(2*ss->order);
+  ss->headlen=SKYSTORE_HEADER+16*(ss->npix+1);
+  if ((size_t) st.st_size<ss->headlen ||
+      (ss->head=mmap(NULL,ss->headlen,PROT_READ,MAP_SHARED,ss->fd,0))==MAP_FAILED) {
+    printf("Unable to map %s at %s:%d\n",filename,__FILE__,__LINE__);
+    ss->head=NULL;
+    goto fail;
+  }
+  ss->tileoff=(const unsigned long long *) ((const char *) ss->head+SKYSTORE_HEADER);
+  ss->first=ss->tileoff+ss->npix+1;
+  if (ss->tileoff[ss->npix]>(unsigned long long) st.st_size) {
+    printf("%s has been cut short at %s:%d\n",filename,__FILE__,__LINE__);
+    goto fail;
+  }
+  ss->cachebytes=cachebytes;
+  ss->pagesize=sysconf(_SC_PAGESIZE);
+  pthread_mutex_init(&ss->lock,NULL);
+  return ss;
+
+ fail:
+  if (ss->head) munmap(ss->head,ss->headlen);
+  if (ss->fd>=0) close(ss->fd);
+  free((void *) ss);
+  return NULL;
+}
+
+void
+skystore_close(struct skystore *ss) {
+  struct skytile *t, *next;
+
+  if (ss==NULL) return;
+  for (t=ss->newest;t;t=next) {
+    next=t->older;
+    munmap(t->map,t->maplen);
+    free((void *) t);
+  }
+  munmap(ss->head,ss->headlen);
+  close(ss->fd);
+  pthread_mutex_destroy(&ss->lock);
+  free((void *) ss);
+}
+
+unsigned long long
+skystore_size(const struct skystore *ss) {
+  return ss->nstars;
+}
+
+/* take the tile out of the list of those used */
+static void
+unlist(struct skystore *ss, struct skytile *t) {
+  if (t->newer) t->newer->older=t->older; else ss->newest=t->older;
+  if (t->older) t->older->newer=t->newer; else ss->oldest=t->newer;
+}
+
+/* map tile pix (or find it mapped already) and pin it as the most
+   recently used; null if it cannot be mapped */
+static struct skytile *
+pintile(struct skystore *ss, unsigned long long pix) {
+  struct skytile *t, **h, *old, *next;
+  unsigned long long start;
+
+  pthread_mutex_lock(&ss->lock);
+  for (t=ss->hash[pix%NHASH];t && t->pix!=pix;t=t->hnext);
+  if (t) {
+    unlist(ss,t);
+  } else if ((t=(struct skytile *) calloc(1,sizeof(struct skytile)))) {
+    start=ss->tileoff[pix]/ss->pagesize*ss->pagesize;
+    t->pix=pix;
+    t->n=ss->first[pix+1]-ss->first[pix];
+    t->maplen=ss->tileoff[pix+1]-start;
+    if ((t->map=mmap(NULL,t->maplen,PROT_READ,MAP_SHARED,ss->fd,(off_t) start))==MAP_FAILED) {
+      printf("Unable to map a tile (%s) at %s:%d\n",strerror(errno),__FILE__,__LINE__);
+      free((void *) t);
+      t=NULL;
+    } else {
+      t->base=(const char *) t->map+(ss->tileoff[pix]-start);
+      t->star=(const struct skystar *) t->base;
+      t->hnext=ss->hash[pix%NHASH];
+      ss->hash[pix%NHASH]=t;
+      ss->mapped+=t->maplen;
+    }
+  }
+  if (t) {
+    t->pins++;
+    t->older=ss->newest;
+    t->newer=NULL;
+    if (ss->newest) ss->newest->newer=t; else ss->oldest=t;
+    ss->newest=t;
+  }
+  /* drop the tiles used longest ago that no query is using */
+  for (old=ss->oldest;old && ss->mapped>ss->cachebytes;old=next) {
+    next=old->newer;
+    if (old->pins>0) continue;
+    for (h=ss->hash+old->pix%NHASH;*h!=old;h=&(*h)->hnext);
+    *h=old->hnext;
+    unlist(ss,old);
+    ss->mapped-=old->maplen;
+    munmap(old->map,old->maplen);
+    free((void *) old);
+  }
+  pthread_mutex_unlock(&ss->lock);
+  return t;
+}
+
+static void
+unpintile(struct skystore *ss, struct skytile *t) {
+  pthread_mutex_lock(&ss->lock);
+  t->pins--;
+  pthread_mutex_unlock(&ss->lock);
+}
+
+/* the angle between two unit vectors */
+static double
+angle(const double a[3], const double b[3]) {
+  double c[3];
+
+  c[0]=a[1]*b[2]-a[2]*b[1];
+  c[1]=a[2]*b[0]-a[0]*b[2];
+  c[2]=a[0]*b[1]-a[1]*b[0];
+  return atan2(sqrt(c[0]*c[0]+c[1]*c[1]+c[2]*c[2]),a[0]*b[0]+a[1]*b[1]+a[2]*b[2]);
+}
+
+/* pin the tiles within reach (an angle) of q under tile pix of the
+   given order */
+static int
+disc(struct skystore *ss, int order, unsigned long long pix, const double q[3], double reach, struct skyquery *qu) {
+  double c[3];
+  int k;
+
+  skystore_centre(order,pix,c);
+  if (angle(c,q)>reach+PIXRAD/(1<<order)) return 0;
+  if (order<ss->order) {
+    for (k=0;k<4;k++) {
+      if (disc(ss,order+1,4*pix+k,q,reach,qu)) return -1;
+    }
+    return 0;
+  }
+  if (ss->first[pix+1]==ss->first[pix]) return 0;
+  if (qu->ntile==qu->tilealloc) {
+    qu->tilealloc=(qu->tilealloc ? 2*qu->tilealloc : 16);
+    if ((qu->tile=(struct skytile **) realloc((void *) qu->tile,sizeof(struct skytile *)*qu->tilealloc))==NULL) {
+      printf("Unable to allocate a query at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+  }
+  if ((qu->tile[qu->ntile]=pintile(ss,pix))==NULL) return -1;
+  qu->ntile++;
+  return 0;
+}
+
+/* the stars of a tile in kd-tree order within range of q */
+static int
+search(const struct skystar *s, unsigned long long n, int depth, const char *base,
+       const double q[3], double range, struct skyquery *qu) {
+  unsigned long long m;
+  double d2, diff;
+
+  while (n>0) {
+    m=n/2;
+    /* (as the range join works it out) */
+    d2=(s[m].pos[0]-q[0])*(s[m].pos[0]-q[0]);
+    d2+=(s[m].pos[1]-q[1])*(s[m].pos[1]-q[1]);
+    d2+=(s[m].pos[2]-q[2])*(s[m].pos[2]-q[2]);
+    if (d2<=range*range) {
+      if (qu->nhit==qu->hitalloc) {
+	qu->hitalloc=(qu->hitalloc ? 2*qu->hitalloc : 64);
+	if ((qu->hit=(struct skyhit *) realloc((void *) qu->hit,sizeof(struct skyhit)*qu->hitalloc))==NULL) {
+	  printf("Unable to allocate a query at %s:%d\n",__FILE__,__LINE__);
+	  return -1;
+	}
+      }
+      qu->hit[qu->nhit].s=s+m;
+      qu->hit[qu->nhit].base=base;
+      qu->hit[qu->nhit++].dist=sqrt(d2);
+    }
+    /* those before the middle are no further along the axis, those after no nearer */
+    diff=q[depth%3]-s[m].pos[depth%3];
+    if (diff<=range && search(s,m,depth+1,base,q,range,qu)) return -1;
+    if (diff<-range) break;
+    s+=m+1;
+    n-=m+1;
+    depth++;
+  }
+  return 0;
+}
+
+/* closest first, then in catalogue order */
+static int
+hitcomp(const void *a, const void *b) {
+  const struct skyhit *ha=(const struct skyhit *) a, *hb=(const struct skyhit *) b;
+
+  if (ha->dist<hb->dist) return -1;
+  if (ha->dist>hb->dist) return 1;
+  return (ha->s->row<hb->s->row ? -1 : (ha->s->row>hb->s->row));
+}
+
+long
+skystore_range(struct skystore *ss, const double q[3], double range, skystore_found found, void *arg) {
+  struct skyquery qu;
+  unsigned long long pix;
+  unsigned int t;
+  size_t k;
+  long retval=0;
+
+  if (!(range>=0) || !isfinite(q[0]+q[1]+q[2])) return 0;
+  memset(&qu,0,sizeof(qu));
+  for (pix=0;retval==0 && pix<12;pix++) {
+    /* (the chord as an angle) */
+    if (disc(ss,0,pix,q,(range<2 ? 2*asin(range/2) : M_PI),&qu)) retval=-1;
+  }
+  for (t=0;retval==0 && t<qu.ntile;t++) {
+    if (search(qu.tile[t]->star,qu.tile[t]->n,0,qu.tile[t]->base,q,range,&qu)) retval=-1;
+  }
+  if (retval==0) {
+    qsort(qu.hit,qu.nhit,sizeof(struct skyhit),hitcomp);
+    for (k=0;k<qu.nhit;k++) {
+      found(arg,qu.hit[k].s,qu.hit[k].dist,qu.hit[k].base+qu.hit[k].s->line);
+    }
+    retval=(long) qu.nhit;
+  }
+  for (t=0;t<qu.ntile;t++) unpintile(ss,qu.tile[t]);
+  free((void *) qu.tile);
+  free((void *) qu.hit);
+  return retval;
+}
@@ -0,0 +1,85 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#ifndef _SKYSTORE_H_
+#define _SKYSTORE_H_
+
+/* A reference catalogue for -eq cut into HEALPix tiles (nested
+   numbering), each tile a kd-tree of its stars laid out flat so that it
+   is used as it is mapped from the file, which is little-endian:
+
+     0  "KDSKY\0\0\0"
+     8  uint32 version, uint32 HEALPix order of the tiles
+    16  uint64 number of stars
+    24  uint64 reserved
+    32  12*4^order+1 uint64 offsets of the tiles, then as many uint64
+        numbers of the first star in each tile
+
+   followed by the tiles, each its stars and then their lines.  A star
+   is its unit vector, its row in the original catalogue (from zero, not
+   counting comments), where its line starts from the start of the tile
+   and how long it is.  The stars of a tile are in kd-tree order: the
+   middle star of a range splits the rest on x, y and z in turn. */
+
+#define SKYSTORE_MAGIC "KDSKY\0\0"
+#define SKYSTORE_VERSION 1
+#define SKYSTORE_HEADER 32
+#define SKYSTORE_MAXORDER 10
+
+struct skystar {
+  double pos[3];
+  unsigned long long row, line;
+  unsigned int len, pad;
+};
+
+struct skystore;
+
+/* the tile of a unit vector at the given order, and the centre of a tile */
+unsigned long long skystore_pixel(int order, const double v[3]);
+void skystore_centre(int order, unsigned long long pix, double v[3]);
+
+/* write a store of the catalogue text in tiles of the given order, with
+   RA/Dec (or l/b) in degrees in columns lon and lat; rows without a
+   position are counted but left out.  The file must be seekable. */
+int skystore_write(const char *filename, const char *text, size_t len, const char *fs,
+		   unsigned int lon, unsigned int lat, int order);
+
+/* open a store, keeping at most cachebytes of tiles mapped (those used
+   longest ago are dropped first); null on error */
+struct skystore *skystore_open(const char *filename, size_t cachebytes);
+void skystore_close(struct skystore *ss);
+unsigned long long skystore_size(const struct skystore *ss);
+
+/* the stars within range (a chord of the unit sphere) of the unit vector
+   q, closest first: each is passed to found with its distance and line,
+   which are only there during the call.  Returns how many there were,
+   or -1 if a tile could not be mapped.  Threads may share the store. */
+typedef void (*skystore_found)(void *arg, const struct skystar *s, double dist, const char *line);
+long skystore_range(struct skystore *ss, const double q[3], double range, skystore_found found, void *arg);
+
+#endif	/* _SKYSTORE_H_ */
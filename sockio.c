@@ -0,0 +1,112 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "sockio.h"
+
+/* the address of the socket at path, or -1 if it is too long */
+static int
+sockaddr(const char *path, struct sockaddr_un *addr) {
+  memset(addr,0,sizeof(*addr));
+  addr->sun_family=AF_UNIX;
+  if (strlen(path)>=sizeof(addr->sun_path)) {
+    printf("The socket name %s is too long at %s:%d\n",path,__FILE__,__LINE__);
+    return -1;
+  }
+  strcpy(addr->sun_path,path);
+  return 0;
+}
+
+int
+sockio_listen(const char *path) {
+  struct sockaddr_un addr;
+  struct stat st;
+  int fd;
+
+  if (sockaddr(path,&addr)) return -1;
+  /* only ever remove an old socket, not some other file */
+  if (stat(path,&st)==0 && S_ISSOCK(st.st_mode)) unlink(path);
+  if ((fd=socket(AF_UNIX,SOCK_STREAM,0))<0 ||
+      bind(fd,(struct sockaddr *) &addr,sizeof(addr)) ||
+      listen(fd,16)) {
+    printf("Unable to listen on %s (%s) at %s:%d\n",path,strerror(errno),__FILE__,__LINE__);
+    if (fd>=0) close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int
+sockio_connect(const char *path) {
+  struct sockaddr_un addr;
+  int fd;
+
+  if (sockaddr(path,&addr)) return -1;
+  if ((fd=socket(AF_UNIX,SOCK_STREAM,0))<0 ||
+      connect(fd,(struct sockaddr *) &addr,sizeof(addr))) {
+    printf("Unable to connect to %s (%s) at %s:%d\n",path,strerror(errno),__FILE__,__LINE__);
+    if (fd>=0) close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int
+sockio_read(FILE *in, void *p, size_t n) {
+  return (n==0 || fread(p,n,1,in)==1 ? 0 : -1);
+}
+
+int
+sockio_le64(FILE *in, unsigned long long *v) {
+  unsigned char b[8];
+  int i;
+
+  if (sockio_read(in,b,8)) return -1;
+  *v=0;
+  for (i=7;i>=0;i--) {
+    *v=(*v<<8)|b[i];
+  }
+  return 0;
+}
+
+int
+sockio_ledouble(FILE *in, double *v) {
+  unsigned long long u;
+
+  if (sockio_le64(in,&u)) return -1;
+  memcpy(v,&u,sizeof(u));
+  return 0;
+}
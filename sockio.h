@@ -0,0 +1,52 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#ifndef _SOCKIO_H_
+#define _SOCKIO_H_
+
+#include <stdio.h>
+
+/* Unix-domain sockets for match_kd -serve and -connect, and the reading
+   side of their records: every number goes over as eight little-endian
+   bytes (see outbuf_le64 and outbuf_ledouble for the writing side). */
+
+#define SOCKIO_MAGIC "KDMSERV"	/* and a zero, eight bytes in all */
+
+/* listen on a socket at path, replacing any socket left there; returns
+   the descriptor or -1 */
+int sockio_listen(const char *path);
+/* connect to the socket at path; returns the descriptor or -1 */
+int sockio_connect(const char *path);
+
+/* read n bytes, a 64-bit integer or a double; 0 on success, -1 at the
+   end of the stream or on an error */
+int sockio_read(FILE *in, void *p, size_t n);
+int sockio_le64(FILE *in, unsigned long long *v);
+int sockio_ledouble(FILE *in, double *v);
+
+#endif	/* _SOCKIO_H_ */
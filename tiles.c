@@ -0,0 +1,522 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#include <math.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "kdtree.h"
+#include "rangejoin.h"
+#include "loadfile.h"
+#include "outbuf.h"
+#include "match_kd.h"
+#include "tiles.h"
+
+#define NTILE 64		/* tiles cut at the first level */
+#define NSUBTILE 16		/* and from a tile too big to match */
+#define TILEDEPTH 8
+#define RUNBUF 16384
+/* a star in a tile, followed by its line */
+struct tilerec {
+  unsigned long long id;
+  double pos[3], radius;
+  unsigned int valid, len;
+};
+/* the output for a star of catalogue 1, merged by key: twice its line
+   number plus one (the comments before it are twice its number) */
+struct tileindex {
+  unsigned long long key, len;
+};
+int dotiles=0;
+double membudget;
+static FILE *tile1[NTILE], *tile2[NTILE], *tileall2, *tileidx;
+static unsigned long long n2total, nidx;
+static unsigned long long *runstart, *runoff;
+static unsigned int nrun, runalloc;
+
+/* a temporary file in $TMPDIR, gone once it is closed */
+static FILE *
+tilefile(void) {
+  const char *dir=getenv("TMPDIR");
+  char *name;
+  FILE *f=NULL;
+  int fd;
+
+  if (dir==NULL || *dir==0) dir="/tmp";
+  if ((name=(char *) malloc(strlen(dir)+20))==NULL) {
+    printf("Unable to allocate a file name at %s:%d\n",__FILE__,__LINE__);
+    return NULL;
+  }
+  sprintf(name,"%s/match_kdXXXXXX",dir);
+  if ((fd=mkstemp(name))<0 || (f=fdopen(fd,"w+"))==NULL) {
+    printf("Unable to make a temporary file in %s (%s) at %s:%d\n",dir,strerror(errno),__FILE__,__LINE__);
+  } else {
+    unlink(name);
+  }
+  free((void *) name);
+  return f;
+}
+
+/* the tile of a position when cut into cells of the given size; each
+   level hashes the cells differently.  Stars off the sky go to tile 0. */
+static unsigned int
+tileof(const double pos[], double cell, int depth, unsigned int ntile) {
+  unsigned long long h=0x9e3779b97f4a7c15ULL*(depth+1);
+  int j;
+
+  for (j=0;j<ndim;j++) {
+    if (!isfinite(pos[j])) return 0;
+    h=(h^(unsigned long long) (long long) floor(pos[j]/cell))*0xff51afd7ed558ccdULL;
+    h^=h>>33;
+  }
+  return h%ntile;
+}
+
+static int
+writerec(FILE *f, struct tilerec *r, const char *line) {
+  if (fwrite(r,sizeof(*r),1,f)!=1 || fwrite(line,1,r->len,f)!=r->len) {
+    printf("Unable to write a tile (%s) at %s:%d\n",strerror(errno),__FILE__,__LINE__);
+    return -1;
+  }
+  return 0;
+}
+
+/* the next star of a tile, its line added to the store; 0 at the end */
+static int
+readrec(FILE *f, struct tilerec *r, struct linestore *ls) {
+  char *line;
+
+  if (fread(r,sizeof(*r),1,f)!=1) return 0;
+  if ((line=reserveline(ls,r->len))==NULL) return -1;
+  if (fread(line,1,r->len,f)!=r->len) {
+    printf("Unable to read a tile at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  ls->len+=r->len;
+  return 1;
+}
+
+/* put a star of catalogue 2 in the tile of its cell and of every
+   neighbouring cell that comes within distance of it */
+static int
+spreadref(FILE *f[], struct tilerec *r, const char *line, double cell, int depth, unsigned int ntile) {
+  unsigned int tiles[27], ntiles=0, t, i, k, m, nk=1;
+  double gap, d2, c, near=distance*(1+1e-6);
+  double npos[3];
+  int j, o;
+
+  for (j=0;j<ndim;j++) {
+    /* never matched */
+    if (!isfinite(r->pos[j])) return 0;
+    nk*=3;
+  }
+  for (k=0;k<nk;k++) {
+    d2=0;
+    for (j=0,m=k;j<ndim;j++,m/=3) {
+      o=(int) (m%3)-1;
+      c=floor(r->pos[j]/cell);
+      /* somewhere inside the neighbouring cell */
+      npos[j]=(c+o+0.5)*cell;
+      gap=(o<0 ? r->pos[j]-c*cell : o>0 ? (c+1)*cell-r->pos[j] : 0);
+      d2+=gap*gap;
+    }
+    if (d2>near*near) continue;
+    t=tileof(npos,cell,depth,ntile);
+    for (i=0;i<ntiles && tiles[i]!=t;i++);
+    if (i<ntiles) continue;
+    tiles[ntiles++]=t;
+    if (writerec(f[t],r,line)) return -1;
+  }
+  return 0;
+}
+
+/* a star for -mem: catalogue 2 stars are spread to the tiles (and kept in
+   order for -n); catalogue 1 stars are numbered and go to one tile */
+int
+tilestar(double pos[], double radius, int valid, const char *line, unsigned int len, int iscat2) {
+  struct tilerec r;
+  int j;
+
+  memset(&r,0,sizeof(r));
+  for (j=0;j<ndim;j++) {
+    r.pos[j]=(valid ? pos[j] : 0.0/0.0);
+  }
+  r.radius=radius;
+  r.valid=valid;
+  r.len=len;
+  if (iscat2) {
+    r.id=n2total++;
+    if (dounique && writerec(tileall2,&r,line)) return -1;
+    return spreadref(tile2,&r,line,4*distance,0,NTILE);
+  }
+  r.id=n1++;
+  return writerec(tile1[tileof(r.pos,4*distance,0,NTILE)],&r,line);
+}
+
+/* where the output for a star of catalogue 1 went, for merging */
+void
+putindex(unsigned long long key, unsigned long long len) {
+  struct tileindex entry;
+
+  entry.key=key;
+  entry.len=len;
+  if (fwrite(&entry,sizeof(entry),1,tileidx)!=1) {
+    printf("Unable to write the index of a tile at %s:%d\n",__FILE__,__LINE__);
+    exit(-1);
+  }
+  nidx++;
+}
+
+/* start a run of output in catalogue 1 order */
+static int
+newrun(void) {
+  if (nrun+1>=runalloc) {
+    runalloc=(runalloc ? 2*runalloc : 64);
+    if ((runstart=(unsigned long long *) realloc((void *) runstart,sizeof(unsigned long long)*runalloc))==NULL ||
+	(runoff=(unsigned long long *) realloc((void *) runoff,sizeof(unsigned long long)*runalloc))==NULL) {
+      printf("Unable to allocate a run at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+  }
+  runstart[nrun]=nidx;
+  runoff[nrun++]=outbuf_tell(&out);
+  return 0;
+}
+
+/* match the stars of catalogue 1 in a tile against those of catalogue 2,
+   cutting it into smaller tiles first if they would not fit in memory;
+   the tile's files are closed */
+static int
+matchtile(FILE *f1, FILE *f2, int depth, double cell) {
+  FILE *sub1[NSUBTILE], *sub2[NSUBTILE];
+  struct tilerec r;
+  off_t size2, largest=0;
+  unsigned int t;
+  int j, ret=0;
+
+  if (ftello(f1)==0) {
+    /* nothing to match */
+  } else if (ftello(f2)>membudget/4 && depth<TILEDEPTH) {
+    /* the cells are no smaller than the distance, but are hashed
+       differently at each level */
+    if (cell/2>=distance) cell/=2;
+    for (t=0;t<NSUBTILE;t++) {
+      if ((sub1[t]=tilefile())==NULL || (sub2[t]=tilefile())==NULL) {
+	return -1;
+      }
+    }
+    rewind(f2);
+    ref->store.len=0;
+    while ((ret=readrec(f2,&r,&ref->store))>0) {
+      if (spreadref(sub2,&r,ref->store.text,cell,depth+1,NSUBTILE)) return -1;
+      ref->store.len=0;
+    }
+    if (ret<0) return -1;
+    rewind(f1);
+    blk->store.len=0;
+    while ((ret=readrec(f1,&r,&blk->store))>0) {
+      if (writerec(sub1[tileof(r.pos,cell,depth+1,NSUBTILE)],&r,blk->store.text)) return -1;
+      blk->store.len=0;
+    }
+    if (ret<0) return -1;
+    size2=ftello(f2);
+    fclose(f1);
+    fclose(f2);
+    for (t=0;t<NSUBTILE;t++) {
+      if (ftello(sub2[t])>largest) largest=ftello(sub2[t]);
+    }
+    /* the stars spread over the new tiles too much (a dense clump
+       within the distance) to be worth cutting again */
+    if (2*largest>size2) depth=TILEDEPTH-1;
+    for (t=0;t<NSUBTILE;t++) {
+      if (matchtile(sub1[t],sub2[t],depth+1,cell)) return -1;
+    }
+    return 0;
+  } else {
+    /* small enough to match in memory */
+    ref->kd=kd_create(ndim);
+    ref->n=0;
+    rewind(f2);
+    ref->store.len=0;
+    while ((ret=readrec(f2,&r,&ref->store))>0) {
+      if (addreference(r.pos,r.radius,ref->store.len-r.len,r.len)) return -1;
+      id2[ref->n-1]=r.id;
+    }
+    if (ret<0) return -1;
+    ref->base=ref->store.text;
+    if ((ref->grid=(dosphere ? rangejoin_zones(ref->n,ref->pos,ref->radius,distance) :
+		 rangejoin_grid(ndim,ref->n,ref->pos,ref->radius,distance)))==NULL) {
+      printf("Unable to index catalogue 2 at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+    if (newrun()) return -1;
+    rewind(f1);
+    blk->store.len=0;
+    blk->n=0;
+    while ((ret=readrec(f1,&r,&blk->store))>0) {
+      for (j=0;j<ndim;j++) {
+	blk->pos[blk->n][j]=r.pos[j];
+      }
+      blk->radius[blk->n]=r.radius;
+      blk->line[blk->n]=blk->store.len-r.len;
+      blk->len[blk->n]=r.len;
+      blk->kind[blk->n]=(r.valid ? LINE_STAR : LINE_EMPTY);
+      blk->id[blk->n]=r.id;
+      if (++blk->n==JOINBLOCK) flushblock();
+    }
+    flushblock();
+    rangejoin_grid_free(ref->grid);
+    ref->grid=NULL;
+    kd_free(ref->kd);
+    ref->kd=NULL;
+  }
+  fclose(f1);
+  fclose(f2);
+  return (ret<0 ? -1 : 0);
+}
+
+/* a run read back a buffer at a time */
+struct runbuf {
+  off_t pos, end;
+  size_t len, at;
+  char buf[RUNBUF];
+};
+
+/* the next n bytes of a run: copied to p, or to the output if p is null */
+static int
+runread(int fd, struct runbuf *rb, char *p, struct outbuf *ob, unsigned long long n) {
+  ssize_t got;
+  size_t k;
+
+  while (n>0) {
+    if (rb->at==rb->len) {
+      k=(rb->end-rb->pos<RUNBUF ? rb->end-rb->pos : RUNBUF);
+      if (k==0 || (got=pread(fd,rb->buf,k,rb->pos))<=0) {
+	printf("Unable to read back a tile at %s:%d\n",__FILE__,__LINE__);
+	return -1;
+      }
+      rb->pos+=got;
+      rb->len=got;
+      rb->at=0;
+    }
+    k=rb->len-rb->at;
+    if (k>n) k=n;
+    if (p) {
+      memcpy(p,rb->buf+rb->at,k);
+      p+=k;
+    } else {
+      outbuf_write(ob,rb->buf+rb->at,k);
+    }
+    rb->at+=k;
+    n-=k;
+  }
+  return 0;
+}
+
+/* merge the runs of output back into catalogue 1 order, smallest key
+   first off a heap of the runs */
+static int
+mergeruns(int idxfd, int resfd, struct outbuf *dest) {
+  struct runbuf *idx, *text;
+  struct tileindex *head;
+  unsigned int *heap, nheap=0, r, i, c, top;
+
+  runstart[nrun]=nidx;
+  runoff[nrun]=outbuf_tell(&out);
+  if ((idx=(struct runbuf *) malloc(sizeof(struct runbuf)*nrun))==NULL ||
+      (text=(struct runbuf *) malloc(sizeof(struct runbuf)*nrun))==NULL ||
+      (head=(struct tileindex *) malloc(sizeof(struct tileindex)*nrun))==NULL ||
+      (heap=(unsigned int *) malloc(sizeof(unsigned int)*nrun))==NULL) {
+    printf("Unable to allocate the runs at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  for (r=0;r<nrun;r++) {
+    idx[r].pos=runstart[r]*sizeof(struct tileindex);
+    idx[r].end=runstart[r+1]*sizeof(struct tileindex);
+    text[r].pos=runoff[r];
+    text[r].end=runoff[r+1];
+    idx[r].len=idx[r].at=text[r].len=text[r].at=0;
+    if (idx[r].pos<idx[r].end) {
+      if (runread(idxfd,idx+r,(char *) (head+r),NULL,sizeof(*head))) return -1;
+      for (i=nheap++;i>0 && head[heap[(i-1)/2]].key>head[r].key;i=(i-1)/2) {
+	heap[i]=heap[(i-1)/2];
+      }
+      heap[i]=r;
+    }
+  }
+  while (nheap>0) {
+    top=heap[0];
+    if (runread(resfd,text+top,NULL,dest,head[top].len)) return -1;
+    if (idx[top].pos<idx[top].end || idx[top].at<idx[top].len) {
+      if (runread(idxfd,idx+top,(char *) (head+top),NULL,sizeof(*head))) return -1;
+    } else {
+      top=heap[--nheap];
+    }
+    /* back down the heap from the root */
+    for (i=0;(c=2*i+1)<nheap;i=c) {
+      if (c+1<nheap && head[heap[c+1]].key<head[heap[c]].key) c++;
+      if (head[heap[c]].key>=head[top].key) break;
+      heap[i]=heap[c];
+    }
+    if (nheap>0) heap[i]=top;
+  }
+  free((void *) idx);
+  free((void *) text);
+  free((void *) head);
+  free((void *) heap);
+  return 0;
+}
+
+/* -mem: cut both catalogues into tiles, match them a tile at a time and
+   merge the output; for -n the stars of catalogue 2 are kept in order too */
+int
+matchtiles(char *filename1, unsigned int cols1[], char *names1[], const char *fs1,
+	   char *filename2, unsigned int cols2[], char *names2[], const char *fs2) {
+  FILE *in, *raw, *results;
+  struct outbuf final;
+  struct tilerec r;
+  struct loadfile_fs isfs;
+  char *buffer=NULL;
+  size_t bufalloc=0;
+  ssize_t len;
+  double pos[3], radius;
+  unsigned int t, nfound;
+  int loadon, type, ret;
+
+  dotiles=1;
+  for (t=0;t<NTILE;t++) {
+    if ((tile1[t]=tilefile())==NULL || (tile2[t]=tilefile())==NULL) {
+      return -1;
+    }
+  }
+  if ((tileidx=tilefile())==NULL || (results=tilefile())==NULL ||
+      (dounique && (tileall2=tilefile())==NULL)) {
+    return -1;
+  }
+
+  /* catalogue 2 into the tiles; its comments are printed first */
+  if ((in=opencatalogue(filename2,&raw))==NULL) {
+    return -1;
+  }
+  if ((type=isbinary(in))) {
+    if (readbinary(in,type,cols2,names2,1)) return -1;
+  } else if (names2[0] || names2[1] || names2[2]) {
+    printf("Columns must be given by number for a text catalogue at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  } else {
+    loadon=1;
+    loadfile_separators(&isfs,fs2);
+    while ((len=getline(&buffer,&bufalloc,in))>0) {
+      if (buffer[0]=='*') loadon=1-loadon;
+      if (buffer[0]=='#' || buffer[0]=='*' || !loadon) {
+	if (!dobinary) outbuf_write(&out,buffer,len);
+	continue;
+      }
+      if (buffer[len-1]=='\n') len--;
+      parsepos(buffer,buffer+len,&isfs,fieldstart,fieldend,cols2,pos,&radius,dotransform2,transform2);
+      if (tilestar(pos,radius,1,buffer,len,1)) return -1;
+    }
+  }
+  closecatalogue(in,raw);
+  if (dounique && (matched2=(unsigned char *) calloc(n2total/8+1,1))==NULL) {
+    printf("Unable to allocate catalogue 2 at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+
+  /* from here the output goes to a file of runs; the comments in
+     catalogue 1 are a run of their own, each keyed to go before the
+     next star */
+  final=out;
+  if (outbuf_open(&out,fileno(results),0) || newrun()) {
+    return -1;
+  }
+  if ((in=opencatalogue(filename1,&raw))==NULL) {
+    return -1;
+  }
+  if ((type=isbinary(in))) {
+    if (readbinary(in,type,cols1,names1,0)) return -1;
+  } else if (names1[0] || names1[1] || names1[2]) {
+    printf("Columns must be given by number for a text catalogue at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  } else {
+    loadon=1;
+    loadfile_separators(&isfs,fs1);
+    while ((len=getline(&buffer,&bufalloc,in))>0) {
+      if (buffer[0]=='*') loadon=1-loadon;
+      if (buffer[0]=='#' || buffer[0]=='*' || !loadon) {
+	if (!dobinary) {
+	  outbuf_write(&out,buffer,len);
+	  putindex(2*n1,len);
+	}
+	continue;
+      }
+      if (buffer[len-1]=='\n') len--;
+      nfound=parsepos(buffer,buffer+len,&isfs,fieldstart,fieldend,cols1,pos,&radius,dotransform1,transform1);
+      if (tilestar(pos,radius,(nfound>0),buffer,len,0)) return -1;
+    }
+  }
+  closecatalogue(in,raw);
+  free((void *) buffer);
+
+  for (t=0;t<NTILE;t++) {
+    if (matchtile(tile1[t],tile2[t],0,4*distance)) return -1;
+  }
+  if (fflush(tileidx) || outbuf_flush(&out)) {
+    printf("Unable to write the matches of the tiles at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  ret=mergeruns(fileno(tileidx),out.fd,&final);
+  outbuf_close(&out);
+  out=final;
+  fclose(results);
+  fclose(tileidx);
+  if (ret) return -1;
+
+  if (dounique) {
+    /* the stars of catalogue 2 outside the distance, in order */
+    rewind(tileall2);
+    ref->store.len=0;
+    while ((ret=readrec(tileall2,&r,&ref->store))>0) {
+      if (!ISMATCHED(r.id)) {
+	if (dobinary) {
+	  putrecord(&out,~0ULL,r.id,0.0/0.0);
+	} else {
+	  outbuf_write(&out,ref->store.text,r.len);
+	  outbuf_putc(&out,'\n');
+	}
+      }
+      ref->store.len=0;
+    }
+    fclose(tileall2);
+    if (ret<0) return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,52 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#ifndef _TILES_H_
+#define _TILES_H_
+
+/* -mem: both catalogues are cut into tiles on disk and matched a tile at
+   a time.  A tile holds the catalogue 1 stars of some cells and every
+   catalogue 2 star within distance of those cells; a tile too big for
+   the memory given is cut again into smaller cells.  Each tile's results
+   go to a temporary file as a run in catalogue 1 order, and the runs are
+   merged at the end. */
+extern int dotiles;
+/* -mem: bytes of catalogue 2 to match in memory at a time */
+extern double membudget;
+
+/* where the output for a star of catalogue 1 went, for merging */
+void putindex(unsigned long long key, unsigned long long len);
+/* a star for -mem: catalogue 2 stars are spread to the tiles (and kept in
+   order for -n); catalogue 1 stars are numbered and go to one tile */
+int tilestar(double pos[], double radius, int valid, const char *line, unsigned int len, int iscat2);
+/* cut both catalogues into tiles, match them a tile at a time and merge
+   the output; for -n the stars of catalogue 2 are kept in order too */
+int matchtiles(char *filename1, unsigned int cols1[], char *names1[], const char *fs1,
+	       char *filename2, unsigned int cols2[], char *names2[], const char *fs2);
+
+#endif	/* _TILES_H_ */
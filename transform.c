@@ -30,19 +30,148 @@ OF SUCH DAMAGE.
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "outbuf.h"
+#include "ring.h"
+
+#define MAXCOLUMNS 100
+/* The lines go through three threads in batches: one reads and splits
+   them, one transforms and formats the positions and one writes the
+   output.  The batches go round through rings. */
+#define BATCH 16384
+#define NBATCH 4
+#define LINE_EMPTY 0		/* no fields: not printed */
+#define LINE_POS 1
+#define LINE_COMMENT 2		/* printed as it is */
+struct batch {
+  char *text;			/* the lines as read, end to end */
+  size_t len, alloc;
+  size_t line[BATCH];
+  unsigned int n;
+  int kind[BATCH];
+  double pos[BATCH][2];
+  struct outbuf out;
+};
+
+unsigned int cols[]={1,2}, ncolumns=2;
+double transform[6], ra_c, dec_c;
+int dotransform=0, doimage=0;
+char *fs;
+FILE *in;
+struct outbuf out;
+struct ring empty, full, formatted;
+
+/* read the lines into batches and pick out the coordinates */
+void *
+readlines(void *arg) {
+  struct batch *b=(struct batch *) ring_pop(&empty);
+  char buffer[1024], copy[1024], *inputstring, **ap, *argv2[MAXCOLUMNS];
+  size_t len;
+  unsigned int j;
+
+  while (fgets(buffer,1023,in)) {
+    len=strlen(buffer);
+    if (b->len+len+1>b->alloc) {
+      b->alloc=2*(b->len+len+1);
+      if ((b->text=(char *) realloc((void *) b->text,b->alloc))==NULL) {
+	printf("Unable to allocate a batch at %s:%d\n",__FILE__,__LINE__);
+	exit(-1);
+      }
+    }
+    b->line[b->n]=b->len;
+    memcpy(b->text+b->len,buffer,len+1);
+    b->len+=len+1;
+    if (buffer[0]=='#') {
+      b->kind[b->n]=LINE_COMMENT;
+    } else {
+      memcpy(copy,buffer,len+1);
+      inputstring=copy;
+      /* break line into up to MAXCOLUMNS columns */
+      for (ap = argv2; (*ap = strsep(&inputstring, fs)) != NULL;)
+	if (**ap != '\0')
+	  if (++ap >= &argv2[MAXCOLUMNS])
+	    break;
+      /* were there any tokens? */
+      if (ap>argv2) {
+	b->kind[b->n]=LINE_POS;
+	/* assign columns to the data arrays; missing values given nan */
+	for (j=0;j<ncolumns;j++) {
+	  b->pos[b->n][j]=(argv2+cols[j]<=ap ? atof(argv2[cols[j]-1]) : 0.0/0.0);
+	}
+      } else {
+	b->kind[b->n]=LINE_EMPTY;
+      }
+    }
+    if (++b->n==BATCH) {
+      ring_push(&full,b);
+      b=(struct batch *) ring_pop(&empty);
+    }
+  }
+  ring_push(&full,b);
+  ring_close(&full);
+  return NULL;
+}
+
+/* transform the positions of a batch and format its output */
+void
+transformbatch(struct batch *b) {
+  double *pos, dumx, dumy;
+  const char *buffer;
+  unsigned int i;
+
+  for (i=0;i<b->n;i++) {
+    buffer=b->text+b->line[i];
+    pos=b->pos[i];
+    if (b->kind[i]==LINE_COMMENT) {
+      outbuf_puts(&b->out,buffer);
+    } else if (b->kind[i]==LINE_POS) {
+      if (doimage) {
+	pos[0]*=M_PI/180.0; pos[1]*=M_PI/180.0;
+	dumy=acos(cos(pos[1])*cos(dec_c)*cos(pos[0]-ra_c)+sin(pos[1])*sin(dec_c));
+	dumx=atan2(sin(pos[1])-cos(dumy)*sin(dec_c),cos(pos[1])*sin(pos[0]-ra_c)*cos(dec_c));
+	dumy*=180.0*3600.0/M_PI;
+	pos[0]=dumy*cos(dumx);
+	pos[1]=dumy*sin(dumx);
+      }
+      if (dotransform) {
+	dumx=pos[0]*transform[0]+pos[1]*transform[1]+transform[2];
+	pos[1]=pos[0]*transform[3]+pos[1]*transform[4]+transform[5];
+	pos[0]=dumx;
+      }
+      if (!isnan(pos[0]) && !isnan(pos[1])) {
+	outbuf_fixed(&b->out,pos[0],8,4);
+	outbuf_putc(&b->out,' ');
+	outbuf_fixed(&b->out,pos[1],8,4);
+	outbuf_putc(&b->out,' ');
+	outbuf_puts(&b->out,buffer);
+      }
+    }
+  }
+}
+
+/* write out the formatted batches and hand them back to the reader */
+void *
+writebatches(void *arg) {
+  struct batch *b;
+
+  while ((b=(struct batch *) ring_pop(&formatted))) {
+    outbuf_write(&out,b->out.buf,b->out.len);
+    b->out.len=0;
+    b->n=0;
+    b->len=0;
+    ring_push(&empty,b);
+  }
+  return NULL;
+}
 
 int
 main(int argc, char *argv[])
 {
-  unsigned int n1, j;
-  unsigned int cols[]={1,2}, ncolumns=2;
+  unsigned int j;
   char **argptr, *filename=NULL;
-  double pos[2], transform[6], dumx, dumy, ra_c,dec_c;
-#define MAXCOLUMNS 100
-  char *fs, *inputstring, **ap, *argv2[MAXCOLUMNS];
-  FILE *in;
-  char buffer[1024];
-  int dotransform=0, doimage=0;
+  struct batch *b;
+  pthread_t readtid, writetid;
 
   if (argc<2) {
     printf("Format:\n\n   transform file1\n\n\
@@ -105,41 +234,37 @@ main(int argc, char *argv[])
     in=stdin;
   }
 
-  while (fgets(buffer,1023,in)) {
-    if (buffer[0]=='#') {
-      fputs(buffer,stdout);
-    } else {
-      inputstring=strdup(buffer);
-      /* break line into up to MAXCOLUMNS columns */
-      for (ap = argv2; (*ap = strsep(&inputstring, fs)) != NULL;)
-	if (**ap != '\0')
-	  if (++ap >= &argv2[MAXCOLUMNS])
-	    break;
-      /* were there any tokens? */
-      if (ap>argv2) {
-	/* assign columns to the data arrays; missing values given nan */
-	for (j=0;j<ncolumns;j++) {
-	  pos[j]=(argv2+cols[j]<=ap ? atof(argv2[cols[j]-1]) : 0.0/0.0);
-	}
-	if (doimage) {
-	  pos[0]*=M_PI/180.0; pos[1]*=M_PI/180.0;
-	  dumy=acos(cos(pos[1])*cos(dec_c)*cos(pos[0]-ra_c)+sin(pos[1])*sin(dec_c));
-	  dumx=atan2(sin(pos[1])-cos(dumy)*sin(dec_c),cos(pos[1])*sin(pos[0]-ra_c)*cos(dec_c));
-	  dumy*=180.0*3600.0/M_PI;
-	  pos[0]=dumy*cos(dumx);
-	  pos[1]=dumy*sin(dumx);
-	}
-	if (dotransform) {
-	  dumx=pos[0]*transform[0]+pos[1]*transform[1]+transform[2];
-	  pos[1]=pos[0]*transform[3]+pos[1]*transform[4]+transform[5];
-	  pos[0]=dumx;
-	}
-	if (!isnan(pos[0]) && !isnan(pos[1]))
-	  printf("%8.4f %8.4f %s",pos[0],pos[1],buffer);
-      }
-      free((void *) inputstring);
+  if (outbuf_open(&out,STDOUT_FILENO,0) ||
+      ring_init(&empty,NBATCH) || ring_init(&full,NBATCH) || ring_init(&formatted,NBATCH)) {
+    return -1;
+  }
+  for (j=0;j<NBATCH;j++) {
+    if ((b=(struct batch *) calloc(1,sizeof(struct batch)))==NULL ||
+	outbuf_open(&b->out,-1,0)) {
+      printf("Unable to allocate a batch at %s:%d\n",__FILE__,__LINE__);
+      return -1;
     }
+    ring_push(&empty,b);
+  }
+  if (pthread_create(&readtid,NULL,readlines,NULL) ||
+      pthread_create(&writetid,NULL,writebatches,NULL)) {
+    printf("Unable to start the threads at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  while ((b=(struct batch *) ring_pop(&full))) {
+    transformbatch(b);
+    ring_push(&formatted,b);
+  }
+  ring_close(&formatted);
+  pthread_join(readtid,NULL);
+  pthread_join(writetid,NULL);
+  for (j=0;j<NBATCH;j++) {
+    b=(struct batch *) ring_pop(&empty);
+    outbuf_close(&b->out);
+    free((void *) b->text);
+    free((void *) b);
   }
+  outbuf_close(&out);
   if (in!=stdin) fclose(in);
   free ( (void *) fs);
 
@@ -30,14 +30,31 @@ OF SUCH DAMAGE.
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "kdtree.h"
 #include "loadfile.h"
 #include "calctransform.h"
+#include "footprint.h"
 
 
 unsigned int n1, n2;
 double *xp1, *yp1, *xp2, *yp2;
 int listswapped=0, verbose=0, noswap=0, matching_pairs;
+/* -prior: a rough transformation from 1 to 2 whose overlap of the two
+   fields (widened by -margin) is all that is searched, and the numbers
+   the points kept had in their files */
+int doprior=0, *id1, *id2;
+double prior[6], margin=0;
+/* -shell: the triangles among the brightest stars (by -mag1 and -mag2)
+   are matched first, in shells of stars that double in size */
+int shell=0;
+/* -near: instead of every triangle, only those of a star with two of
+   its k nearest neighbours (between -scale lo and hi away), each once
+   and in order of their faintest star so that a shell is a run of them */
+int near=0, *local1, *local2;
+long nlocal1, nlocal2;
+double scalemin=0, scalemax=HUGE_VAL;
 struct kdtree *kd_good;
 double dist_cut=1e-5, trans_cut=1e-3, param2_factor=1000;
 double bestcoeff[6];
@@ -49,6 +66,12 @@ struct pair_data {
   int i, j, k;
 } pdata;
 
+/* the number point i of a list had in its file */
+int
+pointnumber(const int *id, int i) {
+  return (id ? id[i] : i);
+}
+
 int
 dcomp(const void *a, const void *b) {
   if (*((double *) a) <*((double *) b)) return 1;
@@ -119,11 +142,11 @@ addtriangle(double *param, int *tridata) {
 	if (verbose>=0) {
 	  printf("Triangle pair with matching x-transform: x2= %g x1 + %g y1 + %g: {",pos[0],pos[1],pos[2]*param2_factor);
 	  for (i=0;i<3;i++) {
-	    printf(" %d",data[i]);
+	    printf(" %d",pointnumber(listswapped ? id2 : id1,data[i]));
 	  }
 	  printf("} -> {");
 	  for (i=3;i<6;i++) {
-	    printf(" %d",data[i]);
+	    printf(" %d",pointnumber(listswapped ? id1 : id2,data[i]));
 	  }
 	  printf("}\n");
 	}
@@ -241,13 +264,14 @@ triangleoutput(int ih, int jh, int kh, int iah, int jah, int kah) {
     /* output the pair information */
     if (verbose>1) {
       for (i=0;i<3;i++) {
-	printf("Pair #%d %3d - %3d %10.4f ; %3d - %3d %10.4f\n",i,pb[i].i,pb[i].j,pb[i].length,pa[i].i,pa[i].j,pa[i].length);
+	printf("Pair #%d %3d - %3d %10.4f ; %3d - %3d %10.4f\n",i,pointnumber(id2,pb[i].i),pointnumber(id2,pb[i].j),pb[i].length,pointnumber(id1,pa[i].i),pointnumber(id1,pa[i].j),pa[i].length);
       }
     }
 
     /* output the point correspondances */
     if (verbose>0) {
-      printf("{%d %d %d} -> {%d %d %d}\n",index2[0],index2[1],index2[2],index1[0],index1[1],index1[2]);
+      printf("{%d %d %d} -> {%d %d %d}\n",pointnumber(id2,index2[0]),pointnumber(id2,index2[1]),pointnumber(id2,index2[2]),
+	     pointnumber(id1,index1[0]),pointnumber(id1,index1[1]),pointnumber(id1,index1[2]));
     }
 
     /* calculate forward transformation */
@@ -283,12 +307,13 @@ triangleoutput(int ih, int jh, int kh, int iah, int jah, int kah) {
     /* output the pair information */
     if (verbose>1) {
       for (i=0;i<3;i++) {
-	printf("Pair #%d %3d - %3d %10.4f ; %3d - %3d %10.4f\n",i,pa[i].i,pa[i].j,pa[i].length,pb[i].i,pb[i].j,pb[i].length);
+	printf("Pair #%d %3d - %3d %10.4f ; %3d - %3d %10.4f\n",i,pointnumber(id1,pa[i].i),pointnumber(id1,pa[i].j),pa[i].length,pointnumber(id2,pb[i].i),pointnumber(id2,pb[i].j),pb[i].length);
       }
     }
     /* output the point correspondances */
     if (verbose>0) {
-      printf("{%d %d %d} -> {%d %d %d}\n",index1[0],index1[1],index1[2],index2[0],index2[1],index2[2]);
+      printf("{%d %d %d} -> {%d %d %d}\n",pointnumber(id1,index1[0]),pointnumber(id1,index1[1]),pointnumber(id1,index1[2]),
+	     pointnumber(id2,index2[0]),pointnumber(id2,index2[1]),pointnumber(id2,index2[2]));
     }
 
     /* calculate forward transformation */
@@ -324,18 +349,446 @@ triangleoutput(int ih, int jh, int kh, int iah, int jah, int kah) {
 }
 
 
+/* the shape of triangle i, j, k of a list: the ratios of its two shorter
+   sides to its longest; -1 if the shortest is less than a pixel */
+int
+triangleshape(const double xp[], const double yp[], int i, int j, int k, double ratioarray[2]) {
+  double la[3];
 
+  /* calculate side lengths */
+  la[0]=hypot(xp[i]-xp[j],yp[i]-yp[j]);
+  la[1]=hypot(xp[j]-xp[k],yp[j]-yp[k]);
+  la[2]=hypot(xp[i]-xp[k],yp[i]-yp[k]);
+  /* sort them */
+  qsort((void *) la,3,sizeof(double),dcomp);
+  if (la[2]<1) return -1;
+  ratioarray[0]=la[1]/la[0];
+  ratioarray[1]=la[2]/la[0];
+  return 0;
+}
+
+/* find the triangles of the short list in kd with the shape of triangle
+   i, j, k of the long list; 1 once there are enough matching transforms */
 int
-main(int argc, char *argv[])
-{
-  int i, j, k, max_matches=20;
+matchtriangle(struct kdtree *kd, const double ratioarray[2], int i, int j, int k, int max_matches) {
+  struct kdres *res;
+  double pos[2], diff;
+  int *data;
+
+  res=kd_nearest_range(kd,ratioarray,dist_cut);
+  /* if there are some triangles, then tell us about them */
+  while( !kd_res_end( res ) && matching_pairs<max_matches) {
+    /* get the data and position of the current result item */
+    data = (int*)kd_res_item( res, pos );
+    if (verbose>0) { 
+      diff=hypot(pos[0]-ratioarray[0],pos[1]-ratioarray[1]);
+      printf("# diff= %g\n",diff); 
+    }
+    triangleoutput(i,j,k,data[0],data[1],data[2]);
+    /* go to the next entry */
+    kd_res_next( res );
+  }
+  /* free the results structure */
+  kd_res_free(res);
+  return (matching_pairs>=max_matches);
+}
+
+/* add triangle i, j, k of the short list to kd (unless it is too small) */
+int
+inserttriangle(struct kdtree *kd, int i, int j, int k) {
+  double ratioarray[2];
   int *data;
-  double la[3], diff, ratioarray[2], pos[2],  atof();
+
+  if (triangleshape(xp1,yp1,i,j,k,ratioarray)) return 0;
+  if ((data=(int *) malloc(sizeof(int)*3))==NULL) {
+    printf("Unable to allocate data at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  data[0]=i; data[1]=j; data[2]=k;
+  if (kd_insert(kd, ratioarray, (void *) data)) {
+    printf("Unable to insert point into the tree at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  return 0;
+}
+
+int
+localcomp(const void *a, const void *b) {
+  const int *p=(const int *) a, *q=(const int *) b;
+  int i;
+
+  for (i=2;i>=0;i--) {
+    if (p[i]!=q[i]) return (p[i]<q[i] ? -1 : 1);
+  }
+  return 0;
+}
+
+/* -near: the local triangles of the n stars of a list into tri, each as
+   its three stars in increasing order; returns how many, or -1 */
+long
+localtriangles(int n, const double xp[], const double yp[], int **tri) {
   struct kdtree *kd;
   struct kdres *res;
-  unsigned int cols1[]={1,2}, cols2[]={1,2};
+  double pos[2], npos[2], d;
+  long ntri=0, m, i;
+  int c, a, b, u, nnb, num, found, *nb, *t;
+  size_t star;
+
+  kd=kd_create(2);
+  for (c=0;c<n;c++) {
+    pos[0]=xp[c]; pos[1]=yp[c];
+    if (kd_insert(kd, pos, (void *) (size_t) c)) {
+      printf("Unable to insert point into the tree at %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+  }
+  if ((nb=(int *) malloc(sizeof(int)*(near+1)))==NULL ||
+      (*tri=(int *) malloc(sizeof(int)*3*((long) n*near*(near-1)/2+1)))==NULL) {
+    printf("Unable to allocate the local triangles at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  for (c=0;c<n;c++) {
+    /* (the star itself is usually the nearest); those closer than
+       -scale lo do not count, so look further until there are k from lo
+       to hi away or there are no more */
+    pos[0]=xp[c]; pos[1]=yp[c];
+    for (num=near+1;;num*=2) {
+      if ((res=kd_nearest_n(kd,pos,num))==NULL) {
+	printf("Unable to find the neighbours of a star at %s:%d\n",__FILE__,__LINE__);
+	return -1;
+      }
+      for (nnb=0, d=0;!kd_res_end(res);kd_res_next(res)) {
+	star=(size_t) kd_res_item(res,npos);
+	d=hypot(npos[0]-pos[0],npos[1]-pos[1]);
+	if ((int) star==c || d<scalemin || d>scalemax || nnb==near) continue;
+	nb[nnb++]=(int) star;
+      }
+      found=kd_res_size(res);
+      kd_res_free(res);
+      if (nnb==near || found<num || d>scalemax || num>=n) break;
+    }
+    for (a=0;a<nnb;a++) {
+      for (b=a+1;b<nnb;b++) {
+	t=*tri+3*ntri++;
+	t[0]=c; t[1]=nb[a]; t[2]=nb[b];
+	/* sort the stars */
+	if (t[0]>t[1]) { u=t[0]; t[0]=t[1]; t[1]=u; }
+	if (t[1]>t[2]) { u=t[1]; t[1]=t[2]; t[2]=u; }
+	if (t[0]>t[1]) { u=t[0]; t[0]=t[1]; t[1]=u; }
+      }
+    }
+  }
+  /* a triangle may be local to each of its stars */
+  qsort((void *) *tri,ntri,sizeof(int)*3,localcomp);
+  for (i=0, m=0;i<ntri;i++) {
+    if (m>0 && localcomp(*tri+3*i,*tri+3*(m-1))==0) continue;
+    memmove(*tri+3*m++,*tri+3*i,sizeof(int)*3);
+  }
+  free((void *) nb);
+  kd_free(kd);
+  return m;
+}
+
+/* the first of the ntri local triangles in tri whose faintest star is a
+   or fainter */
+long
+localstart(const int *tri, long ntri, int a) {
+  long lo=0, hi=ntri, mid;
+
+  while (lo<hi) {
+    mid=(lo+hi)/2;
+    if (tri[3*mid+2]<a) lo=mid+1; else hi=mid;
+  }
+  return lo;
+}
+
+/* -shell: add the triangles of the short list whose faintest star is
+   one of a to b-1 to kd */
+int
+addshell(struct kdtree *kd, int a, int b) {
+  long t;
+  int i, j, k;
+
+  if (near) {
+    for (t=localstart(local1,nlocal1,a);t<nlocal1 && local1[3*t+2]<b;t++) {
+      if (inserttriangle(kd,local1[3*t],local1[3*t+1],local1[3*t+2])) return -1;
+    }
+    return 0;
+  }
+  for (k=a;k<b;k++) {
+    for (j=1;j<k;j++) {
+      for (i=0;i<j;i++) {
+	if (inserttriangle(kd,i,j,k)) return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* match the triangles of the long list whose faintest star is one of a
+   to b-1 against kd; 1 once there are enough matching transforms */
+int
+matchshell(struct kdtree *kd, int a, int b, int max_matches) {
+  double ratioarray[2];
+  long t;
+  int i, j, k;
+
+  if (near) {
+    for (t=localstart(local2,nlocal2,a);t<nlocal2 && local2[3*t+2]<b;t++) {
+      i=local2[3*t]; j=local2[3*t+1]; k=local2[3*t+2];
+      if (triangleshape(xp2,yp2,i,j,k,ratioarray)) continue;
+      if (matchtriangle(kd,ratioarray,i,j,k,max_matches)) return 1;
+    }
+    return 0;
+  }
+  for (k=a;k<b;k++) {
+    for (j=1;j<k;j++) {
+      for (i=0;i<j;i++) {
+	if (triangleshape(xp2,yp2,i,j,k,ratioarray)) continue;
+	if (matchtriangle(kd,ratioarray,i,j,k,max_matches)) return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/* -mag1 and -mag2: a star of a list, to be sorted by brightness */
+struct brightness {
+  double mag, x, y;
+  int id;
+};
+
+int
+brightcomp(const void *a, const void *b) {
+  const struct brightness *p=(const struct brightness *) a, *q=(const struct brightness *) b;
+
+  /* (stars without a magnitude go last) */
+  if (p->mag<q->mag || (p->mag==p->mag && q->mag!=q->mag)) return -1;
+  if (p->mag>q->mag || (p->mag!=p->mag && q->mag==q->mag)) return 1;
+  return p->id-q->id;
+}
+
+/* put the brightest of the n stars of a list first; mag is in the order
+   of the file, and id gets the number each star had there */
+int
+sortbymag(int n, double xp[], double yp[], const double mag[], int **id) {
+  struct brightness *b;
+  int i;
+
+  if ((*id==NULL && (*id=(int *) malloc(sizeof(int)*(n+1)))==NULL) ||
+      (b=(struct brightness *) malloc(sizeof(struct brightness)*(n+1)))==NULL) {
+    printf("Unable to allocate the magnitudes at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  for (i=0;i<n;i++) {
+    /* (the stars outside the overlap of -prior are gone already) */
+    b[i].id=(doprior ? (*id)[i] : i);
+    b[i].mag=mag[b[i].id];
+    b[i].x=xp[i];
+    b[i].y=yp[i];
+  }
+  qsort((void *) b,n,sizeof(struct brightness),brightcomp);
+  for (i=0;i<n;i++) {
+    (*id)[i]=b[i].id;
+    xp[i]=b[i].x;
+    yp[i]=b[i].y;
+  }
+  free((void *) b);
+  return 0;
+}
+
+
+/* -j: the full search is split among threads by rank in the order of
+   the loops, the first triangle of each share found from its rank by the
+   combinatorial number system.  The threads shape (and look up) the
+   triangles of a batch; the tree is built and the matches are taken
+   here in rank order, so everything is as it would be on one thread. */
+#define MAXTHREADS 256
+#define RANKBLOCK 65536		/* triangles to a thread in a batch */
+int nthreads=1;
+
+struct rankfound {
+  int *data;
+  double diff;
+};
+
+struct rankwork {
+  unsigned long long a, b;	/* the ranks */
+  int n;			/* stars in the list */
+  const double *xp, *yp;
+  struct kdtree *kd;		/* to look them up in, or null */
+  int tri[3*RANKBLOCK];		/* the stars of each */
+  double shape[2*RANKBLOCK];	/* nan for a triangle that is skipped */
+  unsigned long nfound[RANKBLOCK];	/* the end of the matches of each */
+  struct rankfound *found;
+  unsigned long foundalloc;
+  int error;
+};
+struct rankwork *rankwork;
+
+/* n choose t */
+unsigned long long
+binomial(int n, int t) {
+  unsigned long long c=1;
+  int i;
+
+  if (t<0 || n<t) return 0;
+  for (i=0;i<t;i++) c=c*(n-i)/(i+1);
+  return c;
+}
+
+/* the triangle of rank r among those of n stars, in the order of the loops */
+void
+unrank(unsigned long long r, int n, int c[3]) {
+  unsigned long long count;
+  int p, v;
+
+  for (p=0, v=0;p<3;p++, v++) {
+    /* skip the triangles with a smaller star here */
+    while ((count=binomial(n-1-v,2-p))<=r) {
+      r-=count;
+      v++;
+    }
+    c[p]=v;
+  }
+}
+
+void *
+rankworker(void *arg) {
+  struct rankwork *w=(struct rankwork *) arg;
+  struct kdres *res;
+  unsigned long long r;
+  unsigned long t, m=0;
+  double pos[2], *shape;
+  int c[3], broken=0, k;
+
+  if (w->a>=w->b) return NULL;
+  unrank(w->a,w->n,c);
+  /* (was the row cut short before the first triangle?) */
+  for (k=c[1]+1;k<c[2] && !broken;k++) {
+    broken=triangleshape(w->xp,w->yp,c[0],c[1],k,pos);
+  }
+  for (r=w->a, t=0;r<w->b;r++, t++) {
+    memcpy(w->tri+3*t,c,sizeof(c));
+    shape=w->shape+2*t;
+    /* if the smallest side is less than a pixel, skip the rest of the row */
+    if (broken || (broken=triangleshape(w->xp,w->yp,c[0],c[1],c[2],shape))) {
+      shape[0]=shape[1]=NAN;
+    } else if (w->kd) {
+      /* find all the triangles from the short list that are within the dist_cut */
+      if ((res=kd_nearest_range(w->kd,shape,dist_cut))==NULL) {
+	w->error=1;
+	return NULL;
+      }
+      for (;!kd_res_end(res);kd_res_next(res)) {
+	if (m==w->foundalloc) {
+	  w->foundalloc=(w->foundalloc ? 2*w->foundalloc : 1024);
+	  if ((w->found=(struct rankfound *) realloc((void *) w->found,sizeof(struct rankfound)*w->foundalloc))==NULL) {
+	    w->error=1;
+	    return NULL;
+	  }
+	}
+	w->found[m].data=(int *) kd_res_item(res,pos);
+	w->found[m++].diff=hypot(pos[0]-shape[0],pos[1]-shape[1]);
+      }
+      kd_res_free(res);
+    }
+    w->nfound[t]=m;
+    /* the next triangle */
+    if (++c[2]==w->n) {
+      if (++c[1]==w->n-1) {
+	c[0]++;
+	c[1]=c[0]+1;
+      }
+      c[2]=c[1]+1;
+      broken=0;
+    }
+  }
+  return NULL;
+}
+
+/* every triangle of the n stars at xp, yp: added to build if it is not
+   null, otherwise matched against kd until there are enough matching
+   transforms */
+int
+rankbatches(int n, const double *xp, const double *yp, struct kdtree *build, struct kdtree *kd, int max_matches) {
+  pthread_t tid[MAXTHREADS];
+  struct rankwork *w;
+  unsigned long long r, e, total=binomial(n,3);
+  unsigned long t, f;
+  int i, *data, done=0;
+
+  if (rankwork==NULL && (rankwork=(struct rankwork *) calloc(nthreads,sizeof(struct rankwork)))==NULL) {
+    printf("Unable to allocate the threads at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  for (r=0;r<total && !done;r=e) {
+    e=(total-r>(unsigned long long) RANKBLOCK*nthreads ? r+(unsigned long long) RANKBLOCK*nthreads : total);
+    for (i=0;i<nthreads;i++) {
+      w=rankwork+i;
+      w->a=r+(e-r)*i/nthreads;
+      w->b=r+(e-r)*(i+1)/nthreads;
+      w->n=n;
+      w->xp=xp;
+      w->yp=yp;
+      w->kd=kd;
+      if (nthreads==1 || pthread_create(tid+i,NULL,rankworker,(void *) w)) {
+	/* run it here instead */
+	tid[i]=pthread_self();
+	rankworker((void *) w);
+      }
+    }
+    for (i=0;i<nthreads;i++) {
+      if (!pthread_equal(tid[i],pthread_self())) pthread_join(tid[i],NULL);
+    }
+    for (i=0, w=rankwork;i<nthreads && !done;i++, w++) {
+      if (w->error) {
+	printf("Unable to look up the triangles at %s:%d\n",__FILE__,__LINE__);
+	return -1;
+      }
+      for (t=0, f=0;t<w->b-w->a && !done;f=w->nfound[t++]) {
+	if (build) {
+	  if (isnan(w->shape[2*t])) continue;
+	  /* allocate an array to hold the points */
+	  if ((data=(int *) malloc(sizeof(int)*3))==NULL) {
+	    printf("Unable to allocate data at %s:%d\n",__FILE__,__LINE__);
+	    return -1;
+	  }
+	  memcpy(data,w->tri+3*t,sizeof(int)*3);
+	  /* add it to the tree */
+	  if (kd_insert(build, w->shape+2*t, (void *) data)) {
+	    printf("Unable to insert point into the tree at %s:%d\n",__FILE__,__LINE__);
+	    return -1;
+	  }
+	  continue;
+	}
+	/* if there are some triangles, then tell us about them */
+	for (;f<w->nfound[t] && matching_pairs<max_matches;f++) {
+	  if (verbose>0) { 
+	    printf("# diff= %g\n",w->found[f].diff); 
+	  }
+	  data=w->found[f].data;
+	  triangleoutput(w->tri[3*t],w->tri[3*t+1],w->tri[3*t+2],data[0],data[1],data[2]);
+	}
+	done=(matching_pairs>=max_matches);
+      }
+    }
+  }
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, max_matches=20;
+  int *data;
+  double atof();
+  struct kdtree *kd=NULL, *shells[8*sizeof(int)];
+  unsigned int cols1[]={1,2,0}, cols2[]={1,2,0};
+  char *names1[]={NULL,NULL,NULL}, *names2[]={NULL,NULL,NULL};
   char **argptr, *filename1=NULL, *filename2=NULL;
-  double *dptr[2];
+  double *dptr[3], *mag1=NULL, *mag2=NULL;
+  int nshell=0, a1, a2, b1, b2, done;
   char *fs1, *fs2;
 
   fs1 = strdup(" \t");
@@ -348,13 +801,31 @@ main(int argc, char *argv[])
    -t transform_cutoff how small of a distance to call a match - default %g\n\
    -p translate_factor factor to scale the x-translation       - default %g\n\
    -m max_matches      number of matching transforms to quit   - default %d\n\
-   -x1 column          column to read x-coordinate from file 1 - default %d\n\
-   -y1 column          column to read y-coordinate from file 1 - default %d\n\
-   -x2 column          column to read x-coordinate from file 2 - default %d\n\
-   -y2 column          column to read y-coordinate from file 2 - default %d\n\
+   -x1 col|name        column to read x-coordinate from file 1 - default %d\n\
+   -y1 col|name        column to read y-coordinate from file 1 - default %d\n\
+   -x2 col|name        column to read x-coordinate from file 2 - default %d\n\
+   -y2 col|name        column to read y-coordinate from file 2 - default %d\n\
    -fs  FS             field separator - default space/TAB\n\
    -fs1 FS             field separator for file 1\n\
    -fs2 FS             field separator for file 2\n\
+   -prior a b c d e f  a rough transformation from 1 to 2, as from -t of a\n\
+                       match with fewer stars: only the stars in the overlap\n\
+                       of the two fields are used\n\
+   -margin m           how far outside the overlap (in the coordinates of\n\
+                       file 2) stars are still used - default %g\n\
+   -mag1 col|name      column to read a magnitude from file 1\n\
+   -mag2 col|name      column to read a magnitude from file 2\n\
+   -shell n            match the triangles among the n brightest stars of\n\
+                       each file first (in the order of the files if there\n\
+                       are no magnitudes), then among the 2n brightest and\n\
+                       so on - default 10 if there are magnitudes\n\
+   -near k             only use the triangles of each star with two of its\n\
+                       k nearest neighbours, so that the work grows as the\n\
+                       number of stars rather than its cube\n\
+   -scale lo hi        with -near, the k nearest neighbours from lo to hi\n\
+                       away (looking further past those closer than lo)\n\
+   -j threads          search every triangle on this many threads (0 for\n\
+                       one per processor); the output is the same as on one\n\
    -ns                 Do not swap lists, even if the first is larger\n\
    -v                  be more verbose (more -v more verbose)\n\
    -q                  be less verbose (more -q less verbose)\n\
@@ -364,7 +835,7 @@ main(int argc, char *argv[])
    triangle_kd will try to match triangles in the two catalogues.  It is useful\n\
    when one expects there to be rotation, translation and scaling between the\n\
    two catalogues but no shearing.  If you do expect shearing, use quad_kd.\n",
-	   dist_cut,trans_cut,param2_factor,max_matches,cols1[0],cols1[1],cols2[0],cols2[1]);
+	   dist_cut,trans_cut,param2_factor,max_matches,cols1[0],cols1[1],cols2[0],cols2[1],margin);
     return -1;
   }
 
@@ -372,19 +843,57 @@ main(int argc, char *argv[])
   for (argptr=argv+1;argptr<argv+argc;argptr++) {
     if (strstr(*argptr,"-x1")) {
       if (++argptr<argv+argc) {
-	cols1[0]=atoi(*argptr);
+	loadfile_column(*argptr,cols1+0,names1+0);
       }
     } else if (strstr(*argptr,"-y1")) {
       if (++argptr<argv+argc) {
-	cols1[1]=atoi(*argptr);
+	loadfile_column(*argptr,cols1+1,names1+1);
       }
     } else if (strstr(*argptr,"-x2")) {
       if (++argptr<argv+argc) {
-	cols2[0]=atoi(*argptr);
+	loadfile_column(*argptr,cols2+0,names2+0);
       } 
     } else if (strstr(*argptr,"-y2")) {
       if (++argptr<argv+argc) {
-	cols2[1]=atoi(*argptr);
+	loadfile_column(*argptr,cols2+1,names2+1);
+      }
+    } else if (strstr(*argptr,"-prior")) {
+      /* (before -p) */
+      doprior=1;
+      for (i=0;i<6 && ++argptr<argv+argc;i++) {
+	prior[i]=atof(*argptr);
+      }
+    } else if (strstr(*argptr,"-margin")) {
+      /* (before -m) */
+      if (++argptr<argv+argc) {
+	margin=atof(*argptr);
+      }
+    } else if (strstr(*argptr,"-mag1")) {
+      if (++argptr<argv+argc) {
+	loadfile_column(*argptr,cols1+2,names1+2);
+      }
+    } else if (strstr(*argptr,"-mag2")) {
+      if (++argptr<argv+argc) {
+	loadfile_column(*argptr,cols2+2,names2+2);
+      }
+    } else if (strstr(*argptr,"-j")) {
+      if (++argptr<argv+argc) {
+	nthreads=atoi(*argptr);
+      }
+    } else if (strstr(*argptr,"-near")) {
+      if (++argptr<argv+argc) {
+	near=atoi(*argptr);
+      }
+    } else if (strstr(*argptr,"-scale")) {
+      if (++argptr<argv+argc) {
+	scalemin=atof(*argptr);
+      }
+      if (++argptr<argv+argc) {
+	scalemax=atof(*argptr);
+      }
+    } else if (strstr(*argptr,"-shell")) {
+      if (++argptr<argv+argc) {
+	shell=atoi(*argptr);
       }
     } else if (strstr(*argptr,"-d")) {
       if (++argptr<argv+argc) {
@@ -432,6 +941,9 @@ main(int argc, char *argv[])
 	filename2=*argptr;
     }
   }
+  if (nthreads<=0) nthreads=(int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (nthreads>MAXTHREADS) nthreads=MAXTHREADS;
+  if (nthreads<1) nthreads=1;
 
   if (verbose>0) {
     printf("#");
@@ -453,20 +965,32 @@ main(int argc, char *argv[])
     printf("# %s %s\n",filename1,filename2);
   }
 
+  /* the magnitudes are read as a third column */
+  i=(cols1[2] || names1[2] ? 3 : 2);
   if (strcmp(filename1,"-")) {
-    n1=loadfile_fs(filename1,2,cols1,dptr,fs1);
+    n1=loadfile_named_fs(filename1,i,cols1,names1,dptr,fs1);
   } else {
-    n1=loadfile_fileptr_fs(stdin,2,cols1,dptr,fs1);
+    n1=loadfile_named_fileptr_fs(stdin,i,cols1,names1,dptr,fs1);
   }
   xp1=dptr[0]; yp1=dptr[1];
+  if (i==3) mag1=dptr[2];
 
+  i=(cols2[2] || names2[2] ? 3 : 2);
   if (strcmp(filename2,"-")) {
-    n2=loadfile_fs(filename2,2,cols2,dptr,fs2); 
+    n2=loadfile_named_fs(filename2,i,cols2,names2,dptr,fs2); 
   } else {
-    n2=loadfile_fileptr_fs(stdin,2,cols2,dptr,fs2); 
+    n2=loadfile_named_fileptr_fs(stdin,i,cols2,names2,dptr,fs2); 
   }
   xp2=dptr[0]; yp2=dptr[1];
+  if (i==3) mag2=dptr[2];
+  if (shell<=0 && (mag1 || mag2)) shell=10;
 
+  /* leave out the stars that cannot be in both fields */
+  if (doprior) {
+    if (footprint_overlap(&n1,xp1,yp1,&id1,&n2,xp2,yp2,&id2,prior,margin)) return -1;
+    if (verbose>0) printf("# %u and %u points are in the overlap\n",n1,n2);
+  }
+  if ((mag1 && sortbymag(n1,xp1,yp1,mag1,&id1)) || (mag2 && sortbymag(n2,xp2,yp2,mag2,&id2))) return -1;
 
   /* output some information at the top */
   if (verbose>0) {
@@ -482,92 +1006,57 @@ main(int argc, char *argv[])
     dumptr=xp1; xp1=xp2; xp2=dumptr;
     dumptr=yp1; yp1=yp2; yp2=dumptr;
     i=n1; n1=n2; n2=i;
+    data=id1; id1=id2; id2=data;
     listswapped=1;
     if (verbose>0) printf("# For internal use the lists were swapped.\n");
   } else {
     listswapped=0;
   }
 
-
-  /* create the kd-tree for the triangles*/
-  kd = kd_create(2);
-  /* designate a function to deallocate the data */
-  kd_data_destructor(kd,free);
-
-  /* build the tree */
-  for (i=0;i<n1-2;i++) {
-    for (j=i+1;j<n1-1;j++) {
-      for (k=j+1;k<n1;k++) {
-	/* calculate side lengths */
-	la[0]=hypot(xp1[i]-xp1[j],yp1[i]-yp1[j]);
-	la[1]=hypot(xp1[j]-xp1[k],yp1[j]-yp1[k]);
-	la[2]=hypot(xp1[i]-xp1[k],yp1[i]-yp1[k]);
-	/* sort them */
-	qsort((void *) la,3,sizeof(double),dcomp);
-	/* if the smallest side is less than a pixel, skip this triangle */
-	if (la[2]<1) break;
-	/* calculate the side ratio */
-	ratioarray[0]=la[1]/la[0];
-	ratioarray[1]=la[2]/la[0];
-	/* allocate an array to hold the points */
-	data=(int *) malloc(sizeof(int)*3);
-	data[0]=i; data[1]=j; data[2]=k;
-	/* add it to the tree */
-	if (kd_insert(kd, ratioarray, (void *) data)) {
-	  printf("Unable to insert point into the tree at %s:%d\n",__FILE__,__LINE__);
-	  return -1;
-	}
-      }
-    }
+  if (near>1) {
+    if ((nlocal1=localtriangles(n1,xp1,yp1,&local1))<0 ||
+	(nlocal2=localtriangles(n2,xp2,yp2,&local2))<0) return -1;
+    if (verbose>0) printf("# %ld and %ld local triangles\n",nlocal1,nlocal2);
+  } else {
+    near=0;
   }
 
 
-  /* go through the triangles from the longer list */
-
   /* create the kd-tree for the matches */
   kd_good = kd_create(3);
   /* designate a function to deallocate the data */
   kd_data_destructor(kd_good,free);
 
-  for (i=0;i<n2-2;i++) {
-    for (j=i+1;j<n2-1;j++) {
-      for (k=j+1;k<n2;k++) {
-	/* calculate side lengths */
-	la[0]=hypot(xp2[i]-xp2[j],yp2[i]-yp2[j]);
-	la[1]=hypot(xp2[j]-xp2[k],yp2[j]-yp2[k]);
-	la[2]=hypot(xp2[i]-xp2[k],yp2[i]-yp2[k]);
-	/* sort them */
-	qsort((void *) la,3,sizeof(double),dcomp);
-
-	/* if the smallest side is less than a pixel, skip this triangle */
-	if (la[2]<1) break;
-
-	/* calculate the ratio */
-	ratioarray[0]=la[1]/la[0];
-	ratioarray[1]=la[2]/la[0];
-
-	/* find all the triangles from the first (short) list that are within the dist_cut */
-	res=kd_nearest_range(kd,ratioarray,dist_cut);
-
-	/* if there are some triangles, then tell us about them */
-	if (kd_res_size(res)>0) {
-	  while( !kd_res_end( res ) && matching_pairs<max_matches) {
-	    /* get the data and position of the current result item */
-	    data = (int*)kd_res_item( res, pos );
-	    if (verbose>0) { 
-	      diff=hypot(pos[0]-ratioarray[0],pos[1]-ratioarray[1]);
-	      printf("# diff= %g\n",diff); 
-	    }
-	    triangleoutput(i,j,k,data[0],data[1],data[2]);
-	    /* go to the next entry */
-	    kd_res_next( res );
-	  }
-	}
-	/* free the results structure */
-	kd_res_free(res);
-	if (matching_pairs>max_matches) { i=j=k=n2; }
+  if (shell>0) {
+    /* each shell of the short list is matched against the new stars of
+       the long list and every shell before, and against the stars of the
+       long list before it, so each pair of triangles is tried once */
+    for (a1=a2=done=0;!done && (a1<n1 || a2<n2);a1=b1, a2=b2) {
+      b1=((unsigned int) shell<<nshell<n1 ? shell<<nshell : (int) n1);
+      b2=((unsigned int) shell<<nshell<n2 ? shell<<nshell : (int) n2);
+      shells[nshell]=kd_create(2);
+      kd_data_destructor(shells[nshell],free);
+      if (addshell(shells[nshell++],a1,b1)) return -1;
+      for (i=0;i<nshell && !done;i++) {
+	done=matchshell(shells[i],a2,b2,max_matches);
       }
+      if (!done) done=matchshell(shells[nshell-1],0,a2,max_matches);
+      if (verbose>0) printf("# the %d and %d brightest points have been searched\n",b1,b2);
     }
+  } else if (near) {
+    kd = kd_create(2);
+    kd_data_destructor(kd,free);
+    if (addshell(kd,0,n1)) return -1;
+    matchshell(kd,0,n2,max_matches);
+  } else {
+    /* create the kd-tree for the triangles*/
+    kd = kd_create(2);
+    /* designate a function to deallocate the data */
+    kd_data_destructor(kd,free);
+
+    /* build the tree, then go through the triangles from the longer list */
+    if (rankbatches(n1,xp1,yp1,kd,NULL,0) ||
+	rankbatches(n2,xp2,yp2,NULL,kd,max_matches)) return -1;
   }
 
   /* output the best cooefficients */
@@ -583,6 +1072,9 @@ main(int argc, char *argv[])
 
   /* free the tree */
   kd_free(kd);
+  for (i=0;i<nshell;i++) {
+    kd_free(shells[i]);
+  }
   kd_free(kd_good);
   free ( (void *) fs1);
   free ( (void *) fs2);
@@ -590,5 +1082,11 @@ main(int argc, char *argv[])
   free ((void *) yp1);
   free ((void *) xp2);
   free ((void *) yp2);
+  free ((void *) id1);
+  free ((void *) id2);
+  free ((void *) mag1);
+  free ((void *) mag2);
+  free ((void *) local1);
+  free ((void *) local2);
   return 0;
 }
@@ -0,0 +1,350 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#include "zstream.h"
+
+/* decoded blocks in flight between the threads */
+#define ZBLOCK (1<<20)
+#define ZQUEUE 4
+#define ZINPUT 65536
+
+struct zblock {
+  char *data;
+  size_t len;
+};
+
+struct zstream {
+  FILE *in;
+  int type;
+  /* the magic bytes already read from in */
+  unsigned char magic[4];
+  size_t nmagic;
+  pthread_t tid;
+  pthread_mutex_t lock;
+  pthread_cond_t filled, emptied;
+  struct zblock block[ZQUEUE];
+  /* blocks are filled at head and read from tail */
+  unsigned int head, tail, count;
+  size_t pos;			/* read so far from the block at tail */
+  int done, error, stop;
+};
+
+int
+zstream_type(const unsigned char *magic, size_t len) {
+  if (len>=2 && magic[0]==0x1f && magic[1]==0x8b) return ZSTREAM_GZIP;
+  if (len>=4 && magic[0]==0x28 && magic[1]==0xb5 && magic[2]==0x2f && magic[3]==0xfd) return ZSTREAM_ZSTD;
+  return ZSTREAM_NONE;
+}
+
+/* the raw input, starting with the magic bytes already read */
+static size_t
+rawread(struct zstream *zs, unsigned char *buf, size_t len) {
+  size_t n=0;
+
+  if (zs->nmagic>0) {
+    n=(len<zs->nmagic ? len : zs->nmagic);
+    memcpy(buf,zs->magic,n);
+    memmove(zs->magic,zs->magic+n,zs->nmagic-n);
+    zs->nmagic-=n;
+  }
+  return n+fread(buf+n,1,len-n,zs->in);
+}
+
+/* the decoding thread's next empty block, or null to stop */
+static struct zblock *
+getempty(struct zstream *zs) {
+  struct zblock *b;
+
+  pthread_mutex_lock(&zs->lock);
+  while (zs->count==ZQUEUE && !zs->stop) {
+    pthread_cond_wait(&zs->emptied,&zs->lock);
+  }
+  b=(zs->stop ? NULL : zs->block+zs->head);
+  pthread_mutex_unlock(&zs->lock);
+  if (b) b->len=0;
+  return b;
+}
+
+static void
+putfilled(struct zstream *zs) {
+  pthread_mutex_lock(&zs->lock);
+  zs->head=(zs->head+1)%ZQUEUE;
+  zs->count++;
+  pthread_cond_signal(&zs->filled);
+  pthread_mutex_unlock(&zs->lock);
+}
+
+static int
+decodeplain(struct zstream *zs) {
+  struct zblock *b;
+
+  while ((b=getempty(zs))!=NULL) {
+    if ((b->len=rawread(zs,(unsigned char *) b->data,ZBLOCK))==0) break;
+    putfilled(zs);
+  }
+  return 0;
+}
+
+static int
+decodegzip(struct zstream *zs) {
+  z_stream z;
+  unsigned char *input;
+  struct zblock *b=NULL;
+  int ret=Z_OK;
+
+  if ((input=(unsigned char *) malloc(ZINPUT))==NULL) {
+    printf("Unable to allocate input buffer in %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  memset(&z,0,sizeof(z));
+  /* 32 lets zlib take a gzip or zlib header */
+  if (inflateInit2(&z,15+32)!=Z_OK) {
+    printf("Unable to start inflating at %s:%d\n",__FILE__,__LINE__);
+    free((void *) input);
+    return -1;
+  }
+  for (;;) {
+    if (z.avail_in==0) {
+      z.next_in=input;
+      if ((z.avail_in=rawread(zs,input,ZINPUT))==0) break;
+    }
+    if (ret==Z_STREAM_END) {
+      /* another member of a concatenated file */
+      inflateReset(&z);
+    }
+    if (b==NULL && (b=getempty(zs))==NULL) break;
+    z.next_out=(unsigned char *) b->data+b->len;
+    z.avail_out=ZBLOCK-b->len;
+    ret=inflate(&z,Z_NO_FLUSH);
+    if (ret!=Z_OK && ret!=Z_STREAM_END && ret!=Z_BUF_ERROR) {
+      printf("Corrupt gzip input (%s) at %s:%d\n",(z.msg ? z.msg : "?"),__FILE__,__LINE__);
+      break;
+    }
+    b->len=ZBLOCK-z.avail_out;
+    if (b->len==ZBLOCK) {
+      putfilled(zs);
+      b=NULL;
+    }
+  }
+  if (b && b->len>0) putfilled(zs);
+  inflateEnd(&z);
+  free((void *) input);
+  if (ret!=Z_STREAM_END && !zs->stop) {
+    if (ret==Z_OK || ret==Z_BUF_ERROR) printf("Truncated gzip input at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  return 0;
+}
+
+static int
+decodezstd(struct zstream *zs) {
+#ifdef HAVE_ZSTD
+  ZSTD_DStream *d;
+  ZSTD_inBuffer zin;
+  ZSTD_outBuffer zout;
+  unsigned char *input;
+  struct zblock *b=NULL;
+  size_t ret=0;
+
+  if ((input=(unsigned char *) malloc(ZINPUT))==NULL ||
+      (d=ZSTD_createDStream())==NULL) {
+    printf("Unable to start decompressing at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  ZSTD_initDStream(d);
+  zin.src=input;
+  zin.size=zin.pos=0;
+  for (;;) {
+    if (zin.pos==zin.size) {
+      zin.pos=0;
+      if ((zin.size=rawread(zs,input,ZINPUT))==0) break;
+    }
+    if (b==NULL && (b=getempty(zs))==NULL) break;
+    zout.dst=b->data;
+    zout.size=ZBLOCK;
+    zout.pos=b->len;
+    ret=ZSTD_decompressStream(d,&zout,&zin);
+    if (ZSTD_isError(ret)) {
+      printf("Corrupt zstd input (%s) at %s:%d\n",ZSTD_getErrorName(ret),__FILE__,__LINE__);
+      break;
+    }
+    b->len=zout.pos;
+    if (b->len==ZBLOCK) {
+      putfilled(zs);
+      b=NULL;
+    }
+  }
+  if (b && b->len>0) putfilled(zs);
+  ZSTD_freeDStream(d);
+  free((void *) input);
+  if (ret!=0 && !zs->stop) {
+    if (!ZSTD_isError(ret)) printf("Truncated zstd input at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  return 0;
+#else
+  printf("Not built with zstd (HAVE_ZSTD) at %s:%d\n",__FILE__,__LINE__);
+  return -1;
+#endif
+}
+
+static void *
+decodethread(void *arg) {
+  struct zstream *zs=(struct zstream *) arg;
+  int status;
+
+  switch (zs->type) {
+  case ZSTREAM_GZIP: status=decodegzip(zs); break;
+  case ZSTREAM_ZSTD: status=decodezstd(zs); break;
+  default: status=decodeplain(zs); break;
+  }
+  pthread_mutex_lock(&zs->lock);
+  zs->done=1;
+  if (status) zs->error=1;
+  pthread_cond_signal(&zs->filled);
+  pthread_mutex_unlock(&zs->lock);
+  return NULL;
+}
+
+int
+zstream_open(FILE *in, struct zstream **zs) {
+  unsigned char magic[4];
+  size_t n;
+  int type, i;
+
+  *zs=NULL;
+  n=fread(magic,1,4,in);
+  type=zstream_type(magic,n);
+  if (type==ZSTREAM_NONE && fseeko(in,-(off_t) n,SEEK_CUR)==0) {
+    return 0;
+  }
+  /* compressed, or a pipe that cannot be put back */
+  if ((*zs=(struct zstream *) calloc(1,sizeof(struct zstream)))==NULL) {
+    printf("Unable to allocate stream in %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  (*zs)->in=in;
+  (*zs)->type=type;
+  memcpy((*zs)->magic,magic,n);
+  (*zs)->nmagic=n;
+  for (i=0;i<ZQUEUE;i++) {
+    if (((*zs)->block[i].data=(char *) malloc(ZBLOCK))==NULL) {
+      printf("Unable to allocate stream blocks in %s:%d\n",__FILE__,__LINE__);
+      return -1;
+    }
+  }
+  pthread_mutex_init(&(*zs)->lock,NULL);
+  pthread_cond_init(&(*zs)->filled,NULL);
+  pthread_cond_init(&(*zs)->emptied,NULL);
+  if (pthread_create(&(*zs)->tid,NULL,decodethread,(void *) *zs)) {
+    printf("Unable to start decoding thread at %s:%d\n",__FILE__,__LINE__);
+    return -1;
+  }
+  return 0;
+}
+
+size_t
+zstream_read(struct zstream *zs, char *buf, size_t len) {
+  struct zblock *b;
+  size_t n, total=0;
+
+  while (total<len) {
+    pthread_mutex_lock(&zs->lock);
+    while (zs->count==0 && !zs->done) {
+      pthread_cond_wait(&zs->filled,&zs->lock);
+    }
+    if (zs->count==0) {
+      pthread_mutex_unlock(&zs->lock);
+      break;
+    }
+    pthread_mutex_unlock(&zs->lock);
+    /* the block at tail is ours until it is handed back */
+    b=zs->block+zs->tail;
+    n=b->len-zs->pos;
+    if (n>len-total) n=len-total;
+    memcpy(buf+total,b->data+zs->pos,n);
+    total+=n;
+    zs->pos+=n;
+    if (zs->pos==b->len) {
+      pthread_mutex_lock(&zs->lock);
+      zs->tail=(zs->tail+1)%ZQUEUE;
+      zs->count--;
+      zs->pos=0;
+      pthread_cond_signal(&zs->emptied);
+      pthread_mutex_unlock(&zs->lock);
+    }
+  }
+  return total;
+}
+
+int
+zstream_close(struct zstream *zs) {
+  int error, i;
+
+  pthread_mutex_lock(&zs->lock);
+  zs->stop=1;
+  pthread_cond_signal(&zs->emptied);
+  pthread_mutex_unlock(&zs->lock);
+  pthread_join(zs->tid,NULL);
+  error=zs->error;
+  for (i=0;i<ZQUEUE;i++) {
+    free((void *) zs->block[i].data);
+  }
+  pthread_mutex_destroy(&zs->lock);
+  pthread_cond_destroy(&zs->filled);
+  pthread_cond_destroy(&zs->emptied);
+  free((void *) zs);
+  return (error ? -1 : 0);
+}
+
+static ssize_t
+cookieread(void *cookie, char *buf, size_t len) {
+  return zstream_read((struct zstream *) cookie,buf,len);
+}
+
+static int
+cookieclose(void *cookie) {
+  return zstream_close((struct zstream *) cookie);
+}
+
+FILE *
+zstream_fopen(struct zstream *zs) {
+  cookie_io_functions_t io={cookieread,NULL,NULL,cookieclose};
+
+  return fopencookie((void *) zs,"r",io);
+}
@@ -0,0 +1,54 @@
+/*
+This file is part of ``kd-match'', a suite of programs for matching stellar catalogues
+with coordinate systems that differ through affine transformations (rotations, 
+translations, shearing and scaling). 
+Copyright (C) 2013 Jeremy Heyl <heyl@phas.ubc.ca>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. The name of the author may not be used to endorse or promote products
+   derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR IMPLIED
+WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO
+EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING
+IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY
+OF SUCH DAMAGE.
+*/
+#ifndef _ZSTREAM_H_
+#define _ZSTREAM_H_
+
+/* Compressed input (gzip, or zstd if built with HAVE_ZSTD) recognised by
+   its magic bytes and decoded on a thread of its own, which hands the
+   reader blocks through a short queue. */
+
+#define ZSTREAM_NONE 0
+#define ZSTREAM_GZIP 1
+#define ZSTREAM_ZSTD 2
+
+struct zstream;
+
+/* which kind of stream begins with these bytes */
+int zstream_type(const unsigned char *magic, size_t len);
+/* start decoding in: *zs is null if in is plain and could be rewound,
+   otherwise it is read through the decoding thread; -1 on error */
+int zstream_open(FILE *in, struct zstream **zs);
+/* read up to len decoded bytes, waiting for them; 0 at the end */
+size_t zstream_read(struct zstream *zs, char *buf, size_t len);
+/* stop the thread; returns -1 if the stream was corrupt */
+int zstream_close(struct zstream *zs);
+/* a stream reading the decoded text; closing it closes zs (not the file) */
+FILE *zstream_fopen(struct zstream *zs);
+
+#endif	/* _ZSTREAM_H_ */